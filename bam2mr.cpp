@@ -28,6 +28,11 @@
 #include <iostream>
 #include <fstream>
 #include <queue>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <tr1/unordered_map>
 
 #include "OptionParser.hpp"
@@ -35,6 +40,9 @@
 #include "smithlab_os.hpp"
 #include "SAM.hpp"
 
+#include "buffered_output.hpp"
+#include "binary_mapped_reads.hpp"
+
 using std::string;
 using std::vector;
 using std::cout;
@@ -51,19 +59,118 @@ using std::tr1::unordered_map;
 
 
 /********Below are functions for merging pair-end reads********/
+
+// The bases and quality scores of one read. The buffers are recycled
+// through a ReadBufferPool, so after the first few thousand reads the
+// records are moved in and out of strings that already have the memory.
+struct ReadBuffer {
+  string seq;
+  string scr;
+};
+
+class ReadBufferPool {
+public:
+  ReadBuffer *get() {
+    if (free_buffers.empty()) {
+      buffers.push_back(ReadBuffer());
+      return &buffers.back();
+    }
+    ReadBuffer *buf = free_buffers.back();
+    free_buffers.pop_back();
+    return buf;
+  }
+  void release(ReadBuffer *buf) {free_buffers.push_back(buf);}
+
+private:
+  std::deque<ReadBuffer> buffers;
+  vector<ReadBuffer *> free_buffers;
+};
+
+
+// a mapped end waiting for its mate, its sequence in a pooled buffer
+struct Mate {
+  Mate() : buf(NULL), is_Trich(false), seg_len(0) {}
+  GenomicRegion r;
+  ReadBuffer *buf;
+  bool is_Trich;
+  int seg_len;
+};
+
+static void
+take_mate(SAMRecord &samr, ReadBufferPool &buffers, Mate &mate) {
+  std::swap(mate.r, samr.mr.r);
+  mate.buf = buffers.get();
+  mate.buf->seq.swap(samr.mr.seq);
+  mate.buf->scr.swap(samr.mr.scr);
+  mate.is_Trich = samr.is_Trich;
+  mate.seg_len = samr.seg_len;
+}
+
+static std::ostream &
+operator<<(std::ostream &os, const Mate &mate) {
+  return os << mate.r << '\t' << mate.buf->seq << '\t' << mate.buf->scr;
+}
+
+
+// A read or a pair of merged mates waiting to be written. A merged
+// fragment only refers to the buffers of its mates: its sequence is the
+// first lim_one bases of one, the overlap taken from the bases
+// [overlap_first, overlap_first + overlap_len) of the mate in overlap,
+// N for any gap, and the last lim_two bases of two. The sequence is
+// put together by materialize when the fragment is written.
+struct Fragment {
+  Fragment() : one(NULL), two(NULL), length(0), lim_one(0), lim_two(0),
+               overlap(NULL), overlap_first(0), overlap_len(0) {}
+  explicit Fragment(const Mate &mate) :
+    r(mate.r), one(mate.buf), two(NULL), length(0), lim_one(0), lim_two(0),
+    overlap(NULL), overlap_first(0), overlap_len(0) {}
+  bool is_merged() const {return two != NULL;}
+
+  GenomicRegion r;
+  ReadBuffer *one;
+  ReadBuffer *two;
+  size_t length;
+  size_t lim_one;
+  size_t lim_two;
+  const ReadBuffer *overlap;
+  size_t overlap_first;
+  size_t overlap_len;
+};
+
 static void
-fill_overlap(const bool pos_str, const MappedRead &mr, const size_t start, 
-             const size_t end, const size_t offset, string &seq, string &scr) {
-  const size_t a = pos_str ? (start - mr.r.get_start()) : (mr.r.get_end() - end);
-  const size_t b = pos_str ? (end -  mr.r.get_start()) : (mr.r.get_end() - start);
-  copy(mr.seq.begin() + a, mr.seq.begin() + b, seq.begin() + offset);
-  copy(mr.scr.begin() + a, mr.scr.begin() + b, scr.begin() + offset);
+materialize(const Fragment &frag, string &seq, string &scr) {
+  seq.assign(frag.length, 'N');
+  scr.assign(frag.length, 'B');
+  const ReadBuffer &one = *frag.one;
+  const ReadBuffer &two = *frag.two;
+  copy(one.seq.begin(), one.seq.begin() + frag.lim_one, seq.begin());
+  copy(one.scr.begin(), one.scr.begin() + frag.lim_one, scr.begin());
+  copy(two.seq.end() - frag.lim_two, two.seq.end(), seq.end() - frag.lim_two);
+  copy(two.scr.end() - frag.lim_two, two.scr.end(), scr.end() - frag.lim_two);
+  if (frag.overlap != NULL) {
+    const size_t a = frag.overlap_first, b = a + frag.overlap_len;
+    copy(frag.overlap->seq.begin() + a, frag.overlap->seq.begin() + b,
+         seq.begin() + frag.lim_one);
+    copy(frag.overlap->scr.begin() + a, frag.overlap->scr.begin() + b,
+         scr.begin() + frag.lim_one);
+  }
+}
+
+
+static void
+set_overlap(const bool pos_str, const Mate &mate, const size_t start,
+            const size_t end, Fragment &merged) {
+  const size_t a = pos_str ? (start - mate.r.get_start()) : (mate.r.get_end() - end);
+  const size_t b = pos_str ? (end -  mate.r.get_start()) : (mate.r.get_end() - start);
+  merged.overlap = mate.buf;
+  merged.overlap_first = a;
+  merged.overlap_len = b - a;
 }
 
 static bool
 merge_mates(const size_t suffix_len, const size_t range,
-            const MappedRead &one, const MappedRead &two,
-            MappedRead &merged, int &len) {
+            const Mate &one, const Mate &two,
+            Fragment &merged, int &len) {
   
   const bool pos_str = one.r.pos_strand();
   const size_t overlap_start = max(one.r.get_start(), two.r.get_start());
@@ -91,40 +198,39 @@ merge_mates(const size_t suffix_len, const size_t range,
   // assert(overlap_start >= overlap_end || static_cast<size_t>(len) == 
   //    ((one_right - one_left) + (two_right - two_left) + (overlap_end - overlap_start)));
   
-  string seq(len, 'N');
-  string scr(len, 'B');
-  if (len >= 0 && len <= static_cast<int>(range)) {
-    // lim_one: offset in merged sequence where overlap starts
-    const size_t lim_one = one_right - one_left;
-    copy(one.seq.begin(), one.seq.begin() + lim_one, seq.begin());
-    copy(one.scr.begin(), one.scr.begin() + lim_one, scr.begin());
+  // fragments longer than range are split by the caller, so only the
+  // spans are worked out here and nothing is copied
+  if (len > static_cast<int>(range))
+    return true;
+
+  merged.one = one.buf;
+  merged.two = two.buf;
+  merged.length = len;
+  // lim_one: offset in merged sequence where overlap starts
+  merged.lim_one = one_right - one_left;
+  merged.lim_two = two_right - two_left;
     
-    const size_t lim_two = two_right - two_left;
-    copy(two.seq.end() - lim_two, two.seq.end(), seq.end() - lim_two);
-    copy(two.scr.end() - lim_two, two.scr.end(), scr.end() - lim_two);
-    
-    // deal with overlapping part
-    if (overlap_start < overlap_end) {
-      const size_t one_bads = count(one.seq.begin(), one.seq.end(), 'N');
-      const int info_one = one.seq.length() - (one_bads + one.r.get_score());
-      
-      const size_t two_bads = count(two.seq.begin(), two.seq.end(), 'N');
-      const int info_two = two.seq.length() - (two_bads + two.r.get_score());
+  // deal with overlapping part
+  if (overlap_start < overlap_end) {
+    const string &one_seq = one.buf->seq;
+    const size_t one_bads = count(one_seq.begin(), one_seq.end(), 'N');
+    const int info_one = one_seq.length() - (one_bads + one.r.get_score());
+
+    const string &two_seq = two.buf->seq;
+    const size_t two_bads = count(two_seq.begin(), two_seq.end(), 'N');
+    const int info_two = two_seq.length() - (two_bads + two.r.get_score());
       
-      // use the mate with the most info to fill in the overlap
-      if (info_one >= info_two)
-	fill_overlap(pos_str, one, overlap_start, overlap_end, lim_one, seq, scr);
-      else
-	fill_overlap(pos_str, two, overlap_start, overlap_end, lim_one, seq, scr);
-    }
+    // use the mate with the most info to fill in the overlap
+    if (info_one >= info_two)
+      set_overlap(pos_str, one, overlap_start, overlap_end, merged);
+    else
+      set_overlap(pos_str, two, overlap_start, overlap_end, merged);
   }
   
-  merged = one;
+  merged.r = one.r;
   merged.r.set_start(pos_str ? one.r.get_start() : two.r.get_start());
   merged.r.set_end(merged.r.get_start() + len);
   merged.r.set_score(one.r.get_score() + two.r.get_score());
-  merged.seq = seq;
-  merged.scr = scr;  
   const string name(one.r.get_name());
   merged.r.set_name("FRAG:" + name.substr(0, name.size() - suffix_len));
 
@@ -133,94 +239,379 @@ merge_mates(const size_t suffix_len, const size_t range,
 
 inline static bool
 same_read(const size_t suffix_len, 
-	  const MappedRead &a, const MappedRead &b) {
-  const string sa(a.r.get_name());
-  const string sb(b.r.get_name());
+	  const GenomicRegion &a, const GenomicRegion &b) {
+  const string sa(a.get_name());
+  const string sb(b.get_name());
   bool SAME_NAME = false;
   if(sa == sb)
     SAME_NAME = true;
-  return (SAME_NAME && a.r.same_chrom(b.r));
+  return (SAME_NAME && a.same_chrom(b));
 }
 
 
 
 static void
-revcomp(MappedRead &mr) {
+revcomp(Mate &mate) {
   // set the strand to the opposite of the current value
-  mr.r.set_strand(mr.r.pos_strand() ? '-' : '+');
+  mate.r.set_strand(mate.r.pos_strand() ? '-' : '+');
   // reverse complement the sequence, and reverse the quality scores
-  revcomp_inplace(mr.seq);
-  std::reverse(mr.scr.begin(), mr.scr.end());
+  revcomp_inplace(mate.buf->seq);
+  std::reverse(mate.buf->scr.begin(), mate.buf->scr.end());
 }
 /********Above are functions for merging pair-end reads********/
 
 
+// same text as operator<< for MappedRead
+static void
+write_mapped_read(const GenomicRegion &r, const string &seq,
+                  const string &scr, BufferedOutput &out) {
+  const string name(r.get_name());
+  out << r.get_chrom() << '\t' << r.get_start() << '\t' << r.get_end();
+  if (!name.empty())
+    out << '\t' << name << '\t' << r.get_score() << '\t' << r.get_strand();
+  out << '\t' << seq << '\t' << scr << '\n';
+}
+
+
+
+/////pipeline stages////////////////////////////////////////
+
+// A batch keeps the items past size for their memory, so records are
+// assigned into buffers that stay with one thread instead of being
+// allocated on one thread and freed on another.
+template <class T>
+struct Batch {
+  Batch() : size(0) {}
+  T &next() {
+    if (size == items.size())
+      items.push_back(T());
+    return items[size++];
+  }
+  vector<T> items;
+  size_t size;
+};
+
+
+// Batches handed from one thread to the next. push blocks while
+// max_batches are waiting and returns false once the queue is closed;
+// pop returns false once the queue is closed and empty. Each call
+// hands back an emptied batch in place of the one it takes.
+template <class T>
+class BatchQueue {
+public:
+  BatchQueue(const size_t mb) : max_batches(mb), CLOSED(false) {}
+
+  bool push(Batch<T> &batch) {
+    std::unique_lock<std::mutex> lock(mtx);
+    not_full.wait(lock, [this] {
+        return batches.size() < max_batches || CLOSED;
+      });
+    if (CLOSED)
+      return false;
+    batches.push_back(Batch<T>());
+    std::swap(batches.back(), batch);
+    if (!spare.empty()) {
+      std::swap(batch, spare.back());
+      spare.pop_back();
+    }
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+  }
+
+  bool pop(Batch<T> &batch) {
+    std::unique_lock<std::mutex> lock(mtx);
+    not_empty.wait(lock, [this] {return !batches.empty() || CLOSED;});
+    if (batches.empty())
+      return false;
+    batch.size = 0;
+    spare.push_back(Batch<T>());
+    std::swap(spare.back(), batch);
+    std::swap(batch, batches.front());
+    batches.pop_front();
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      CLOSED = true;
+    }
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+private:
+  const size_t max_batches;
+  std::deque<Batch<T> > batches;
+  vector<Batch<T> > spare;
+  std::mutex mtx;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  bool CLOSED;
+};
+
+
+// Reads SAM records, on a thread of its own when THREADED so decoding
+// the BAM overlaps with merging the mates.
+class SAMRecordSource {
+public:
+  SAMRecordSource(const string &file_name, const string &mapper,
+                  const bool THREADED);
+  ~SAMRecordSource();
+
+  bool read(SAMRecord &samr);
+
+private:
+  void run();
+
+  static const size_t batch_size = 4096;
+
+  SAMReader sam_reader;
+  BatchQueue<SAMRecord> batches;
+  Batch<SAMRecord> batch;
+  size_t batch_pos;
+  std::exception_ptr error;
+  std::thread thread;
+};
+
+
+SAMRecordSource::SAMRecordSource(const string &file_name,
+                                 const string &mapper, const bool THREADED) :
+  sam_reader(file_name, mapper), batches(16), batch_pos(0) {
+  if (THREADED)
+    thread = std::thread(&SAMRecordSource::run, this);
+}
+
+
+SAMRecordSource::~SAMRecordSource() {
+  if (thread.joinable()) {
+    batches.close();
+    thread.join();
+  }
+}
+
+
+void
+SAMRecordSource::run() {
+  try {
+    Batch<SAMRecord> records;
+    while ((sam_reader >> records.next(), sam_reader.is_good())) {
+      if (records.size == batch_size && !batches.push(records))
+        return;
+    }
+    --records.size;
+    if (records.size > 0)
+      batches.push(records);
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+  batches.close();
+}
+
+
+bool
+SAMRecordSource::read(SAMRecord &samr) {
+  if (!thread.joinable())
+    return (sam_reader >> samr, sam_reader.is_good());
+
+  if (batch_pos == batch.size) {
+    batch_pos = 0;
+    if (!batches.pop(batch)) {
+      if (error)
+        std::rethrow_exception(error);
+      return false;
+    }
+  }
+  samr = batch.items[batch_pos++];
+  return true;
+}
+
+
+// Formats and writes the reads, as text or in the binary format of
+// binary_mapped_reads.hpp, on a thread of its own when THREADED.
+// Merged fragments are put together from their mates' buffers as they
+// are written, straight into the batch for the writing thread when
+// there is one, so the buffers can go back to the pool as soon as
+// write returns. Errors from the writing thread are thrown by close().
+class MappedReadWriter {
+public:
+  MappedReadWriter(const string &outfile, const bool BGZF_OUTPUT,
+                   const bool BINARY, const bool THREADED);
+  ~MappedReadWriter();
+
+  void write(const Fragment &frag);
+  void close();
+
+private:
+  void run();
+  void format(const GenomicRegion &r, const string &seq, const string &scr);
+  void rethrow_writer_error();
+
+  static const size_t batch_size = 4096;
+
+  BufferedOutput out;
+  const bool BINARY;
+  BinaryReadEncoder encoder;
+  string encoded;
+  MappedRead merged;
+  BatchQueue<MappedRead> batches;
+  Batch<MappedRead> pending;
+  std::exception_ptr error;
+  std::thread thread;
+};
+
+
+MappedReadWriter::MappedReadWriter(const string &outfile,
+                                   const bool BGZF_OUTPUT, const bool B,
+                                   const bool THREADED) :
+  out(outfile, BGZF_OUTPUT), BINARY(B), batches(16) {
+  if (BINARY) {
+    encoder.encode_header(encoded);
+    out << encoded;
+  }
+  if (THREADED)
+    thread = std::thread(&MappedReadWriter::run, this);
+}
+
+
+MappedReadWriter::~MappedReadWriter() {
+  if (thread.joinable()) {
+    batches.close();
+    thread.join();
+  }
+}
+
+
+void
+MappedReadWriter::run() {
+  try {
+    Batch<MappedRead> reads;
+    while (batches.pop(reads))
+      for (size_t i = 0; i < reads.size; ++i)
+        format(reads.items[i].r, reads.items[i].seq, reads.items[i].scr);
+  }
+  catch (...) {
+    error = std::current_exception();
+    batches.close();
+  }
+}
+
+
+void
+MappedReadWriter::format(const GenomicRegion &r, const string &seq,
+                         const string &scr) {
+  if (!BINARY)
+    write_mapped_read(r, seq, scr, out);
+  else {
+    encoded.clear();
+    encoder.encode(r.get_chrom(), r.get_start(), r.get_end(),
+                   r.pos_strand(), seq, encoded);
+    out << encoded;
+  }
+}
+
+
+void
+MappedReadWriter::write(const Fragment &frag) {
+  if (!thread.joinable()) {
+    if (!frag.is_merged())
+      format(frag.r, frag.one->seq, frag.one->scr);
+    else {
+      materialize(frag, merged.seq, merged.scr);
+      format(frag.r, merged.seq, merged.scr);
+    }
+    return;
+  }
+  MappedRead &mr = pending.next();
+  mr.r = frag.r;
+  if (!frag.is_merged()) {
+    mr.seq.assign(frag.one->seq);
+    mr.scr.assign(frag.one->scr);
+  }
+  else materialize(frag, mr.seq, mr.scr);
+  if (pending.size == batch_size && !batches.push(pending))
+    rethrow_writer_error();
+}
+
+
+// the queue only closes early when the writer thread has failed
+void
+MappedReadWriter::rethrow_writer_error() {
+  thread.join();
+  if (error)
+    std::rethrow_exception(error);
+  throw SMITHLABException("output writer stopped early");
+}
+
+
+void
+MappedReadWriter::close() {
+  if (thread.joinable()) {
+    if (pending.size > 0)
+      batches.push(pending);
+    batches.close();
+    thread.join();
+    if (error)
+      std::rethrow_exception(error);
+  }
+  out.close();
+}
+
+
 /////comparison function for priority queue/////////////////
 
 /**************** FOR CLARITY BELOW WHEN COMPARING READS *************/
 static inline bool
-chrom_greater(const MappedRead &a, const MappedRead &b) {
-    return a.r.get_chrom() > b.r.get_chrom();
+chrom_greater(const GenomicRegion &a, const GenomicRegion &b) {
+    return a.get_chrom() > b.get_chrom();
 }
 static inline bool
-same_start(const MappedRead &a, const MappedRead &b) {
-    return a.r.get_start() == b.r.get_start();
+same_start(const GenomicRegion &a, const GenomicRegion &b) {
+    return a.get_start() == b.get_start();
 }
 static inline bool
-start_greater(const MappedRead &a, const MappedRead &b) {
-    return a.r.get_start() > b.r.get_start();
+start_greater(const GenomicRegion &a, const GenomicRegion &b) {
+    return a.get_start() > b.get_start();
 }
 static inline bool
-end_greater(const MappedRead &a, const MappedRead &b) {
-    return a.r.get_end() > b.r.get_end();
+end_greater(const GenomicRegion &a, const GenomicRegion &b) {
+    return a.get_end() > b.get_end();
 }
 /******************************************************************************/
 
 
-struct MappedReadOrderChecker {
-    bool operator()(const MappedRead &prev, const MappedRead &gr) const {
-        return start_check(prev, gr);
+struct FragmentOrderChecker {
+    bool operator()(const Fragment &prev, const Fragment &frag) const {
+        return start_check(prev.r, frag.r);
     }
     static bool
-    is_ready(const priority_queue<MappedRead, vector<MappedRead>, MappedReadOrderChecker> &pq,
-             const MappedRead &mr, const size_t max_width) {
-        return !pq.top().r.same_chrom(mr.r) || pq.top().r.get_end() + max_width < mr.r.get_start();
+    is_ready(const priority_queue<Fragment, vector<Fragment>, FragmentOrderChecker> &pq,
+             const GenomicRegion &r, const size_t max_width) {
+        return !pq.top().r.same_chrom(r) || pq.top().r.get_end() + max_width < r.get_start();
     }
     static bool
-    start_check(const MappedRead &prev, const MappedRead &mr) {
-        return (chrom_greater(prev, mr)
-                || (prev.r.same_chrom(mr.r) && start_greater(prev, mr))
-                || (prev.r.same_chrom(mr.r) && same_start(prev, mr) && end_greater(prev, mr)));
+    start_check(const GenomicRegion &prev, const GenomicRegion &r) {
+        return (chrom_greater(prev, r)
+                || (prev.same_chrom(r) && start_greater(prev, r))
+                || (prev.same_chrom(r) && same_start(prev, r) && end_greater(prev, r)));
     }
 };
 
 
-
-static void empty_pq(MappedRead &prev_mr,
-                     priority_queue<MappedRead, vector<MappedRead>,
-                                    MappedReadOrderChecker> &read_pq,
-                     const string &input_file_name,
-		     std::ostream& out){
-    
-  MappedRead curr_mr = read_pq.top();
-    //	       cerr << "outputting from queue : " << read_pq.top() << endl;
+// writes the first fragment in the queue and gives its buffers back
+static void empty_pq(priority_queue<Fragment, vector<Fragment>,
+                                    FragmentOrderChecker> &read_pq,
+                     ReadBufferPool &buffers, MappedReadWriter &out){
+  const Fragment &frag = read_pq.top();
+  out.write(frag);
+  buffers.release(frag.one);
+  if (frag.is_merged())
+    buffers.release(frag.two);
   read_pq.pop();
-
-  /*
-    // check if reads are sorted
-  if (curr_mr.r.same_chrom(prev_mr.r) &&
-      curr_mr.r.get_start() < prev_mr.r.get_start()
-      && curr_mr.r.get_end() < prev_mr.r.get_end()){
-    cerr << "prev = \t" << prev_mr << endl;
-    cerr << "curr = \t" << curr_mr << endl;
-    cerr << "Increase seg_len if in paired end mode" << endl;
-    throw SMITHLABException("reads unsorted in " + input_file_name);
-  }
-  */
-
-  out << curr_mr << endl;
-
-  prev_mr = curr_mr;
 }
 
 
@@ -232,7 +623,10 @@ main(int argc, const char **argv) {
     size_t MAX_SEGMENT_LENGTH = 10000;
     size_t suffix_len = 0;
     bool VERBOSE = false;
+    bool BGZF_OUTPUT = false;
+    bool BINARY_OUTPUT = false;
     size_t MAX_READS_TO_HOLD = 1000000;
+    size_t n_threads = 1;
     
     /****************** COMMAND LINE OPTIONS ********************/
     OptionParser opt_parse(strip_path(argv[0]),
@@ -245,6 +639,13 @@ main(int argc, const char **argv) {
                       false, MAX_SEGMENT_LENGTH); 
     opt_parse.add_opt("max_reads", 'R', "maximum number of reads to hold for merging",
 		      false, MAX_READS_TO_HOLD);
+    opt_parse.add_opt("bgzf", 'z', "compress the output with BGZF",
+                      false, BGZF_OUTPUT);
+    opt_parse.add_opt("binary", 'b', "write the compact binary format "
+                      "read by gc_extrap", false, BINARY_OUTPUT);
+    opt_parse.add_opt("threads", 'T', "number of threads, more than one "
+                      "decodes, merges and writes on separate threads",
+                      false, n_threads);
     opt_parse.add_opt("verbose", 'v', "print more information",
                       false, VERBOSE);
 
@@ -268,120 +669,106 @@ main(int argc, const char **argv) {
       return EXIT_SUCCESS;
     }
     const string mapped_reads_file = leftover_args.front();
+    if (BINARY_OUTPUT && BGZF_OUTPUT)
+      throw SMITHLABException("binary output is read uncompressed, "
+                              "choose one of --binary and --bgzf");
     /****************** END COMMAND LINE OPTIONS *****************/
 
-    std::ofstream of;
-    if (!outfile.empty()) of.open(outfile.c_str());
-    std::ostream out(outfile.empty() ? cout.rdbuf() : of.rdbuf());
+    const bool THREADED = n_threads > 1;
+    MappedReadWriter out(outfile, BGZF_OUTPUT, BINARY_OUTPUT, THREADED);
     if (VERBOSE)
     {
       cerr << "Input file: " << mapped_reads_file << endl
            << "Output file: " << (outfile.empty() ? "stdout" : outfile) << endl;
     }
 
-    SAMReader sam_reader(mapped_reads_file, mapper);
-    std::tr1::unordered_map<string, SAMRecord> dangling_mates;
+    SAMRecordSource sam_reader(mapped_reads_file, mapper, THREADED);
+    ReadBufferPool buffers;
+    std::tr1::unordered_map<string, Mate> dangling_mates;
    
     const size_t progress_step = 1000000;
     SAMRecord samr;
-    MappedRead prev_mr;
     size_t n_mates = 0;
 
-    std::priority_queue<MappedRead, vector<MappedRead>, MappedReadOrderChecker> read_pq;
+    std::priority_queue<Fragment, vector<Fragment>, FragmentOrderChecker> read_pq;
 
-    while ((sam_reader >> samr, sam_reader.is_good()))
+    while (sam_reader.read(samr))
     {
       if(samr.is_primary && samr.is_mapped){
 	// only convert mapped and primary reads
 	++n_mates;
+	Mate mate;
+	take_mate(samr, buffers, mate);
 	if (samr.is_mapping_paired){
 	  const string read_name
-	    = samr.mr.r.get_name().substr(0, samr.mr.r.get_name().size() - suffix_len);
+	    = mate.r.get_name().substr(0, mate.r.get_name().size() - suffix_len);
 
 	  if (dangling_mates.find(read_name) != dangling_mates.end()){
 	    // other end is in dangling mates, merge the two mates
-	    if(same_read(suffix_len, samr.mr, dangling_mates[read_name].mr)){
-	      if (samr.is_Trich) std::swap(samr, dangling_mates[read_name]);
+	    if(same_read(suffix_len, mate.r, dangling_mates[read_name].r)){
+	      if (mate.is_Trich) std::swap(mate, dangling_mates[read_name]);
 
-	      revcomp(samr.mr);
+	      revcomp(mate);
 
-	      MappedRead merged;
+	      Fragment merged;
 	      int len = 0;
 	      bool MERGE_SUCCESS =
 		merge_mates(suffix_len, MAX_SEGMENT_LENGTH,
-			    dangling_mates[read_name].mr, samr.mr, merged, len);
+			    dangling_mates[read_name], mate, merged, len);
 
 	      if (MERGE_SUCCESS && 
 		  len >= 0 && 
 		  len <= static_cast<int>(MAX_SEGMENT_LENGTH)){
-		//if(read_pq.empty())
-		//prev_mr = merged;
-		//else
 		  read_pq.push(merged);
 	      }
 	      else{
 		// informative error message!
 		if(VERBOSE){
 		  cerr << "problem merging read " << read_name << ", splitting read" << endl;
-		  cerr << samr.mr << endl;
-		  cerr << dangling_mates[read_name].mr << endl;
+		  cerr << mate << endl;
+		  cerr << dangling_mates[read_name] << endl;
 		  cerr << "To merge, set max segement length (seg_len) higher." << endl;
 		}
 
 		// don't throw error for problems merging
-		//if(read_pq.empty()){
-		// prev_mr = dangling_mates[read_name].mr;
-		// read_pq.push(samr.mr);
-		//}
-		//else{
-		  read_pq.push(samr.mr);
-		  read_pq.push(dangling_mates[read_name].mr);
-		  //}
+		  read_pq.push(Fragment(mate));
+		  read_pq.push(Fragment(dangling_mates[read_name]));
 	      }
 
 	      dangling_mates.erase(read_name);
 	    }
 	    else{
-	      //if(read_pq.empty()){
-	      //prev_mr = dangling_mates[read_name].mr;
-	      //read_pq.push(samr.mr);
-	      //}
-	      //else{
-		read_pq.push(samr.mr);
-		read_pq.push(dangling_mates[read_name].mr);
-		//}
+		read_pq.push(Fragment(mate));
+		read_pq.push(Fragment(dangling_mates[read_name]));
 	      dangling_mates.erase(read_name);
 	    }
 
 	    if(!(read_pq.empty()) &&
-	       MappedReadOrderChecker::is_ready(read_pq, samr.mr, MAX_SEGMENT_LENGTH)) {
+	       FragmentOrderChecker::is_ready(read_pq, mate.r, MAX_SEGMENT_LENGTH)) {
 	      //begin emptying priority queue
 	      while(!(read_pq.empty()) &&
-		    MappedReadOrderChecker::is_ready(read_pq, samr.mr, MAX_SEGMENT_LENGTH) ){
-		empty_pq(prev_mr, read_pq, mapped_reads_file, out);
+		    FragmentOrderChecker::is_ready(read_pq, mate.r, MAX_SEGMENT_LENGTH) ){
+		empty_pq(read_pq, buffers, out);
 	      }//end while loop
 	    }//end statement for emptying priority queue
 
 	  }
 	  else
-	    dangling_mates[read_name] = samr;
+	    dangling_mates[read_name] = mate;
 
 	}
 	else{ 
 	    // unmatched, output read
-	  if (!samr.is_Trich) revcomp(samr.mr);
+	  if (!mate.is_Trich) revcomp(mate);
 
-	  //if(read_pq.empty())
-	  //prev_mr = samr.mr;
-	  //else 
-	    read_pq.push(samr.mr);
+	    read_pq.push(Fragment(mate));
 
 	  if(!(read_pq.empty()) &&
-	     MappedReadOrderChecker::is_ready(read_pq, samr.mr, MAX_SEGMENT_LENGTH)) {
+	     FragmentOrderChecker::is_ready(read_pq, mate.r, MAX_SEGMENT_LENGTH)) {
 	      //begin emptying priority queue
 	    while(!(read_pq.empty()) &&
-		  MappedReadOrderChecker::is_ready(read_pq, samr.mr, MAX_SEGMENT_LENGTH) ){
-	      empty_pq(prev_mr, read_pq, mapped_reads_file, out);
+		  FragmentOrderChecker::is_ready(read_pq, mate.r, MAX_SEGMENT_LENGTH) ){
+	      empty_pq(read_pq, buffers, out);
 	    }//end while loop
 	  }//end statement for emptying priority queue
 
@@ -395,17 +782,19 @@ main(int argc, const char **argv) {
 	//  cerr << "dangling mates too large, emptying" << endl;
 
 	  using std::tr1::unordered_map;
-	  unordered_map<string, SAMRecord> tmp;
-	  for (unordered_map<string, SAMRecord>::iterator
+	  unordered_map<string, Mate> tmp;
+	  for (unordered_map<string, Mate>::iterator
 		 itr = dangling_mates.begin();
 	       itr != dangling_mates.end(); ++itr){
-	    if (itr->second.mr.r.get_chrom() != samr.mr.r.get_chrom()
-		|| (itr->second.mr.r.get_chrom() == samr.mr.r.get_chrom()
-		    && itr->second.mr.r.get_end() + MAX_SEGMENT_LENGTH <
-		    samr.mr.r.get_start())) {
-	      if (!itr->second.is_Trich) revcomp(itr->second.mr);
+	    if (itr->second.r.get_chrom() != mate.r.get_chrom()
+		|| (itr->second.r.get_chrom() == mate.r.get_chrom()
+		    && itr->second.r.get_end() + MAX_SEGMENT_LENGTH <
+		    mate.r.get_start())) {
+	      if (!itr->second.is_Trich) revcomp(itr->second);
 	      if(itr->second.seg_len >= 0)
-		read_pq.push(itr->second.mr);
+		read_pq.push(Fragment(itr->second));
+	      else
+		buffers.release(itr->second.buf);
 	    }
 	    else
 	      tmp[itr->first] = itr->second;
@@ -414,11 +803,11 @@ main(int argc, const char **argv) {
 	  tmp.clear();
 
 	  if(!(read_pq.empty()) &&
-	     MappedReadOrderChecker::is_ready(read_pq, samr.mr, MAX_SEGMENT_LENGTH)) {
+	     FragmentOrderChecker::is_ready(read_pq, mate.r, MAX_SEGMENT_LENGTH)) {
 	      //begin emptying priority queue
 	    while(!(read_pq.empty()) &&
-		  MappedReadOrderChecker::is_ready(read_pq, samr.mr, MAX_SEGMENT_LENGTH) ){
-	      empty_pq(prev_mr, read_pq, mapped_reads_file, out);
+		  FragmentOrderChecker::is_ready(read_pq, mate.r, MAX_SEGMENT_LENGTH) ){
+	      empty_pq(read_pq, buffers, out);
 	    }//end while loop
 	  }//end statement for emptying priority queue
 
@@ -435,14 +824,15 @@ main(int argc, const char **argv) {
     }
     while (!dangling_mates.empty()){
       if (!dangling_mates.begin()->second.is_Trich)
-        revcomp(dangling_mates.begin()->second.mr);
-      read_pq.push(dangling_mates.begin()->second.mr);
+        revcomp(dangling_mates.begin()->second);
+      read_pq.push(Fragment(dangling_mates.begin()->second));
       dangling_mates.erase(dangling_mates.begin());
     }
 
     while(!read_pq.empty()){
-      empty_pq(prev_mr, read_pq, mapped_reads_file, out);
+      empty_pq(read_pq, buffers, out);
     }
+    out.close();
           
     if (VERBOSE){
       cerr << "Done." << endl;
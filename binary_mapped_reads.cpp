@@ -0,0 +1,180 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binary_mapped_reads.hpp"
+
+#include <cstring>
+
+#include "smithlab_utils.hpp"
+
+using std::string;
+using std::vector;
+
+
+const char binary_reads_magic[8] = {'P', 'R', 'E', 'S', 'E', 'Q', 'M', '1'};
+
+bool
+has_binary_reads_magic(const char *data, const size_t size) {
+  return size >= sizeof(binary_reads_magic) &&
+    memcmp(data, binary_reads_magic, sizeof(binary_reads_magic)) == 0;
+}
+
+
+static inline void
+put_varint(unsigned long long x, string &bytes) {
+  while (x >= 0x80) {
+    bytes.push_back(static_cast<char>((x & 0x7F) | 0x80));
+    x >>= 7;
+  }
+  bytes.push_back(static_cast<char>(x));
+}
+
+static inline unsigned long long
+zigzag(const long long x) {
+  return (static_cast<unsigned long long>(x) << 1) ^ (x < 0 ? ~0ULL : 0ULL);
+}
+
+static inline long long
+unzigzag(const unsigned long long x) {
+  return static_cast<long long>(x >> 1) ^ -static_cast<long long>(x & 1);
+}
+
+
+void
+BinaryReadEncoder::encode_header(string &bytes) const {
+  bytes.append(binary_reads_magic, sizeof(binary_reads_magic));
+}
+
+
+void
+BinaryReadEncoder::encode(const string &chrom, const size_t start,
+                          const size_t end, const bool pos_strand,
+                          const string &seq, string &bytes) {
+  std::map<string, size_t>::iterator id = chrom_ids.find(chrom);
+  const bool NEW_CHROM = id == chrom_ids.end() || id->second != last_chrom_id;
+  if (NEW_CHROM)
+    last_start = 0;
+
+  const long long delta = static_cast<long long>(start) -
+    static_cast<long long>(last_start);
+  put_varint((zigzag(delta) << 2) | (pos_strand ? 0 : 2) | (NEW_CHROM ? 1 : 0),
+             bytes);
+  if (id == chrom_ids.end()) {
+    id = chrom_ids.insert(std::make_pair(chrom, chrom_ids.size())).first;
+    put_varint(id->second, bytes);
+    put_varint(chrom.size(), bytes);
+    bytes.append(chrom);
+  }
+  else if (NEW_CHROM)
+    put_varint(id->second, bytes);
+  last_chrom_id = id->second;
+  last_start = start;
+
+  put_varint(seq.size(), bytes);
+  put_varint(zigzag(static_cast<long long>(end) - static_cast<long long>(start)
+                    - static_cast<long long>(seq.size())), bytes);
+
+  n_runs.clear();
+  const char *first = seq.data();
+  const char *seq_end = first + seq.size();
+  for (const char *i = first; (i = static_cast<const char *>(
+           memchr(i, 'N', seq_end - i))) != NULL; ) {
+    const char *run_start = i;
+    while (i < seq_end && *i == 'N')
+      ++i;
+    n_runs.push_back(std::make_pair(run_start - first, i - first));
+  }
+
+  put_varint(n_runs.size(), bytes);
+  size_t run_end = 0;
+  for (size_t i = 0; i < n_runs.size(); ++i) {
+    put_varint(n_runs[i].first - run_end, bytes);
+    put_varint(n_runs[i].second - n_runs[i].first, bytes);
+    run_end = n_runs[i].second;
+  }
+}
+
+
+BinaryReadDecoder::BinaryReadDecoder(const char *data, const size_t size) :
+  pos(reinterpret_cast<const unsigned char *>(data)),
+  data_end(reinterpret_cast<const unsigned char *>(data) + size),
+  chrom_id(0), last_start(0) {
+  if (!has_binary_reads_magic(data, size))
+    throw SMITHLABException("not a binary mapped reads file");
+  pos += sizeof(binary_reads_magic);
+}
+
+
+size_t
+BinaryReadDecoder::varint() {
+  unsigned long long x = 0;
+  for (size_t shift = 0; pos < data_end && shift < 64; shift += 7) {
+    const unsigned char byte = *pos++;
+    x |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+    if (byte < 0x80)
+      return x;
+  }
+  throw SMITHLABException("binary mapped reads cut short or corrupt");
+}
+
+
+bool
+BinaryReadDecoder::next(BinaryRead &read) {
+  if (pos == data_end)
+    return false;
+
+  const unsigned long long flags = varint();
+  if (flags & 1) {
+    chrom_id = varint();
+    if (chrom_id == chrom_names.size()) {
+      const size_t length = varint();
+      if (static_cast<size_t>(data_end - pos) < length)
+        throw SMITHLABException("binary mapped reads cut short or corrupt");
+      chrom_names.push_back(string(reinterpret_cast<const char *>(pos),
+                                   length));
+      pos += length;
+    }
+    else if (chrom_id > chrom_names.size())
+      throw SMITHLABException("binary mapped reads cut short or corrupt");
+    last_start = 0;
+  }
+  else if (chrom_names.empty())
+    throw SMITHLABException("binary mapped reads cut short or corrupt");
+
+  read.chrom_id = chrom_id;
+  read.pos_strand = !(flags & 2);
+  read.start = last_start + unzigzag(flags >> 2);
+  last_start = read.start;
+  read.seq_length = varint();
+  read.end = read.start + read.seq_length + unzigzag(varint());
+
+  const size_t n_runs = varint();
+  if (n_runs > static_cast<size_t>(data_end - pos))
+    throw SMITHLABException("binary mapped reads cut short or corrupt");
+  read.n_runs.resize(n_runs);
+  size_t run_end = 0;
+  for (size_t i = 0; i < read.n_runs.size(); ++i) {
+    read.n_runs[i].first = run_end + varint();
+    read.n_runs[i].second = read.n_runs[i].first + varint();
+    run_end = read.n_runs[i].second;
+  }
+  if (run_end > read.seq_length)
+    throw SMITHLABException("binary mapped reads cut short or corrupt");
+  return true;
+}
@@ -0,0 +1,100 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BINARY_MAPPED_READS_HPP
+#define BINARY_MAPPED_READS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+// Binary stream of mapped reads, written by bam2mr --binary, keeping
+// only what gc_extrap uses: the position, strand and which bases of the
+// sequence are N.  The file starts with binary_reads_magic and every
+// number after it is an unsigned LEB128 varint; signed ones are zigzag
+// encoded.  Each read is
+//
+//   flags            bit 0: new chromosome, bit 1: negative strand,
+//                    bits 2 and up: zigzag start - previous start
+//                    (previous start is 0 on a new chromosome)
+//   [chrom id]       new chromosome only; an id one past the last one
+//   [name length,    seen is followed by the name, so the table of
+//    name bytes]     chromosome names is built as the stream is read
+//   seq length
+//   zigzag (end - start) - seq length
+//   number of N runs, then for each run the bases since the end of the
+//   previous run (or the start of the sequence) and the run length
+
+extern const char binary_reads_magic[8];
+
+// true if the data starts with binary_reads_magic
+bool
+has_binary_reads_magic(const char *data, const size_t size);
+
+struct BinaryRead {
+  size_t chrom_id;
+  size_t start;
+  size_t end;
+  size_t seq_length;
+  bool pos_strand;
+  // offsets [first, second) into the sequence of the runs of N
+  std::vector<std::pair<size_t, size_t> > n_runs;
+};
+
+class BinaryReadEncoder {
+public:
+  BinaryReadEncoder() : last_chrom_id(0), last_start(0) {}
+
+  // the header, once before the reads
+  void encode_header(std::string &bytes) const;
+  // appends the encoded read to bytes
+  void encode(const std::string &chrom, const size_t start,
+              const size_t end, const bool pos_strand,
+              const std::string &seq, std::string &bytes);
+
+private:
+  std::map<std::string, size_t> chrom_ids;
+  size_t last_chrom_id;
+  size_t last_start;
+  std::vector<std::pair<size_t, size_t> > n_runs;
+};
+
+// reads the stream in [data, data + size), which is not copied; throws
+// SMITHLABException if the stream is corrupt or cut short
+class BinaryReadDecoder {
+public:
+  BinaryReadDecoder(const char *data, const size_t size);
+
+  bool next(BinaryRead &read);
+  const std::string &chrom_name(const size_t chrom_id) const {
+    return chrom_names[chrom_id];
+  }
+
+private:
+  size_t varint();
+
+  const unsigned char *pos;
+  const unsigned char *data_end;
+  std::vector<std::string> chrom_names;
+  size_t chrom_id;
+  size_t last_start;
+};
+
+#endif
@@ -0,0 +1,340 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "buffered_output.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "smithlab_utils.hpp"
+
+#ifdef HAVE_SAMTOOLS
+#include "bgzf.h"
+#endif
+
+using std::string;
+using std::vector;
+
+
+BufferedOutput::BufferedOutput(const string &fn, const bool COMPRESS) :
+  file_name(fn.empty() ? "stdout" : fn), fd(STDOUT_FILENO), OWNS_FD(false),
+  fixed_digits(-1), bgzf(NULL), DONE(false) {
+  buffer.reserve(capacity);
+
+  if (COMPRESS) {
+#ifdef HAVE_SAMTOOLS
+    if (fn.empty()) {
+      std::cout.flush();
+      bgzf = bgzf_fdopen(STDOUT_FILENO, "w");
+    }
+    else bgzf = bgzf_open(fn.c_str(), "w");
+    if (bgzf == NULL)
+      throw SMITHLABException("could not open output file: " + file_name);
+    compressor = std::thread(&BufferedOutput::run_compressor, this);
+#else
+    throw SMITHLABException("BGZF output requires samtools");
+#endif
+  }
+  else if (fn.empty())
+    std::cout.flush();
+  else {
+    fd = open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+      throw SMITHLABException("could not open output file: " + file_name);
+    OWNS_FD = true;
+  }
+}
+
+
+BufferedOutput::BufferedOutput(const int out_fd, const string &name) :
+  file_name(name), fd(out_fd), OWNS_FD(false), fixed_digits(-1),
+  bgzf(NULL), DONE(false) {
+  buffer.reserve(capacity);
+}
+
+
+// errors are only reported by an explicit close()
+BufferedOutput::~BufferedOutput() {
+  try {
+    close();
+  }
+  catch (SMITHLABException &e) {}
+}
+
+
+/////////////////////////////////////////////////////
+// number formatting
+
+// the pairs of digits 00 to 99
+static const char digit_pairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// writes x backwards ending at end, returns the first character
+static char *
+format_unsigned(unsigned long long x, char *end) {
+  while (x >= 100) {
+    const size_t pair = 2*(x % 100);
+    x /= 100;
+    *--end = digit_pairs[pair + 1];
+    *--end = digit_pairs[pair];
+  }
+  if (x >= 10) {
+    *--end = digit_pairs[2*x + 1];
+    *--end = digit_pairs[2*x];
+  }
+  else *--end = '0' + x;
+  return end;
+}
+
+
+BufferedOutput &
+BufferedOutput::write_unsigned(unsigned long long x) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  const char *first = format_unsigned(x, end);
+  return write(first, end - first);
+}
+
+
+BufferedOutput &
+BufferedOutput::write_signed(const long long x) {
+  if (x >= 0)
+    return write_unsigned(x);
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *first = format_unsigned(0ull - static_cast<unsigned long long>(x), end);
+  *--first = '-';
+  return write(first, end - first);
+}
+
+
+// Fixed notation with up to 3 digits after the point, rounded the way
+// printf rounds. x = m 2^e exactly with m < 2^53, so x 10^digits
+// = m 10^digits / 2^-e has an exact 64 bit numerator and the rounding
+// (half to even) is decided by the remainder of the shift.
+void
+BufferedOutput::write_fixed(const double x) {
+  static const unsigned long long powers_of_ten[] = {1, 10, 100, 1000};
+  if (fixed_digits > 3 || !std::isfinite(x) || fabs(x) >= 1e15) {
+    char formatted[512];
+    const int n = snprintf(formatted, sizeof(formatted), "%.*f",
+                           fixed_digits, x);
+    write(formatted, std::min(static_cast<size_t>(n), sizeof(formatted) - 1));
+    return;
+  }
+
+  int exponent = 0;
+  const double fraction = frexp(fabs(x), &exponent);
+  const unsigned long long mantissa =
+    static_cast<unsigned long long>(ldexp(fraction, 53));
+  const unsigned long long ten_to_digits = powers_of_ten[fixed_digits];
+  const unsigned long long numerator = mantissa*ten_to_digits;
+  const int shift = 53 - exponent;
+
+  unsigned long long scaled = 0;
+  if (shift <= 0)
+    scaled = numerator << -shift;
+  else if (shift < 64) {
+    scaled = numerator >> shift;
+    const unsigned long long remainder =
+      numerator & ((1ull << shift) - 1);
+    const unsigned long long half = 1ull << (shift - 1);
+    if (remainder > half || (remainder == half && (scaled & 1)))
+      ++scaled;
+  }
+  // otherwise x 10^digits < 2^63/2^64 and rounds to 0
+
+  char digits[32];
+  char *end = digits + sizeof(digits);
+  char *first = end;
+  if (fixed_digits > 0) {
+    unsigned long long decimals = scaled % ten_to_digits;
+    for (int i = 0; i < fixed_digits; ++i) {
+      *--first = '0' + decimals % 10;
+      decimals /= 10;
+    }
+    *--first = '.';
+  }
+  first = format_unsigned(scaled/ten_to_digits, first);
+  if (std::signbit(x))
+    *--first = '-';
+  write(first, end - first);
+}
+
+
+// the default ostream format is %g with precision 6, which prints
+// whole numbers below 10^6 as integers
+void
+BufferedOutput::write_general(const double x) {
+  if (fabs(x) < 1e6 && x == floor(x) && !(x == 0.0 && std::signbit(x)))
+    write_signed(static_cast<long long>(x));
+  else {
+    char formatted[32];
+    const int n = snprintf(formatted, sizeof(formatted), "%g", x);
+    write(formatted, n);
+  }
+}
+
+
+BufferedOutput &
+BufferedOutput::operator<<(const double x) {
+  if (fixed_digits >= 0)
+    write_fixed(x);
+  else write_general(x);
+  return *this;
+}
+
+
+/////////////////////////////////////////////////////
+// buffering
+
+BufferedOutput &
+BufferedOutput::operator<<(const char *s) {
+  return write(s, strlen(s));
+}
+
+
+BufferedOutput &
+BufferedOutput::write(const char *s, const size_t n) {
+  if (buffer.size() + n > capacity)
+    send_buffer();
+  buffer.insert(buffer.end(), s, s + n);
+  return *this;
+}
+
+
+void
+BufferedOutput::write_out(const vector<char> &buf) {
+  size_t written = 0;
+  while (written < buf.size()) {
+    const ssize_t n = ::write(fd, buf.data() + written, buf.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw SMITHLABException("failed to write output: " + file_name);
+    written += n;
+  }
+}
+
+
+void
+BufferedOutput::send_buffer() {
+  if (buffer.empty())
+    return;
+  if (bgzf == NULL) {
+    write_out(buffer);
+    buffer.clear();
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mtx);
+  space_cv.wait(lock, [this] {
+      return queued.size() < max_queued || !error.empty();
+    });
+  if (!error.empty())
+    throw SMITHLABException(error);
+  queued.push_back(vector<char>());
+  queued.back().swap(buffer);
+  if (!spare.empty()) {
+    buffer.swap(spare.back());
+    spare.pop_back();
+  }
+  else buffer.reserve(capacity);
+  lock.unlock();
+  queued_cv.notify_one();
+}
+
+
+void
+BufferedOutput::run_compressor() {
+#ifdef HAVE_SAMTOOLS
+  std::unique_lock<std::mutex> lock(mtx);
+  while (true) {
+    queued_cv.wait(lock, [this] {return !queued.empty() || DONE;});
+    if (queued.empty())
+      break;
+    vector<char> buf;
+    buf.swap(queued.front());
+    queued.pop_front();
+
+    lock.unlock();
+    const bool FAILED = error.empty() &&
+      bgzf_write(static_cast<BGZF *>(bgzf), buf.data(), buf.size()) < 0;
+    buf.clear();
+    lock.lock();
+
+    if (FAILED)
+      error = "failed to write output: " + file_name;
+    spare.push_back(vector<char>());
+    spare.back().swap(buf);
+    space_cv.notify_one();
+  }
+#endif
+}
+
+
+void
+BufferedOutput::close() {
+  // the compressor and the file are shut down even if the last write
+  // fails
+  string message;
+  try {
+    send_buffer();
+  }
+  catch (SMITHLABException &e) {
+    message = e.what();
+    buffer.clear();
+  }
+
+  if (compressor.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      DONE = true;
+    }
+    queued_cv.notify_one();
+    compressor.join();
+  }
+#ifdef HAVE_SAMTOOLS
+  if (bgzf != NULL) {
+    if (bgzf_close(static_cast<BGZF *>(bgzf)) != 0 && error.empty())
+      error = "failed to write output: " + file_name;
+    bgzf = NULL;
+  }
+#endif
+  if (OWNS_FD) {
+    OWNS_FD = false;
+    if (::close(fd) != 0 && error.empty())
+      error = "failed to write output: " + file_name;
+  }
+  if (message.empty())
+    message = error;
+  error.clear();
+  if (!message.empty())
+    throw SMITHLABException(message);
+}
@@ -0,0 +1,106 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFERED_OUTPUT_HPP
+#define BUFFERED_OUTPUT_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Output writer for the curves and for bam2mr. Text is formatted
+// straight into a large buffer that is written out only when it fills
+// or the writer is closed, so lines are never flushed one at a time.
+// Numbers are printed exactly as a std::ostream would print them, in
+// the default format or in fixed format after set_fixed_precision.
+// With COMPRESS set (needs samtools) the output is compressed on a
+// background thread while the next buffer is being filled.
+class BufferedOutput {
+public:
+  // an empty file name writes to the standard output
+  BufferedOutput(const std::string &file_name, const bool COMPRESS = false);
+  // writes to fd, which is left open; name is used in errors
+  BufferedOutput(const int fd, const std::string &name);
+  ~BufferedOutput();
+
+  // like std::fixed with precision(digits), at most 3 digits are
+  // formatted without going through snprintf
+  void set_fixed_precision(const int digits) {fixed_digits = digits;}
+
+  BufferedOutput &operator<<(const std::string &s) {
+    return write(s.data(), s.size());
+  }
+  BufferedOutput &operator<<(const char *s);
+  BufferedOutput &operator<<(const char c) {
+    if (buffer.size() == capacity)
+      send_buffer();
+    buffer.push_back(c);
+    return *this;
+  }
+  BufferedOutput &operator<<(const int x) {return write_signed(x);}
+  BufferedOutput &operator<<(const long x) {return write_signed(x);}
+  BufferedOutput &operator<<(const long long x) {return write_signed(x);}
+  BufferedOutput &operator<<(const unsigned x) {return write_unsigned(x);}
+  BufferedOutput &operator<<(const unsigned long x) {return write_unsigned(x);}
+  BufferedOutput &operator<<(const unsigned long long x) {
+    return write_unsigned(x);
+  }
+  BufferedOutput &operator<<(const double x);
+
+  BufferedOutput &write(const char *s, const size_t n);
+
+  // writes out everything buffered and closes the file, throws
+  // SMITHLABException if any write failed
+  void close();
+
+private:
+  BufferedOutput &write_signed(const long long x);
+  BufferedOutput &write_unsigned(unsigned long long x);
+  void write_fixed(const double x);
+  void write_general(const double x);
+
+  void send_buffer();
+  void write_out(const std::vector<char> &buf);
+  void run_compressor();
+
+  static const size_t capacity = 1 << 20;
+  static const size_t max_queued = 4;
+
+  const std::string file_name;
+  int fd;
+  bool OWNS_FD;
+  int fixed_digits;
+  std::vector<char> buffer;
+  std::string error;
+
+  // BGZF compression thread and the buffers waiting for it
+  void *bgzf;
+  std::deque<std::vector<char> > queued;
+  std::vector<std::vector<char> > spare;
+  std::mutex mtx;
+  std::condition_variable queued_cv;
+  std::condition_variable space_cv;
+  bool DONE;
+  std::thread compressor;
+};
+
+#endif
@@ -0,0 +1,1053 @@
+/*    Copyright (C) 2013-2015 University of Southern California and
+ *                            Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Timothy Daley, Chao Deng, Victoria Helus, and Andrew Smith
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "complexity_estimates.hpp"
+
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+#include <gsl/gsl_cdf.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_statistics_double.h>
+#include <gsl/gsl_sf_gamma.h>
+
+#include "smithlab_utils.hpp"
+
+#include "continued_fraction.hpp"
+#include "moment_sequence.hpp"
+#include "run_stats.hpp"
+
+using std::string;
+using std::vector;
+using std::min;
+using std::max;
+using std::endl;
+using std::cerr;
+using std::isfinite;
+using std::setw;
+using std::setprecision;
+
+
+// a generator for one estimate, freed however the estimate ends
+struct RNGHolder {
+  explicit RNGHolder(const unsigned long int seed) :
+    rng(gsl_rng_alloc(gsl_rng_default)) {
+    if (rng == NULL)
+      throw std::bad_alloc();
+    gsl_rng_set(rng, seed);
+  }
+  ~RNGHolder() {gsl_rng_free(rng);}
+  gsl_rng *rng;
+private:
+  RNGHolder(const RNGHolder &);
+  RNGHolder &operator=(const RNGHolder &);
+};
+
+
+/////////////////////////////////////////////////////////
+// Confidence interval stuff
+
+/*
+static inline double
+alpha_log_confint_multiplier(const double estimate,
+                             const double variance, const double alpha) {
+  const double inv_norm_alpha = gsl_cdf_ugaussian_Qinv(alpha/2.0);
+  return exp(inv_norm_alpha*
+             sqrt(log(1.0 + variance/pow(estimate, 2))));
+}
+*/
+
+
+void
+median_and_ci(const vector<double> &estimates,
+              const double ci_level,
+              double &median_estimate,
+              double &lower_ci_estimate,
+              double &upper_ci_estimate){
+  assert(!estimates.empty());
+  const double alpha = 1.0 - ci_level;
+  const size_t n_est = estimates.size();
+  vector<double> sorted_estimates(estimates);
+  sort(sorted_estimates.begin(), sorted_estimates.end());
+  median_estimate =
+    gsl_stats_median_from_sorted_data(&sorted_estimates[0], 
+                                      1, n_est);
+
+  lower_ci_estimate = 
+    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
+					1, n_est, alpha/2);
+  upper_ci_estimate = 
+    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
+					1, n_est, 1.0 - alpha/2);
+
+}
+
+void
+vector_median_and_ci(const vector<vector<double> > &bootstrap_estimates,
+                     const double ci_level, 
+                     vector<double> &yield_estimates,
+                     vector<double> &lower_ci_lognormal,
+                     vector<double> &upper_ci_lognormal) {
+
+  yield_estimates.clear();
+  lower_ci_lognormal.clear();
+  upper_ci_lognormal.clear();
+  assert(!bootstrap_estimates.empty());
+
+  const size_t n_est = bootstrap_estimates.size();
+  vector<double> estimates_row(bootstrap_estimates.size(), 0.0);
+  for (size_t i = 0; i < bootstrap_estimates[0].size(); i++) {
+
+    // estimates is in wrong order, work locally on const val
+    for (size_t k = 0; k < n_est; ++k)
+      estimates_row[k] = bootstrap_estimates[k][i];
+
+    double median_estimate, lower_ci_estimate, upper_ci_estimate;
+    median_and_ci(estimates_row, ci_level, median_estimate,
+                  lower_ci_estimate, upper_ci_estimate);
+    sort(estimates_row.begin(), estimates_row.end());
+
+    yield_estimates.push_back(median_estimate);
+    lower_ci_lognormal.push_back(lower_ci_estimate);
+    upper_ci_lognormal.push_back(upper_ci_estimate);
+  }
+}
+
+void
+log_mean(const bool VERBOSE,
+	 const vector<double> &estimates,
+	 const double c_level,
+	 double &log_mean, 
+	 double &log_lower_ci,
+	 double &log_upper_ci){
+  vector<double> log_estimates(estimates);
+  for(size_t i = 0; i < log_estimates.size(); i++)
+    log_estimates[i] = log(log_estimates[i]);
+
+  log_mean = exp(gsl_stats_mean(&log_estimates[0], 1,
+				log_estimates.size()) );
+
+  double log_std_dev = std::sqrt(gsl_stats_variance(&log_estimates[0], 1, 
+						    log_estimates.size()) );
+
+  const double inv_norm_alpha = gsl_cdf_ugaussian_Qinv((1.0 - c_level)/2.0);
+  log_lower_ci = exp(log(log_mean) - inv_norm_alpha*log_std_dev);
+  log_upper_ci = exp(log(log_mean) + inv_norm_alpha*log_std_dev);
+}
+
+void
+mean_and_ci(const vector<double> &estimates,
+	const double ci_level,
+	double &mean_estimate,
+	double &lower_ci_estimate,
+	double &upper_ci_estimate){
+  assert(!estimates.empty());
+  const double alpha = 1.0 - ci_level;
+  const size_t n_est = estimates.size();
+  vector<double> sorted_estimates(estimates);
+  sort(sorted_estimates.begin(), sorted_estimates.end());
+  mean_estimate =
+    gsl_stats_mean(&sorted_estimates[0], 1, n_est);
+
+  lower_ci_estimate = 
+    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
+					1, n_est, alpha/2);
+  upper_ci_estimate = 
+    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
+					1, n_est, 1.0 - alpha/2);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////
+/////
+/////  EXTRAP MODE BELOW HERE
+/////
+
+
+// vals_hist[j] = n_{j} = # (counts = j)
+// vals_hist_distinct_counts[k] = kth index j s.t. vals_hist[j] > 0
+// stores kth index of vals_hist that is positive
+// distinct_counts_hist[k] = vals_hist[vals_hist_distinct_counts[k]]
+// stores the kth positive value of vals_hist
+void
+resample_hist(const gsl_rng *rng, const vector<size_t> &vals_hist_distinct_counts,
+              const vector<double> &distinct_counts_hist,
+              const unsigned int distinct, vector<double> &out_hist) {
+
+  vector<unsigned int> sample_distinct_counts_hist(distinct_counts_hist.size(), 0);
+
+  gsl_ran_multinomial(rng, distinct_counts_hist.size(), distinct,
+                      &distinct_counts_hist.front(),
+                      &sample_distinct_counts_hist.front());
+
+  out_hist.clear();
+  out_hist.resize(vals_hist_distinct_counts.back() + 1, 0.0);
+  for(size_t i = 0; i < sample_distinct_counts_hist.size(); i++)
+    out_hist[vals_hist_distinct_counts[i]] =
+      static_cast<double>(sample_distinct_counts_hist[i]);
+}
+
+// interpolate by explicit calculating the expectation 
+// for sampling without replacement; 
+// see K.L Heck 1975
+// N total sample size; S the total number of distincts
+// n sub sample size
+double
+interpolate_distinct(const vector<double> &hist, const size_t N,
+                     const size_t S, const size_t n) {
+  double denom = gsl_sf_lngamma(N + 1) - gsl_sf_lngamma(n + 1) - gsl_sf_lngamma(N - n + 1);
+  vector<double> numer(hist.size(), 0); 
+  for (size_t i = 1; i < hist.size(); i++) {
+	// N - i -n + 1 should be greater than 0
+	if (N < i + n) {
+	  numer[i] = 0;
+	} else {
+	  numer[i] = gsl_sf_lngamma(N - i + 1) - gsl_sf_lngamma(n + 1) - gsl_sf_lngamma(N - i - n + 1);
+	  numer[i] = exp(numer[i] - denom) * hist[i];
+	}
+  }
+  return S - accumulate(numer.begin(), numer.end(), 0);
+}
+
+
+// check if estimates are finite, increasing, and concave
+static bool
+check_yield_estimates(const vector<double> &estimates) {
+
+  if (estimates.empty())
+    return false;
+
+  // make sure that the estimate is increasing in the time_step and is
+  // below the initial distinct per step_size
+  if (!isfinite(accumulate(estimates.begin(), estimates.end(), 0.0)))
+    return false;
+
+  for (size_t i = 1; i < estimates.size(); ++i)
+    if ((estimates[i] < estimates[i - 1]) ||
+        (i >= 2 && (estimates[i] - estimates[i - 1] >
+                    estimates[i - 1] - estimates[i - 2])) ||
+        (estimates[i] < 0.0))
+      return false;
+
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////
+// Bootstrap checkpoints
+//
+// Everything random in extrap_bootstrap comes from the gsl_rng, so the
+// accepted rows, the iteration count and the raw generator state are
+// enough to continue a run exactly where it stopped. The checkpoint is
+// a log: each save appends the rows accepted since the last one and a
+// "state" line; rows after the last complete state line (a save cut
+// short) are dropped on reading. Rows are written with 17 significant
+// digits so they read back to the same doubles.
+
+// describes the histogram and settings a checkpoint belongs to, so one
+// is never resumed against a different run; the seed is part of it as
+// gc_extrap also bins the reads with it
+static string
+bootstrap_checkpoint_key(const bool DEFECTS, const unsigned long int seed,
+                         const vector<double> &orig_hist,
+                         const size_t bootstraps, const size_t orig_max_terms,
+                         const int diagonal, const double bin_step_size,
+                         const double max_extrapolation,
+                         const size_t max_iter, const gsl_rng *rng) {
+  const HistogramSummary summary = summarize_histogram(orig_hist);
+  std::ostringstream oss;
+  oss << setprecision(17) << orig_hist.size() << ' ' << summary.total << ' '
+      << summary.distinct << ' ' << seed << ' '
+      << DEFECTS << ' ' << bootstraps << ' ' << orig_max_terms << ' '
+      << diagonal << ' ' << bin_step_size << ' ' << max_extrapolation << ' '
+      << max_iter << ' ' << gsl_rng_name(rng);
+  return oss.str();
+}
+
+// append rows [first_row, end) and the state after iteration iter
+static void
+append_bootstrap_checkpoint(std::ofstream &out, const size_t first_row,
+                            const size_t iter, const gsl_rng *rng,
+                            const vector<vector<double> > &bootstrap_estimates) {
+  out << setprecision(17);
+  for (size_t i = first_row; i < bootstrap_estimates.size(); ++i) {
+    out << "row " << bootstrap_estimates[i].size();
+    for (size_t j = 0; j < bootstrap_estimates[i].size(); ++j)
+      out << ' ' << bootstrap_estimates[i][j];
+    out << '\n';
+  }
+
+  const unsigned char *state =
+    static_cast<const unsigned char *>(gsl_rng_state(rng));
+  out << "state " << bootstrap_estimates.size() << ' ' << iter << ' '
+      << std::hex << std::setfill('0');
+  for (size_t i = 0; i < gsl_rng_size(rng); ++i)
+    out << setw(2) << static_cast<unsigned int>(state[i]);
+  out << std::dec << std::setfill(' ') << endl;
+  if (!out)
+    throw SMITHLABException("could not write bootstrap checkpoint");
+}
+
+// start a fresh log holding what has been done so far; written to a
+// temporary file and renamed so an existing checkpoint is never lost
+static void
+open_bootstrap_checkpoint(const string &checkpoint_file, const string &key,
+                          const size_t iter, const gsl_rng *rng,
+                          const vector<vector<double> > &bootstrap_estimates,
+                          std::ofstream &out) {
+  const string tmp_file = checkpoint_file + ".tmp";
+  std::ofstream tmp(tmp_file.c_str());
+  if (!tmp)
+    throw SMITHLABException("could not write checkpoint: " + tmp_file);
+  tmp << "PRESEQ_BOOTSTRAP_CHECKPOINT" << '\n' << key << '\n';
+  append_bootstrap_checkpoint(tmp, 0, iter, rng, bootstrap_estimates);
+  tmp.close();
+  if (rename(tmp_file.c_str(), checkpoint_file.c_str()) != 0)
+    throw SMITHLABException("could not write checkpoint: " + checkpoint_file);
+
+  out.open(checkpoint_file.c_str(), std::ios::app);
+  if (!out)
+    throw SMITHLABException("could not write checkpoint: " + checkpoint_file);
+}
+
+// returns false if there is no checkpoint to resume from
+static bool
+read_bootstrap_checkpoint(const string &checkpoint_file, const string &key,
+                          size_t &iter, gsl_rng *rng,
+                          vector<vector<double> > &bootstrap_estimates) {
+  std::ifstream in(checkpoint_file.c_str());
+  if (!in)
+    return false;
+
+  string buffer, stored_key;
+  getline(in, buffer);
+  getline(in, stored_key);
+  if (buffer != "PRESEQ_BOOTSTRAP_CHECKPOINT" || stored_key != key)
+    throw SMITHLABException("checkpoint does not match this run: " +
+                            checkpoint_file);
+
+  vector<vector<double> > rows;
+  size_t n_saved = 0;
+  string state_hex;
+  while (getline(in, buffer)) {
+    std::istringstream iss(buffer);
+    string tag;
+    size_t n = 0;
+    iss >> tag >> n;
+    if (tag == "row") {
+      vector<double> row(n);
+      for (size_t j = 0; j < n && iss; ++j)
+        iss >> row[j];
+      if (!iss)
+        break;
+      rows.push_back(row);
+    }
+    else if (tag == "state") {
+      size_t state_iter = 0;
+      string hex;
+      if (n != rows.size() || !(iss >> state_iter >> hex) ||
+          hex.size() != 2*gsl_rng_size(rng))
+        break;
+      n_saved = n;
+      iter = state_iter;
+      state_hex.swap(hex);
+    }
+    else break;
+  }
+  if (state_hex.empty())
+    throw SMITHLABException("bad checkpoint file: " + checkpoint_file);
+
+  unsigned char *state = static_cast<unsigned char *>(gsl_rng_state(rng));
+  for (size_t i = 0; i < gsl_rng_size(rng); ++i)
+    state[i] = static_cast<unsigned char>(strtoul(state_hex.substr(2*i, 2).c_str(),
+                                                  NULL, 16));
+  rows.resize(n_saved);
+  bootstrap_estimates.swap(rows);
+  return true;
+}
+
+
+// lower_cfa.optimal_cont_frac_distinct(hist), timed as "cf_search"
+static ContinuedFraction
+optimal_lower_cf(const ContinuedFractionApproximation &lower_cfa,
+                 const vector<double> &hist, RunStats *stats) {
+  const PhaseTimer cf_timer(stats, "cf_search");
+  const ContinuedFraction lower_cf(lower_cfa.optimal_cont_frac_distinct(hist));
+  if (stats && lower_cf.is_valid())
+    stats->add_cf_degree(lower_cf.return_degree());
+  return lower_cf;
+}
+
+
+void
+extrap_bootstrap(const bool VERBOSE, const bool DEFECTS,
+		 const unsigned long int seed,
+		 const vector<double> &orig_hist,
+                 const size_t bootstraps, const size_t orig_max_terms,
+                 const int diagonal, const double bin_step_size,
+                 const double max_extrapolation, const size_t max_iter,
+                 const string &checkpoint_file, const size_t checkpoint_every,
+                 const bool RESUME,
+                 vector< vector<double> > &bootstrap_estimates,
+                 RunStats *stats) {
+  const PhaseTimer bootstrap_timer(stats, "bootstrap");
+  // clear returning vectors
+  bootstrap_estimates.clear();
+
+  //setup rng
+  const RNGHolder rng_holder(seed);
+  gsl_rng *rng = rng_holder.rng;
+
+  // continue from the last checkpoint if there is one
+  const string checkpoint_key =
+    bootstrap_checkpoint_key(DEFECTS, seed, orig_hist, bootstraps,
+                             orig_max_terms, diagonal, bin_step_size,
+                             max_extrapolation, max_iter, rng);
+  size_t first_iter = 0;
+  if (RESUME && !checkpoint_file.empty() &&
+      read_bootstrap_checkpoint(checkpoint_file, checkpoint_key, first_iter,
+                                rng, bootstrap_estimates) && VERBOSE)
+    cerr << "RESUMING AT " << bootstrap_estimates.size()
+         << " BOOTSTRAPS (ITERATION " << first_iter << ")" << endl;
+  std::ofstream checkpoint;
+  if (!checkpoint_file.empty())
+    open_bootstrap_checkpoint(checkpoint_file, checkpoint_key, first_iter,
+                              rng, bootstrap_estimates, checkpoint);
+  size_t n_saved = bootstrap_estimates.size();
+  size_t n_rejected = 0;
+
+  const double initial_distinct = summarize_histogram(orig_hist).distinct;
+
+
+  vector<size_t> orig_hist_distinct_counts;
+  vector<double> distinct_orig_hist;
+  for (size_t i = 0; i < orig_hist.size(); i++){
+    if (orig_hist[i] > 0) {
+      orig_hist_distinct_counts.push_back(i);
+      distinct_orig_hist.push_back(orig_hist[i]);
+    }
+  }
+  // the same for every replicate
+  const unsigned int n_distinct =
+    static_cast<unsigned int>(accumulate(distinct_orig_hist.begin(),
+                                         distinct_orig_hist.end(), 0.0));
+  
+  for (size_t iter = first_iter;
+       (iter < max_iter && bootstrap_estimates.size() < bootstraps);
+       ++iter) {
+
+    const size_t n_accepted = bootstrap_estimates.size();
+    vector<double> yield_vector;
+    vector<double> hist;
+    resample_hist(rng, orig_hist_distinct_counts, distinct_orig_hist,
+                  n_distinct, hist);
+
+    //resize boot_hist to remove excess zeros
+    while (hist.back() == 0)
+      hist.pop_back();
+
+    const HistogramSummary summary = summarize_histogram(hist);
+    const double sample_vals_sum = summary.total;
+
+    // compute complexity curve by random sampling w/out replacement
+    const size_t upper_limit = static_cast<size_t>(sample_vals_sum);
+    const size_t distinct = static_cast<size_t>(summary.distinct);
+    const size_t step = static_cast<size_t>(bin_step_size);
+    size_t sample = step;
+    {
+      const PhaseTimer interpolation_timer(stats, "interpolation");
+      while(sample < upper_limit){
+        yield_vector.push_back(interpolate_distinct(hist, upper_limit, distinct, sample));
+        sample += step;
+      }
+    }
+
+    // ENSURE THAT THE MAX TERMS ARE ACCEPTABLE
+    const size_t max_terms = usable_max_terms(summary, orig_max_terms);
+    
+    // defect mode, simple extrapolation
+    if(DEFECTS){
+      vector<double> ps_coeffs;
+      for (size_t j = 1; j <= max_terms; j++)
+	ps_coeffs.push_back((j % 2 == 1 ? hist[j] : -hist[j]));
+    
+      const ContinuedFraction
+	defect_cf(ps_coeffs, diagonal, max_terms);
+
+      double sample_size = static_cast<double>(sample);
+      while(sample_size < max_extrapolation){
+	double t = (sample_size - sample_vals_sum)/sample_vals_sum;
+	assert(t >= 0.0);
+	yield_vector.push_back(initial_distinct + t*defect_cf(t));
+	sample_size += bin_step_size;
+      }
+      // no checking of curve in defect mode
+      bootstrap_estimates.push_back(yield_vector);
+      if (VERBOSE) cerr << '.';
+    }
+    else{
+      //refit curve for lower bound
+      const ContinuedFractionApproximation
+	lower_cfa(diagonal, max_terms);
+
+      const ContinuedFraction
+	lower_cf(optimal_lower_cf(lower_cfa, hist, stats));
+
+      //extrapolate the curve start
+      if (lower_cf.is_valid()){
+	double sample_size = static_cast<double>(sample);
+	while(sample_size < max_extrapolation){
+	  double t = (sample_size - sample_vals_sum)/sample_vals_sum;
+	  assert(t >= 0.0);
+	  yield_vector.push_back(initial_distinct + t*lower_cf(t));
+	  sample_size += bin_step_size;
+	}
+
+	// SANITY CHECK
+	if (check_yield_estimates(yield_vector)) {
+	  bootstrap_estimates.push_back(yield_vector);
+	  if (VERBOSE) cerr << '.';
+	}
+	else {
+	  ++n_rejected;
+	  if (VERBOSE) cerr << "_";
+	}
+      }
+      else {
+	++n_rejected;
+	if (VERBOSE) cerr << "_";
+      }
+
+    }
+
+    if (checkpoint.is_open() && checkpoint_every > 0 &&
+        bootstrap_estimates.size() > n_accepted &&
+        bootstrap_estimates.size() % checkpoint_every == 0) {
+      append_bootstrap_checkpoint(checkpoint, n_saved, iter + 1, rng,
+                                  bootstrap_estimates);
+      n_saved = bootstrap_estimates.size();
+    }
+  }
+  if (VERBOSE)
+    cerr << endl;
+  if (stats) {
+    stats->add("bootstraps", bootstrap_estimates.size());
+    stats->add("bootstraps_rejected", n_rejected);
+  }
+  if (bootstrap_estimates.size() < bootstraps)
+    throw SMITHLABException("too many defects in the approximation, consider running in defect mode");
+}
+
+bool
+extrap_single_estimate(const bool VERBOSE, const bool DEFECTS,
+		       const vector<double> &hist,
+                       size_t max_terms, const int diagonal,
+                       const double step_size, 
+                       const double max_extrapolation,
+                       vector<double> &yield_estimate,
+                       RunStats *stats) {
+
+  yield_estimate.clear();
+  const HistogramSummary summary = summarize_histogram(hist);
+  const double vals_sum = summary.total;
+  const double initial_distinct = summary.distinct;
+
+  // interpolate complexity curve by random sampling w/out replacement
+  size_t upper_limit = static_cast<size_t>(vals_sum);
+  size_t step = static_cast<size_t>(step_size);
+  size_t sample = step;
+  {
+    const PhaseTimer interpolation_timer(stats, "interpolation");
+    while (sample < upper_limit){
+      yield_estimate.push_back(
+		interpolate_distinct(hist, upper_limit, 
+		                      static_cast<size_t>(initial_distinct), sample));
+      sample += step;
+    }
+  }
+
+  // ENSURE THAT THE MAX TERMS ARE ACCEPTABLE
+  max_terms = usable_max_terms(summary, max_terms);
+
+  if(DEFECTS){
+    vector<double> ps_coeffs;
+    for (size_t j = 1; j <= max_terms; j++)
+      ps_coeffs.push_back((j % 2 == 1 ? hist[j] : -hist[j]));
+    
+    const ContinuedFraction
+      defect_cf(ps_coeffs, diagonal, max_terms);
+
+    double sample_size = static_cast<double>(sample);
+    while(sample_size < max_extrapolation){
+      const double one_minus_fold_extrap 
+	= (sample_size - vals_sum)/vals_sum;
+      assert(one_minus_fold_extrap >= 0.0);
+      double tmp = one_minus_fold_extrap*defect_cf(one_minus_fold_extrap);
+      yield_estimate.push_back(initial_distinct + tmp);
+      sample_size += step_size;
+    }
+
+    if (VERBOSE) {
+      if(defect_cf.offset_coeffs.size() > 0){
+	cerr << "CF_OFFSET_COEFF_ESTIMATES" << endl;
+	copy(defect_cf.offset_coeffs.begin(), defect_cf.offset_coeffs.end(),
+	     std::ostream_iterator<double>(cerr, "\n"));
+      }
+      if(defect_cf.cf_coeffs.size() > 0){
+	cerr << "CF_COEFF_ESTIMATES" << endl;
+	copy(defect_cf.cf_coeffs.begin(), defect_cf.cf_coeffs.end(),
+	     std::ostream_iterator<double>(cerr, "\n"));
+      }
+    }
+
+    // NO FAIL!  DEFECT MODE DOESN'T CARE ABOUT FAILURE
+  }
+  else{
+    const ContinuedFractionApproximation
+      lower_cfa(diagonal, max_terms);
+
+    const ContinuedFraction
+      lower_cf(optimal_lower_cf(lower_cfa, hist, stats));
+
+    // extrapolate curve
+    if (lower_cf.is_valid()){
+      double sample_size = static_cast<double>(sample);
+      while(sample_size < max_extrapolation){
+	const double one_minus_fold_extrap 
+	  = (sample_size - vals_sum)/vals_sum;
+	assert(one_minus_fold_extrap >= 0.0);
+	double tmp = one_minus_fold_extrap*lower_cf(one_minus_fold_extrap);
+	yield_estimate.push_back(initial_distinct + tmp);
+	sample_size += step_size;
+      }
+    }
+    else{
+    // FAIL!
+    // lower_cf unacceptable, need to bootstrap to obtain estimates
+      return false;
+    }
+
+    if (VERBOSE) {
+      if(lower_cf.offset_coeffs.size() > 0){
+	cerr << "CF_OFFSET_COEFF_ESTIMATES" << endl;
+	copy(lower_cf.offset_coeffs.begin(), lower_cf.offset_coeffs.end(),
+	     std::ostream_iterator<double>(cerr, "\n"));
+      }
+      if(lower_cf.cf_coeffs.size() > 0){
+	cerr << "CF_COEFF_ESTIMATES" << endl;
+	copy(lower_cf.cf_coeffs.begin(), lower_cf.cf_coeffs.end(),
+	     std::ostream_iterator<double>(cerr, "\n"));
+      }
+    }
+  }
+
+  // SUCCESS!!
+  return true;
+}
+
+// Sums over hist in lanes of four consecutive entries, kept apart so
+// the compiler can add a block in one vector instruction without
+// reordering a single sum. Lanes 0 and 2 hold the even j and lanes 1
+// and 3 the odd, so the alternating Good-Toulmin sum comes from the
+// same sums as the distinct reads.
+struct HistogramLanes {
+  static const size_t n_lanes = 4;
+  HistogramLanes() {
+    for (size_t k = 0; k < n_lanes; ++k) {
+      distinct[k] = 0.0;
+      total[k] = 0.0;
+      positive[k] = 0.0;
+      j[k] = k;
+    }
+  }
+  void add(const double *block) {
+    for (size_t k = 0; k < n_lanes; ++k) {
+      distinct[k] += block[k];
+      total[k] += j[k]*block[k];
+      positive[k] += (block[k] > 0.0) ? 1.0 : 0.0;
+      j[k] += n_lanes;
+    }
+  }
+  double distinct[n_lanes];
+  double total[n_lanes];
+  double positive[n_lanes];
+  double j[n_lanes];
+};
+
+
+HistogramSummary
+summarize_histogram(const vector<double> &hist) {
+  const size_t n_lanes = HistogramLanes::n_lanes;
+  const size_t n = hist.size();
+  const size_t blocks_end = n - n % n_lanes;
+  const double *h = hist.data();
+
+  // the first zero is found apart from the sums, so that the loop
+  // over blocks has no exit for the compiler to keep
+  HistogramSummary summary;
+  size_t first_zero = 1;
+  while (first_zero < n && h[first_zero] > 0.0)
+    ++first_zero;
+  summary.counts_before_first_zero = first_zero;
+
+  HistogramLanes lanes;
+  size_t j = 0;
+  for (; j < blocks_end; j += n_lanes)
+    lanes.add(h + j);
+
+  double even = (lanes.distinct[0] + lanes.distinct[2]);
+  double odd = (lanes.distinct[1] + lanes.distinct[3]);
+  summary.total = (lanes.total[0] + lanes.total[2]) +
+    (lanes.total[1] + lanes.total[3]);
+  double positive = (lanes.positive[0] + lanes.positive[2]) +
+    (lanes.positive[1] + lanes.positive[3]);
+  for (; j < n; ++j) {
+    (j % 2 == 0 ? even : odd) += h[j];
+    summary.total += j*h[j];
+    positive += (h[j] > 0.0) ? 1.0 : 0.0;
+  }
+  summary.distinct = even + odd;
+  summary.good_toulmin_2x = odd - even;
+  summary.distinct_counts = static_cast<size_t>(positive);
+  return summary;
+}
+
+
+double
+GoodToulmin2xExtrap(const vector<double> &counts_hist){
+  return summarize_histogram(counts_hist).good_toulmin_2x;
+}
+
+
+size_t
+usable_max_terms(const HistogramSummary &summary, const size_t max_terms) {
+  // Ensure we are not using a zero term
+  size_t terms = std::min(max_terms, summary.counts_before_first_zero - 1);
+  // refit curve for lower bound (degree of approx is 1 less than
+  // max_terms)
+  return terms - (terms % 2 == 1);
+}
+
+
+size_t
+usable_max_terms(const vector<double> &hist, const size_t max_terms) {
+  return usable_max_terms(summarize_histogram(hist), max_terms);
+}
+
+
+/////////////////////////////////////////////////////////
+// Whole estimates
+
+size_t
+extrapolation_max_terms(const vector<double> &hist, const size_t max_terms) {
+  const size_t MIN_REQUIRED_COUNTS = 4;
+
+  const HistogramSummary summary = summarize_histogram(hist);
+
+  // check to make sure library is not overly saturated
+  if (summary.good_toulmin_2x < 0.0)
+    throw SMITHLABException("Library expected to saturate in doubling of "
+                            "size, unable to extrapolate");
+
+  // catch if all reads are distinct
+  const size_t terms = usable_max_terms(summary, max_terms);
+  if (terms < MIN_REQUIRED_COUNTS)
+    throw SMITHLABException("max count before zero is les than min required "
+                            "count (4), sample not sufficiently deep or "
+                            "duplicates removed");
+  return terms;
+}
+
+
+void
+extrap_curve(const bool VERBOSE, const vector<double> &hist,
+             const ExtrapOptions &options, ExtrapCurve &curve) {
+  curve.estimates.clear();
+  curve.lower_ci.clear();
+  curve.upper_ci.clear();
+
+  const size_t max_terms = extrapolation_max_terms(hist, options.max_terms);
+
+  if (options.SINGLE_ESTIMATE) {
+    if (!extrap_single_estimate(VERBOSE, options.DEFECTS, hist, max_terms,
+                                options.diagonal, options.step_size,
+                                options.max_extrapolation, curve.estimates,
+                                options.stats))
+      throw SMITHLABException("SINGLE ESTIMATE FAILED, NEED TO RUN "
+                              "FULL MODE FOR ESTIMATES");
+    return;
+  }
+
+  if (VERBOSE)
+    cerr << "[BOOTSTRAPPING HISTOGRAM]" << endl;
+
+  const size_t max_iter = 10*options.bootstraps;
+
+  vector<vector<double> > bootstrap_estimates;
+  extrap_bootstrap(VERBOSE, options.DEFECTS, options.seed, hist,
+                   options.bootstraps, max_terms, options.diagonal,
+                   options.step_size, options.max_extrapolation, max_iter,
+                   options.checkpoint_file, options.checkpoint_every,
+                   options.RESUME, bootstrap_estimates, options.stats);
+
+  if (VERBOSE)
+    cerr << "[COMPUTING CONFIDENCE INTERVALS]" << endl;
+
+  const PhaseTimer ci_timer(options.stats, "ci");
+  vector_median_and_ci(bootstrap_estimates, options.c_level, curve.estimates,
+                       curve.lower_ci, curve.upper_ci);
+}
+
+
+void
+interpolate_curve(const vector<double> &hist, const double step_size,
+                  const size_t upper_limit, vector<size_t> &sample_sizes,
+                  vector<double> &expected_distinct) {
+  sample_sizes.clear();
+  expected_distinct.clear();
+
+  const HistogramSummary summary = summarize_histogram(hist);
+  const double distinct_reads = summary.distinct;
+  const size_t total_reads = static_cast<size_t>(summary.total);
+
+  for (size_t i = step_size; i <= upper_limit; i += step_size) {
+    sample_sizes.push_back(i);
+    expected_distinct.push_back(interpolate_distinct(hist, total_reads,
+                                                     distinct_reads, i));
+  }
+}
+
+
+// the lower quadrature rule for the moments, and from it the
+// estimated number of species given n_1 singletons and the observed
+// distinct; n_points is set to 0 if there is no positive estimate
+static double
+quadrature_estimate(const bool VERBOSE, MomentSequence &mom_seq,
+                    const double singletons, const double distinct,
+                    const double tolerance, const size_t max_iter,
+                    size_t &n_points) {
+  vector<double> points, weights;
+  mom_seq.Lower_quadrature_rules(VERBOSE, n_points, tolerance,
+                                 max_iter, points, weights);
+
+  const double weights_sum = accumulate(weights.begin(), weights.end(), 0.0);
+  if(weights_sum != 1.0){
+    for(size_t i = 0; i < weights.size(); i++)
+      weights[i] = weights[i]/weights_sum;
+  }
+
+  if(VERBOSE){
+    cerr << "points = " << endl;
+    for(size_t i = 0; i < points.size(); i++)
+      cerr << points[i] << '\t';
+    cerr << endl;
+
+    cerr << "weights = " << endl;
+    for(size_t i = 0; i < weights.size(); i++)
+      cerr << weights[i] << '\t';
+    cerr << endl;
+  }
+
+  double estimated_unobs = 0.0;
+  for(size_t i = 0; i < weights.size(); i++)
+    estimated_unobs += singletons*weights[i]/points[i];
+
+  if(estimated_unobs > 0.0)
+    estimated_unobs += distinct;
+  else{
+    estimated_unobs = distinct;
+    n_points = 0;
+  }
+  return estimated_unobs;
+}
+
+
+static void
+print_recurrence(const MomentSequence &mom_seq) {
+  for(size_t k = 0; k < mom_seq.alpha.size(); k++)
+    cerr << "alpha_" << k << '\t';
+  cerr << endl;
+  for(size_t k = 0; k < mom_seq.alpha.size(); k++)
+    cerr << mom_seq.alpha[k] << '\t';
+  cerr << endl;
+
+  for(size_t k = 0; k < mom_seq.beta.size(); k++)
+    cerr << "beta_" << k << '\t';
+  cerr << endl;
+  for(size_t k = 0; k < mom_seq.beta.size(); k++)
+    cerr << mom_seq.beta[k] << '\t';
+  cerr << endl;
+}
+
+
+void
+bound_pop_estimate(const bool VERBOSE, const vector<double> &counts_hist,
+                   const BoundPopOptions &options, BoundPopEstimate &result) {
+  const double distinct_obs = summarize_histogram(counts_hist).distinct;
+  const double tolerance = options.tolerance;
+  const size_t max_iter = options.max_iter;
+  size_t max_num_points = options.max_num_points;
+
+  // log factorials for the moments, tabulated once for the bootstraps
+  vector<double> log_factorial(std::max(counts_hist.size(),
+                                        2*max_num_points + 2));
+  for(size_t i = 0; i < log_factorial.size(); i++)
+    log_factorial[i] = gsl_sf_lnfact(i);
+
+  // the moments grow factorially, so they are kept as logs and
+  // scaled by scale_log_moments before the recurrence
+  vector<double> log_measure_moments;
+  // mu_r = (r + 1)! n_{r+1} / n_1
+  size_t indx = 1;
+  while(indx < counts_hist.size() && counts_hist[indx] > 0){
+    log_measure_moments.push_back(log_factorial[indx]
+                                  + log(counts_hist[indx])
+                                  - log(counts_hist[1]));
+    indx++;
+  }
+  if(options.QUICK_MODE && log_measure_moments.size() > 2*max_num_points)
+    log_measure_moments.resize(2*max_num_points);
+
+  vector<double> measure_moments;
+  const double log_scale =
+    scale_log_moments(log_measure_moments, measure_moments);
+
+  if (VERBOSE){
+    cerr << "OBSERVED MOMENTS (LOG SCALE = " << log_scale << ")" << endl;
+    for(size_t i = 0; i < measure_moments.size(); i++)
+      cerr << std::setprecision(16) << measure_moments[i] << endl;
+  }
+
+  if(options.QUICK_MODE){
+    if(measure_moments.size() < 2*max_num_points)
+      max_num_points = static_cast<size_t>(floor(measure_moments.size()/2));
+    size_t n_points = 0;
+    n_points = ensure_pos_def_mom_seq(measure_moments, tolerance,
+                                      VERBOSE, log_scale);
+    if(VERBOSE)
+      cerr << "n_points = " << n_points << endl;
+
+    MomentSequence obs_mom_seq(std::move(measure_moments), log_scale);
+    if(VERBOSE)
+      print_recurrence(obs_mom_seq);
+
+    result.estimate =
+      quadrature_estimate(VERBOSE, obs_mom_seq, counts_hist[1], distinct_obs,
+                          tolerance, max_iter, n_points);
+    result.lower_ci = result.estimate;
+    result.upper_ci = result.estimate;
+    result.n_points = n_points;
+    return;
+  }
+
+  // NOT QUICK MODE, BOOTSTRAP
+  vector<double> quad_estimates;
+
+  //setup rng
+  const RNGHolder rng_holder(options.seed);
+  gsl_rng *rng = rng_holder.rng;
+
+  // hist may be sparse, to speed up bootstrapping
+  // sample only from positive entries
+  vector<size_t> counts_hist_distinct_counts;
+  vector<double> distinct_counts_hist;
+  for (size_t i = 0; i < counts_hist.size(); i++){
+    if (counts_hist[i] > 0) {
+      counts_hist_distinct_counts.push_back(i);
+      distinct_counts_hist.push_back(counts_hist[i]);
+    }
+  }
+  const unsigned int n_distinct =
+    static_cast<unsigned int>(accumulate(distinct_counts_hist.begin(),
+                                         distinct_counts_hist.end(), 0.0));
+
+  PhaseTimer bootstrap_timer(options.stats, "bootstrap");
+  for(size_t iter = 0;
+      iter < max_iter && quad_estimates.size() < options.bootstraps;
+      ++iter){
+    if(VERBOSE)
+      cerr << "iter=" << "\t" << iter << endl;
+
+    vector<double> sample_hist;
+    resample_hist(rng, counts_hist_distinct_counts,
+                  distinct_counts_hist, n_distinct, sample_hist);
+
+    const double sampled_distinct = summarize_histogram(sample_hist).distinct;
+    // initialize log moments, 0th moment is 1
+    vector<double> log_bootstrap_moments(1, 0.0);
+    // moments[r] = (r + 1)! n_{r+1} / n_1
+    for(size_t i = 0; i < 2*max_num_points; i++)
+      log_bootstrap_moments.push_back(i + 2 < sample_hist.size() ?
+                                      log_factorial[i + 2]
+                                      + log(sample_hist[i + 2])
+                                      - log(sample_hist[1]) :
+                                      -std::numeric_limits<double>::infinity());
+
+    vector<double> bootstrap_moments;
+    const double bootstrap_log_scale =
+      scale_log_moments(log_bootstrap_moments, bootstrap_moments);
+
+    size_t n_points = 0;
+    n_points = ensure_pos_def_mom_seq(bootstrap_moments, tolerance,
+                                      VERBOSE, bootstrap_log_scale);
+    n_points = std::min(n_points, max_num_points);
+    if(VERBOSE)
+      cerr << "n_points = " << n_points << endl;
+
+    MomentSequence bootstrap_mom_seq(std::move(bootstrap_moments),
+                                     bootstrap_log_scale);
+
+    const double estimated_unobs =
+      quadrature_estimate(VERBOSE, bootstrap_mom_seq, counts_hist[1],
+                          sampled_distinct, tolerance, max_iter, n_points);
+
+    if(VERBOSE){
+      cerr << "bootstrapped_moments=" << endl;
+      for(size_t i = 0; i < bootstrap_mom_seq.moments.size(); i++)
+        cerr << bootstrap_mom_seq.moments[i] << endl;
+      print_recurrence(bootstrap_mom_seq);
+      cerr << "estimated_unobs=" << "\t" << estimated_unobs << endl;
+    }
+
+    quad_estimates.push_back(estimated_unobs);
+  }
+  bootstrap_timer.stop();
+  if (options.stats)
+    options.stats->add("bootstraps", quad_estimates.size());
+
+  const PhaseTimer ci_timer(options.stats, "ci");
+  median_and_ci(quad_estimates, options.c_level, result.estimate,
+                result.lower_ci, result.upper_ci);
+  result.n_points = 0;
+}
@@ -0,0 +1,214 @@
+/*    Copyright (C) 2013-2015 University of Southern California and
+ *                            Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Timothy Daley, Chao Deng, Victoria Helus, and Andrew Smith
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPLEXITY_ESTIMATES_HPP
+#define COMPLEXITY_ESTIMATES_HPP
+
+#include <string>
+#include <vector>
+
+#include <gsl/gsl_rng.h>
+
+class RunStats;
+
+// The estimators behind the preseq commands, working on a histogram
+// hist where hist[j] is the number of distinct reads (or bins) seen j
+// times. Nothing here keeps state between calls: every bootstrap uses
+// its own generator of type gsl_rng_default seeded from the options,
+// so any number of estimates can run at once on different threads.
+// Estimates that cannot be made throw SMITHLABException. Given a
+// RunStats, the estimates time their phases ("interpolation",
+// "cf_search", "bootstrap", "ci") and count the bootstraps, those
+// rejected and the degrees of the continued fractions chosen.
+
+/////////////////////////////////////////////////////////
+// Whole estimates, as made by the preseq commands
+
+// lc_extrap and gc_extrap; the defaults are those of lc_extrap
+struct ExtrapOptions {
+  ExtrapOptions() : max_terms(100), max_extrapolation(1.0e10),
+                    step_size(1e6), bootstraps(100), diagonal(0),
+                    c_level(0.95), seed(1), DEFECTS(false),
+                    SINGLE_ESTIMATE(false), checkpoint_every(10),
+                    RESUME(false), stats(NULL) {}
+  size_t max_terms;
+  double max_extrapolation;
+  double step_size;
+  size_t bootstraps;
+  int diagonal;
+  double c_level;
+  unsigned long int seed;
+  bool DEFECTS;
+  bool SINGLE_ESTIMATE;
+  // bootstrap checkpoints, off if checkpoint_file is empty
+  std::string checkpoint_file;
+  size_t checkpoint_every;
+  bool RESUME;
+  RunStats *stats;
+};
+
+// estimates[i] is the expected yield after (i + 1)*step_size reads;
+// the confidence intervals are empty for a single estimate
+struct ExtrapCurve {
+  std::vector<double> estimates;
+  std::vector<double> lower_ci;
+  std::vector<double> upper_ci;
+};
+
+void
+extrap_curve(const bool VERBOSE, const std::vector<double> &hist,
+             const ExtrapOptions &options, ExtrapCurve &curve);
+
+// c_curve: the expected distinct reads in subsamples of
+// step_size, 2 step_size, ... up to upper_limit reads
+void
+interpolate_curve(const std::vector<double> &hist, const double step_size,
+                  const size_t upper_limit, std::vector<size_t> &sample_sizes,
+                  std::vector<double> &expected_distinct);
+
+struct BoundPopOptions {
+  BoundPopOptions() : max_num_points(10), tolerance(1e-20), bootstraps(500),
+                      c_level(0.95), max_iter(100), seed(1),
+                      QUICK_MODE(false), stats(NULL) {}
+  size_t max_num_points;
+  double tolerance;
+  size_t bootstraps;
+  double c_level;
+  size_t max_iter;
+  unsigned long int seed;
+  bool QUICK_MODE;
+  RunStats *stats;
+};
+
+// the lower bound on the number of species; in quick mode there are
+// no bootstraps and the interval is just the estimate
+struct BoundPopEstimate {
+  BoundPopEstimate() : estimate(0.0), lower_ci(0.0), upper_ci(0.0),
+                       n_points(0) {}
+  double estimate;
+  double lower_ci;
+  double upper_ci;
+  size_t n_points;
+};
+
+void
+bound_pop_estimate(const bool VERBOSE, const std::vector<double> &hist,
+                   const BoundPopOptions &options, BoundPopEstimate &result);
+
+
+/////////////////////////////////////////////////////////
+// The steps the estimates are made of
+
+// what the estimates take from a histogram, found in one pass
+struct HistogramSummary {
+  HistogramSummary() : distinct(0.0), total(0.0),
+                       counts_before_first_zero(1), distinct_counts(0),
+                       good_toulmin_2x(0.0) {}
+  // sum of hist[j], the distinct reads
+  double distinct;
+  // sum of j hist[j], the reads
+  double total;
+  // the first j > 0 with hist[j] == 0, or hist.size() if there is none
+  size_t counts_before_first_zero;
+  // the number of j with hist[j] > 0
+  size_t distinct_counts;
+  // sum of (-1)^(j + 1) hist[j], as GoodToulmin2xExtrap
+  double good_toulmin_2x;
+};
+
+HistogramSummary
+summarize_histogram(const std::vector<double> &hist);
+
+// max_terms limited to the counts before the first zero in hist and
+// made even, as the continued fractions use it
+size_t
+usable_max_terms(const std::vector<double> &hist, const size_t max_terms);
+
+size_t
+usable_max_terms(const HistogramSummary &summary, const size_t max_terms);
+
+// usable_max_terms, after checking that hist can be extrapolated at all
+size_t
+extrapolation_max_terms(const std::vector<double> &hist,
+                        const size_t max_terms);
+
+// negative if the library is expected to saturate in doubling of size
+double
+GoodToulmin2xExtrap(const std::vector<double> &counts_hist);
+
+// expected distinct in a subsample of n from N reads with S distinct
+double
+interpolate_distinct(const std::vector<double> &hist, const size_t N,
+                     const size_t S, const size_t n);
+
+// draw a histogram of the same number of distinct reads; hist is
+// given by its positive entries distinct_counts_hist at the indices
+// vals_hist_distinct_counts, and distinct is their sum
+void
+resample_hist(const gsl_rng *rng,
+              const std::vector<size_t> &vals_hist_distinct_counts,
+              const std::vector<double> &distinct_counts_hist,
+              const unsigned int distinct, std::vector<double> &out_hist);
+
+// false if the continued fraction for the lower bound is not valid
+bool
+extrap_single_estimate(const bool VERBOSE, const bool DEFECTS,
+                       const std::vector<double> &hist,
+                       size_t max_terms, const int diagonal,
+                       const double step_size,
+                       const double max_extrapolation,
+                       std::vector<double> &yield_estimate,
+                       RunStats *stats = NULL);
+
+void
+extrap_bootstrap(const bool VERBOSE, const bool DEFECTS,
+                 const unsigned long int seed,
+                 const std::vector<double> &orig_hist,
+                 const size_t bootstraps, const size_t orig_max_terms,
+                 const int diagonal, const double bin_step_size,
+                 const double max_extrapolation, const size_t max_iter,
+                 const std::string &checkpoint_file,
+                 const size_t checkpoint_every, const bool RESUME,
+                 std::vector<std::vector<double> > &bootstrap_estimates,
+                 RunStats *stats = NULL);
+
+void
+median_and_ci(const std::vector<double> &estimates, const double ci_level,
+              double &median_estimate, double &lower_ci_estimate,
+              double &upper_ci_estimate);
+
+void
+mean_and_ci(const std::vector<double> &estimates, const double ci_level,
+            double &mean_estimate, double &lower_ci_estimate,
+            double &upper_ci_estimate);
+
+void
+log_mean(const bool VERBOSE, const std::vector<double> &estimates,
+         const double c_level, double &log_mean, double &log_lower_ci,
+         double &log_upper_ci);
+
+// median and interval at each point of the bootstrapped curves
+void
+vector_median_and_ci(const std::vector<std::vector<double> > &bootstrap_estimates,
+                     const double ci_level,
+                     std::vector<double> &yield_estimates,
+                     std::vector<double> &lower_ci_lognormal,
+                     std::vector<double> &upper_ci_lognormal);
+
+#endif
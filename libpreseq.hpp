@@ -0,0 +1,33 @@
+/*    Copyright (C) 2013-2015 University of Southern California and
+ *                            Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Timothy Daley and Andrew D. Smith
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBPRESEQ_HPP
+#define LIBPRESEQ_HPP
+
+// The interface of libpreseq.a and libpreseq.so: the loaders that build
+// a histogram from reads, and the estimators that make curves and
+// confidence intervals from it. Build with -DHAVE_SAMTOOLS, as the
+// library is, to get the BAM loaders. Both take an optional RunStats
+// for the timings and counters written by --stats-json.
+
+#include "load_data_for_complexity.hpp"
+#include "complexity_estimates.hpp"
+#include "run_stats.hpp"
+
+#endif
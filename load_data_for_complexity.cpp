@@ -20,8 +20,29 @@
 #include "load_data_for_complexity.hpp"
 
 #include <queue>
+#include <deque>
+#include <map>
 #include <sstream>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef _WIN32
   #include <unordered_map>
@@ -32,6 +53,8 @@
 #include "GenomicRegion.hpp"
 #include "MappedRead.hpp"
 #include "RNG.hpp"
+#include "binary_mapped_reads.hpp"
+#include "run_stats.hpp"
 
 using std::string;
 using std::vector;
@@ -43,6 +66,28 @@ using std::cerr;
 using std::tr1::unordered_map;
 
 
+//////////////////////////////////////////////////////////////////////
+// Input streams
+/////////////////////////////////////////////////////////////////////
+
+// "-" and "/dev/stdin" both name the standard input, so output from an
+// aligner can be piped straight in; nothing below seeks or re-reads
+bool
+is_standard_input(const string &filename) {
+  return filename == "-" || filename == "/dev/stdin";
+}
+
+// buffer to construct the input stream on; NULL if the file could not
+// be opened, which leaves the stream in a failed state
+static std::streambuf *
+open_input_buffer(const string &filename, std::ifstream &in_file) {
+  if (is_standard_input(filename))
+    return std::cin.rdbuf();
+  in_file.open(filename.c_str());
+  return in_file ? in_file.rdbuf() : NULL;
+}
+
+
 //////////////////////////////////////////////////////////////////////
 // Data imputation
 /////////////////////////////////////////////////////////////////////
@@ -106,6 +151,42 @@ update_se_duplicate_counts_hist(const GenomicRegion &curr_gr,
 
 
 
+// hand a copy of the partial histogram, including the run of
+// duplicates still being counted, to the observer
+static void
+report_partial_hist(HistogramObserver *observer, const size_t n_reads,
+                    const vector<double> &counts_hist,
+                    const size_t current_count) {
+  vector<double> partial_hist(counts_hist);
+  if (current_count > 0) {
+    if (partial_hist.size() < current_count + 1)
+      partial_hist.resize(current_count + 1, 0.0);
+    ++partial_hist[current_count];
+  }
+  observer->snapshot(n_reads, partial_hist);
+}
+
+
+// in >> gr, with the time it takes on watch
+static bool
+timed_read(std::istream &in, GenomicRegion &gr, StopWatch &watch) {
+  watch.start();
+  const bool GOOD = static_cast<bool>(in >> gr);
+  watch.stop();
+  return GOOD;
+}
+
+
+// the records of a serial loader and the shares of loading it timed
+static void
+report_load_stats(RunStats *stats, const size_t n_records,
+                  const StopWatch &decode_watch, const StopWatch &hist_watch) {
+  stats->add("records", n_records);
+  stats->add_share("load.decode", decode_watch.seconds);
+  stats->add_share("load.histogram", hist_watch.seconds);
+}
+
+
 /////comparison function for priority queue/////////////////
 
 /**************** FOR CLARITY BELOW WHEN COMPARING READS *************/
@@ -156,50 +237,146 @@ is_ready_to_pop(const ReadPQ &pq,
 }
 
 
-static void
-empty_pq(GenomicRegion &curr_gr, GenomicRegion &prev_gr,
-         size_t &current_count, vector<double> &counts_hist,
-         ReadPQ &read_pq, const string &input_file_name) {
-  
-  curr_gr = read_pq.top();
-  read_pq.pop();
-  
-  // update counts hist
-  const bool UPDATE_SUCCESS =
-    update_pe_duplicate_counts_hist(curr_gr, prev_gr, counts_hist,
-                                    current_count);
-  if (!UPDATE_SUCCESS) {
-    std::ostringstream oss;
-    oss << "reads unsorted in: " << input_file_name << "\n"
-        << "prev = \t" << prev_gr << "\n"
-        << "curr = \t" << curr_gr << "\n"
-        << "Increase seg_len if in paired end mode";
-    throw SMITHLABException(oss.str());
-  }
-  prev_gr = curr_gr;
-}
-
-
 /*
  * This code is used to deal with read data in BAM format.
  */
 #ifdef HAVE_SAMTOOLS
 // switching dependency on bamtools to samtools
 #include <SAM.hpp>
+#include <cerrno>
+
+
+// peek at the first byte of a SAM/BAM input without consuming it: BAM
+// is BGZF compressed and starts with the gzip magic, SAM is plain text
+static bool
+sam_input_is_bam(const string &filename) {
+  unsigned char magic = 0;
+  ssize_t n_peeked = 0;
+  if (!is_standard_input(filename)) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    n_peeked = in.read(reinterpret_cast<char *>(&magic), 1).gcount();
+  }
+  else {
+    // redirected regular files allow pread at the current offset; for
+    // pipes, tee(2) copies the head of the pipe without consuming it
+    const off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (offset >= 0)
+      n_peeked = pread(STDIN_FILENO, &magic, 1, offset);
+#ifdef __linux__
+    else if (errno == ESPIPE) {
+      int peek_pipe[2];
+      if (pipe(peek_pipe) == 0) {
+        if (tee(STDIN_FILENO, peek_pipe[1], 1, 0) == 1)
+          n_peeked = read(peek_pipe[0], &magic, 1);
+        close(peek_pipe[0]);
+        close(peek_pipe[1]);
+      }
+    }
+#endif
+    // nothing to look at: aligners almost always pipe BAM
+    if (n_peeked != 1)
+      return true;
+  }
+  return n_peeked == 1 && magic == 0x1f;
+}
+
+
+// Reader for SAM or BAM through the samtools API.  SAMReader chooses
+// its decoder from the file name extension and so cannot read from a
+// pipe; this fills the SAMRecord fields used by the loaders (the
+// sequence and quality strings are left empty) and never seeks.
+class SAMStreamReader {
+public:
+  SAMStreamReader(const string &filename);
+  ~SAMStreamReader();
+
+  bool is_good() const {return GOOD;}
+  SAMStreamReader &operator>>(SAMRecord &samr);
+  // the record behind the last SAMRecord, for its CIGAR and sequence
+  const bam1_t *record() const {return algn_p;}
+
+private:
+  SAMStreamReader(const SAMStreamReader &);
+  SAMStreamReader &operator=(const SAMStreamReader &);
+
+  samfile_t *file_handler;
+  bam1_t *algn_p;
+  bool GOOD;
+};
+
+
+SAMStreamReader::SAMStreamReader(const string &filename) :
+  file_handler(NULL), algn_p(NULL), GOOD(false) {
+  const string mode = sam_input_is_bam(filename) ? "rb" : "r";
+  // samtools reads the standard input from "-"
+  const string name = is_standard_input(filename) ? "-" : filename;
+  file_handler = samopen(name.c_str(), mode.c_str(), NULL);
+  if (file_handler != NULL && file_handler->header != NULL) {
+    algn_p = bam_init1();
+    GOOD = true;
+  }
+}
+
+
+SAMStreamReader::~SAMStreamReader() {
+  if (algn_p != NULL)
+    bam_destroy1(algn_p);
+  if (file_handler != NULL)
+    samclose(file_handler);
+}
+
+
+SAMStreamReader &
+SAMStreamReader::operator>>(SAMRecord &samr) {
+  GOOD = GOOD && samread(file_handler, algn_p) >= 0;
+  if (!GOOD)
+    return *this;
+
+  const bam1_core_t &core = algn_p->core;
+  samr.is_primary = !(core.flag & BAM_FSECONDARY);
+  samr.is_mapped = !(core.flag & BAM_FUNMAP) && core.tid >= 0;
+  samr.is_mapping_paired = (core.flag & BAM_FPROPER_PAIR);
+  samr.is_Trich = (core.flag & BAM_FREAD1);
+  samr.seg_len = core.isize;
+
+  GenomicRegion &r = samr.mr.r;
+  r.set_name(bam1_qname(algn_p));
+  r.set_score(0);
+  r.set_strand(bam1_strand(algn_p) ? '-' : '+');
+  if (samr.is_mapped) {
+    r.set_chrom(file_handler->header->target_name[core.tid]);
+    r.set_start(core.pos);
+    r.set_end(bam_calend(&core, bam1_cigar(algn_p)));
+  }
+  return *this;
+}
+
+
+// sam_reader >> samr, with the time it takes on watch; BGZF is
+// decompressed as the records are read, so this includes it
+static bool
+timed_read(SAMStreamReader &sam_reader, SAMRecord &samr, StopWatch &watch) {
+  watch.start();
+  sam_reader >> samr;
+  watch.stop();
+  return sam_reader.is_good();
+}
 
 
 size_t
 load_counts_BAM_se(const string &input_file_name, 
-                   vector<double> &counts_hist) {
-  const string mapper = "general";
-  SAMReader sam_reader(input_file_name, mapper);
+                   vector<double> &counts_hist,
+                   HistogramObserver *observer, RunStats *stats) {
+  SAMStreamReader sam_reader(input_file_name);
   if(!(sam_reader.is_good()))
     throw SMITHLABException("problem opening input file " 
                             + input_file_name);
 
+  StopWatch decode_watch(stats != NULL), hist_watch(stats != NULL);
   SAMRecord samr;
-  sam_reader >> samr;
+  timed_read(sam_reader, samr, decode_watch);
   size_t n_reads = 1;
+  size_t n_records = 1;
   // resize vals_hist, make sure it starts out empty
   counts_hist.clear();
   counts_hist.resize(2, 0.0);
@@ -208,7 +385,8 @@ load_counts_BAM_se(const string &input_file_name,
   MappedRead prev_mr, curr_mr;
   prev_mr = samr.mr;
 
-  while (sam_reader >> samr, sam_reader.is_good()) {
+  while (timed_read(sam_reader, samr, decode_watch)) {
+    ++n_records;
     // only convert mapped and primary reads
     if (samr.is_primary && samr.is_mapped) {
 
@@ -218,14 +396,19 @@ load_counts_BAM_se(const string &input_file_name,
         //only count unpaired reads or the left mate of paired reads
         
         curr_mr = samr.mr;
+        hist_watch.start();
         update_se_duplicate_counts_hist(curr_mr.r, prev_mr.r, 
                                         input_file_name,
                                         counts_hist, 
                                         current_count);
+        hist_watch.stop();
         
         // update number of reads and prev read
         ++n_reads;
         prev_mr = samr.mr;
+
+        if (observer && observer->is_due(n_reads))
+          report_partial_hist(observer, n_reads, counts_hist, current_count);
       }
     }
   }
@@ -234,7 +417,9 @@ load_counts_BAM_se(const string &input_file_name,
   if (counts_hist.size() < current_count + 1)
     counts_hist.resize(current_count + 1, 0.0);
   ++counts_hist[current_count];
-  
+
+  if (stats)
+    report_load_stats(stats, n_records, decode_watch, hist_watch);
   return n_reads;
 }
 
@@ -290,18 +475,12 @@ GenomicRegionIsNull(const GenomicRegion &gr){
 }
 
 
+// check that curr_gr, the next fragment, does not come before prev_gr
+// and count it
 static void
-empty_pq(GenomicRegion &prev_gr,
-         priority_queue<GenomicRegion,
-                        vector<GenomicRegion>,
-                        GenomicRegionOrderChecker> &read_pq,
-           const string &input_file_name,
-         vector<double> &counts_hist,
-         size_t &current_count) {
-
-  GenomicRegion curr_gr = read_pq.top();
-  read_pq.pop();
-
+count_fragment(GenomicRegion &prev_gr, const GenomicRegion &curr_gr,
+               const string &input_file_name, vector<double> &counts_hist,
+               size_t &current_count) {
   // check if reads are sorted
   if (curr_gr.same_chrom(prev_gr) &&
       curr_gr.get_start() < prev_gr.get_start()
@@ -332,17 +511,350 @@ empty_pq(GenomicRegion &prev_gr,
 }
 
 
+static void
+empty_pq(GenomicRegion &prev_gr,
+         priority_queue<GenomicRegion,
+                        vector<GenomicRegion>,
+                        GenomicRegionOrderChecker> &read_pq,
+           const string &input_file_name,
+         vector<double> &counts_hist,
+         size_t &current_count,
+         StopWatch &pq_watch, StopWatch &hist_watch) {
+
+  pq_watch.start();
+  GenomicRegion curr_gr = read_pq.top();
+  read_pq.pop();
+  pq_watch.stop();
+  hist_watch.start();
+  count_fragment(prev_gr, curr_gr, input_file_name, counts_hist,
+                 current_count);
+  hist_watch.stop();
+}
+
+
+// samr and mate have the same name: push the fragment they span, or
+// each read if they cannot be merged into one
+template <class Push> static void
+pair_mates(const bool VERBOSE, const size_t suffix_len,
+           const size_t MAX_SEGMENT_LENGTH, SAMRecord &samr, SAMRecord &mate,
+           const Push &push, size_t &n_paired, size_t &n_unpaired) {
+  if (same_read(suffix_len, samr.mr, mate.mr)) {
+    if (samr.is_Trich)
+      std::swap(samr, mate);
+    GenomicRegion merged;
+    int len = 0;
+    const bool MERGE_SUCCESS =
+      merge_mates(suffix_len, MAX_SEGMENT_LENGTH, mate.mr.r, samr.mr.r,
+                  merged, len);
+    // merge success!
+    if (MERGE_SUCCESS && len >= 0 &&
+        len <= static_cast<int>(MAX_SEGMENT_LENGTH)) {
+      push(merged);
+      ++n_paired;
+      return;
+    }
+    // informative error message!
+    if (VERBOSE) {
+      const string name(mate.mr.r.get_name());
+      cerr << "problem merging read "
+           << name.substr(0, name.size() - suffix_len)
+           << ", splitting read" << endl
+           << samr.mr << "\t" << samr.is_mapping_paired << endl
+           << mate.mr << "\t" << mate.is_mapping_paired << endl
+           << "To merge, set max segement "
+           << "length (seg_len) higher." << endl;
+    }
+  }
+  push(samr.mr.r);
+  push(mate.mr.r);
+  n_unpaired += 2;
+}
+
+
+/* spilling paired-end reads to disk */
+
+// Records written to an unlinked temporary file in $TMPDIR (or /tmp)
+// and then read back once, in the order written.
+class SpillRun {
+public:
+  SpillRun();
+  ~SpillRun() {fclose(file);}
+  void start_reading();
+
+  FILE *file;
+  size_t n_records;
+  // how many merges the records went through
+  size_t level;
+
+private:
+  SpillRun(const SpillRun &);
+  SpillRun &operator=(const SpillRun &);
+};
+
+
+SpillRun::SpillRun() : file(NULL), n_records(0), level(0) {
+  const char *tmp_dir = getenv("TMPDIR");
+  const string dir = (tmp_dir != NULL && *tmp_dir != '\0') ? tmp_dir : "/tmp";
+  const string name_template = dir + "/preseq_spill.XXXXXX";
+  vector<char> path(name_template.begin(), name_template.end());
+  path.push_back('\0');
+  const int fd = mkstemp(&path[0]);
+  if (fd < 0)
+    throw SMITHLABException("could not create a spill file in " + dir);
+  unlink(&path[0]);
+  file = fdopen(fd, "w+b");
+  if (file == NULL) {
+    close(fd);
+    throw SMITHLABException("could not open a spill file in " + dir);
+  }
+}
+
+
+void
+SpillRun::start_reading() {
+  if (fflush(file) != 0 || ferror(file))
+    throw SMITHLABException("problem writing a spill file, "
+                            "is the temporary directory full?");
+  rewind(file);
+}
+
+
+template <class T> static void
+write_value(FILE *file, const T &x) {
+  fwrite(&x, sizeof(T), 1, file);
+}
+
+template <class T> static void
+read_value(FILE *file, T &x) {
+  if (fread(&x, sizeof(T), 1, file) != 1)
+    throw SMITHLABException("problem reading a spill file");
+}
+
+static void
+write_string(FILE *file, const string &s) {
+  write_value(file, static_cast<uint32_t>(s.size()));
+  fwrite(s.data(), 1, s.size(), file);
+}
+
+static void
+read_string(FILE *file, string &s) {
+  uint32_t n = 0;
+  read_value(file, n);
+  s.resize(n);
+  if (n > 0 && fread(&s[0], 1, n, file) != n)
+    throw SMITHLABException("problem reading a spill file");
+}
+
+
+// fragments are counted by their position alone
+static void
+write_record(FILE *file, const GenomicRegion &gr) {
+  write_string(file, gr.get_chrom());
+  write_value(file, static_cast<uint64_t>(gr.get_start()));
+  write_value(file, static_cast<uint64_t>(gr.get_end()));
+}
+
+static void
+read_record(FILE *file, GenomicRegion &gr) {
+  string chrom;
+  uint64_t start = 0, end = 0;
+  read_string(file, chrom);
+  read_value(file, start);
+  read_value(file, end);
+  gr = GenomicRegion(chrom, start, end);
+}
+
+
+// the fields of a dangling mate that pairing uses
+static void
+write_record(FILE *file, const SAMRecord &samr) {
+  const GenomicRegion &r = samr.mr.r;
+  write_string(file, r.get_name());
+  write_string(file, r.get_chrom());
+  write_value(file, static_cast<uint64_t>(r.get_start()));
+  write_value(file, static_cast<uint64_t>(r.get_end()));
+  write_value(file, static_cast<double>(r.get_score()));
+  write_value(file, r.get_strand());
+  write_value(file, samr.seg_len);
+  const uint8_t flags = samr.is_Trich | (samr.is_mapping_paired << 1);
+  write_value(file, flags);
+}
+
+static void
+read_record(FILE *file, SAMRecord &samr) {
+  string name, chrom;
+  uint64_t start = 0, end = 0;
+  double score = 0.0;
+  char strand = '+';
+  uint8_t flags = 0;
+  read_string(file, name);
+  read_string(file, chrom);
+  read_value(file, start);
+  read_value(file, end);
+  read_value(file, score);
+  read_value(file, strand);
+  read_value(file, samr.seg_len);
+  read_value(file, flags);
+  samr.mr.r = GenomicRegion(chrom, start, end, name, score, strand);
+  samr.is_Trich = flags & 1;
+  samr.is_mapping_paired = flags & 2;
+  samr.is_primary = true;
+  samr.is_mapped = true;
+}
+
+
+typedef vector<std::unique_ptr<SpillRun> > SpillRuns;
+
+// k-way merge of runs that are each in order: emit(x) is called on
+// every record, smallest first, where greater(a, b) is true if a
+// should come after b
+template <class T, class Greater, class Emit> static void
+merge_spill_runs(SpillRuns &runs, const Greater &greater, const Emit &emit) {
+  vector<T> heads(runs.size());
+  vector<size_t> n_left(runs.size(), 0);
+  const std::function<bool(size_t, size_t)> run_greater =
+    [&](const size_t a, const size_t b) {return greater(heads[a], heads[b]);};
+  priority_queue<size_t, vector<size_t>,
+                 std::function<bool(size_t, size_t)> > next_run(run_greater);
+  for (size_t i = 0; i < runs.size(); ++i) {
+    runs[i]->start_reading();
+    if (runs[i]->n_records > 0) {
+      read_record(runs[i]->file, heads[i]);
+      n_left[i] = runs[i]->n_records - 1;
+      next_run.push(i);
+    }
+  }
+  while (!next_run.empty()) {
+    const size_t i = next_run.top();
+    next_run.pop();
+    emit(heads[i]);
+    if (n_left[i] > 0) {
+      read_record(runs[i]->file, heads[i]);
+      --n_left[i];
+      next_run.push(i);
+    }
+  }
+}
+
+
+// runs are merged this many at a time, to keep few files open
+static const size_t spill_merge_width = 16;
+
+static bool
+mate_name_greater(const SAMRecord &a, const SAMRecord &b) {
+  return a.mr.r.get_name() > b.mr.r.get_name();
+}
+
+// Merges the newest runs while spill_merge_width of them have the same
+// level, like carries in a counter.  The levels of the runs never go
+// up from oldest to newest, each record is rewritten once per level,
+// O(log n) times, and fewer than spill_merge_width runs of each level
+// stay open.
+template <class T, class Greater> static void
+collapse_spill_runs(SpillRuns &runs, const Greater &greater) {
+  while (runs.size() >= spill_merge_width &&
+         runs[runs.size() - spill_merge_width]->level == runs.back()->level) {
+    SpillRuns newest;
+    for (size_t i = runs.size() - spill_merge_width; i < runs.size(); ++i)
+      newest.push_back(std::move(runs[i]));
+    runs.resize(runs.size() - spill_merge_width);
+
+    std::unique_ptr<SpillRun> merged(new SpillRun);
+    merged->level = newest.back()->level + 1;
+    merge_spill_runs<T>(newest, greater, [&](const T &x) {
+        write_record(merged->file, x);
+        ++merged->n_records;
+      });
+    runs.push_back(std::move(merged));
+  }
+}
+
+
+// write the queued fragments as one run, in order, and free the queue
+static void
+spill_fragments(ReadPQ &read_pq, SpillRuns &fragment_runs) {
+  fragment_runs.push_back(std::unique_ptr<SpillRun>(new SpillRun));
+  SpillRun &run = *fragment_runs.back();
+  while (!read_pq.empty()) {
+    write_record(run.file, read_pq.top());
+    read_pq.pop();
+    ++run.n_records;
+  }
+  ReadPQ().swap(read_pq);
+  collapse_spill_runs<GenomicRegion>(fragment_runs,
+                                     GenomicRegionOrderChecker::start_check);
+}
+
+
+// write the dangling mates as one run, by name, and free the table
+static void
+spill_mates(unordered_map<string, SAMRecord> &dangling_mates,
+            SpillRuns &mate_runs) {
+  vector<const SAMRecord *> by_name;
+  by_name.reserve(dangling_mates.size());
+  for (unordered_map<string, SAMRecord>::const_iterator itr =
+         dangling_mates.begin(); itr != dangling_mates.end(); ++itr)
+    by_name.push_back(&itr->second);
+  std::sort(by_name.begin(), by_name.end(),
+            [](const SAMRecord *a, const SAMRecord *b) {
+              return mate_name_greater(*b, *a);
+            });
+  mate_runs.push_back(std::unique_ptr<SpillRun>(new SpillRun));
+  SpillRun &run = *mate_runs.back();
+  for (size_t i = 0; i < by_name.size(); ++i)
+    write_record(run.file, *by_name[i]);
+  run.n_records = by_name.size();
+  unordered_map<string, SAMRecord>().swap(dangling_mates);
+  collapse_spill_runs<SAMRecord>(mate_runs, mate_name_greater);
+}
+
+
+// rough heap use of the dangling mates and of the queued fragments,
+// from the name length of the latest read
+static size_t
+dangling_bytes(const unordered_map<string, SAMRecord> &dangling_mates,
+               const SAMRecord &samr) {
+  const size_t mate_bytes = sizeof(std::pair<const string, SAMRecord>) +
+    2*(samr.mr.r.get_name().size() + 1) + 32;
+  return dangling_mates.size()*mate_bytes +
+    dangling_mates.bucket_count()*sizeof(void *);
+}
+
+static size_t
+queue_bytes(const size_t n_fragments, const SAMRecord &samr) {
+  const size_t fragment_bytes =
+    sizeof(GenomicRegion) + samr.mr.r.get_name().size() + 8;
+  return n_fragments*fragment_bytes;
+}
+
+
+// count the fragments of runs that are each in order
+static void
+count_spilled_fragments(SpillRuns &fragment_runs, GenomicRegion &prev_gr,
+                        const string &input_file_name,
+                        vector<double> &counts_hist, size_t &current_count) {
+  merge_spill_runs<GenomicRegion>(fragment_runs,
+                                  GenomicRegionOrderChecker::start_check,
+                                  [&](const GenomicRegion &gr) {
+      count_fragment(prev_gr, gr, input_file_name, counts_hist,
+                     current_count);
+    });
+  fragment_runs.clear();
+}
+
+
 size_t
 load_counts_BAM_pe(const bool VERBOSE,
                    const string &input_file_name,
                    const size_t MAX_SEGMENT_LENGTH,
                    const size_t MAX_READS_TO_HOLD,
+                   const size_t max_memory,
                    size_t &n_paired,
                    size_t &n_mates,
-                   vector<double> &counts_hist) {
+                   vector<double> &counts_hist,
+                   HistogramObserver *observer, RunStats *stats) {
   
-  const string mapper = "general";
-  SAMReader sam_reader(input_file_name, mapper);
+  SAMStreamReader sam_reader(input_file_name);
 
   // check sam_reader
   if(!(sam_reader.is_good()))
@@ -364,61 +876,46 @@ load_counts_BAM_pe(const bool VERBOSE,
   std::priority_queue<GenomicRegion, vector<GenomicRegion>,
                       GenomicRegionOrderChecker> read_pq;
   
+  const std::function<void(const GenomicRegion &)> push_fragment =
+    [&](const GenomicRegion &gr) {read_pq.push(gr);};
+  
   unordered_map<string, SAMRecord> dangling_mates;
+
+  StopWatch decode_watch(stats != NULL), pq_watch(stats != NULL),
+    hist_watch(stats != NULL);
+  size_t n_records = 0;
+  size_t pq_high_water = 0;
+  size_t dangling_high_water = 0;
+
+  // Over max_memory, the queue or the dangling mates, whichever holds
+  // more than half of it, are written to disk as a sorted run. From
+  // then on all fragments go through runs, merged once the input ends.
+  SpillRuns fragment_runs, mate_runs;
+  bool SPILLING = false;
+  size_t buffer_high_water = 0;
+  size_t n_spilled_fragments = 0, n_spilled_mates = 0;
   
-  while ((sam_reader >> samr, sam_reader.is_good())) {
+  while (timed_read(sam_reader, samr, decode_watch)) {
+    ++n_records;
     
     // only convert mapped and primary reads
     if (samr.is_primary && samr.is_mapped) {
       ++n_mates;
+      pq_watch.start();
       
       // deal with paired-end stuff
       if (samr.is_mapping_paired) {
         
         const size_t name_len = samr.mr.r.get_name().size() - suffix_len;
         const string read_name(samr.mr.r.get_name().substr(0, name_len));
-        
-        if (dangling_mates.find(read_name) != dangling_mates.end()) {
+
+        unordered_map<string, SAMRecord>::iterator mate =
+          dangling_mates.find(read_name);
+        if (mate != dangling_mates.end()) {
           // other end is in dangling mates, merge the two mates
-          if(same_read(suffix_len, samr.mr, 
-                       dangling_mates[read_name].mr)) {
-            if (samr.is_Trich)
-              std::swap(samr, dangling_mates[read_name]);
-            GenomicRegion merged;
-            int len = 0;
-            const bool MERGE_SUCCESS =
-              merge_mates(suffix_len, MAX_SEGMENT_LENGTH,
-                          dangling_mates[read_name].mr.r, samr.mr.r,
-                          merged, len);
-            // merge success!
-            if (MERGE_SUCCESS && len >= 0 &&
-                len <= static_cast<int>(MAX_SEGMENT_LENGTH)) {
-              read_pq.push(merged);
-              ++n_paired;
-            }
-            else {
-              // informative error message!
-              if (VERBOSE) {
-                cerr << "problem merging read "
-                     << read_name << ", splitting read" << endl
-                     << samr.mr << "\t" << samr.is_mapping_paired << endl
-                     << dangling_mates[read_name].mr << "\t" 
-		     << dangling_mates[read_name].is_mapping_paired << endl
-                     << "To merge, set max segement "
-                     << "length (seg_len) higher." << endl;
-              }
-              read_pq.push(samr.mr.r);
-              read_pq.push(dangling_mates[read_name].mr.r);
-              n_unpaired += 2;
-            }
-            dangling_mates.erase(read_name);
-          }
-          else {
-            read_pq.push(samr.mr.r);
-            read_pq.push(dangling_mates[read_name].mr.r);
-            dangling_mates.erase(read_name);
-            n_unpaired += 2;
-          }
+          pair_mates(VERBOSE, suffix_len, MAX_SEGMENT_LENGTH, samr,
+                     mate->second, push_fragment, n_paired, n_unpaired);
+          dangling_mates.erase(mate);
         }
         else // didn't find read in dangling_mates, store for later
           dangling_mates[read_name] = samr;
@@ -449,21 +946,80 @@ load_counts_BAM_pe(const bool VERBOSE,
         std::swap(tmp, dangling_mates);
         tmp.clear();
       }
-
+      pq_high_water = max(pq_high_water, read_pq.size());
+      dangling_high_water = max(dangling_high_water, dangling_mates.size());
+
+      if (max_memory > 0) {
+        const size_t mate_bytes = dangling_bytes(dangling_mates, samr);
+        const size_t fragment_bytes = queue_bytes(read_pq.size(), samr);
+        buffer_high_water = max(buffer_high_water, mate_bytes + fragment_bytes);
+        if (mate_bytes + fragment_bytes > max_memory) {
+          if (fragment_bytes > max_memory/2) {
+            n_spilled_fragments += read_pq.size();
+            spill_fragments(read_pq, fragment_runs);
+          }
+          if (mate_bytes > max_memory/2) {
+            n_spilled_mates += dangling_mates.size();
+            spill_mates(dangling_mates, mate_runs);
+          }
+          SPILLING = true;
+        }
+      }
+      pq_watch.stop();
       
       // now empty the priority queue
-      if (!(read_pq.empty()) &&
+      if (!SPILLING && !(read_pq.empty()) &&
           is_ready_to_pop(read_pq, samr.mr.r, MAX_SEGMENT_LENGTH)) {
         //begin emptying priority queue
         while (!(read_pq.empty()) &&
                is_ready_to_pop(read_pq, samr.mr.r, MAX_SEGMENT_LENGTH)) {
-          empty_pq(prev_gr, read_pq, input_file_name, counts_hist, current_count);
+          empty_pq(prev_gr, read_pq, input_file_name, counts_hist,
+                   current_count, pq_watch, hist_watch);
         }
       }
       
       if (VERBOSE && n_mates % progress_step == 0)
         cerr << "Processed " << n_mates << " records" << endl;
+
+      if (observer && observer->is_due(n_mates))
+        report_partial_hist(observer, n_mates, counts_hist, current_count);
+    }
+  }
+
+  if (!mate_runs.empty()) {
+    // pair the mates by name across the runs; those left alone are
+    // counted as unpaired reads
+    n_spilled_mates += dangling_mates.size();
+    spill_mates(dangling_mates, mate_runs);
+    pq_watch.start();
+    SAMRecord waiting;
+    bool WAITING = false;
+    merge_spill_runs<SAMRecord>(mate_runs, mate_name_greater,
+                                [&](SAMRecord &mate) {
+        if (WAITING && waiting.mr.r.get_name() == mate.mr.r.get_name()) {
+          pair_mates(VERBOSE, suffix_len, MAX_SEGMENT_LENGTH, mate, waiting,
+                     push_fragment, n_paired, n_unpaired);
+          WAITING = false;
+        }
+        else {
+          if (WAITING) {
+            read_pq.push(waiting.mr.r);
+            ++n_unpaired;
+          }
+          std::swap(waiting, mate);
+          WAITING = true;
+        }
+        if (queue_bytes(read_pq.size(), waiting) > max_memory) {
+          n_spilled_fragments += read_pq.size();
+          spill_fragments(read_pq, fragment_runs);
+        }
+      });
+    if (WAITING) {
+      read_pq.push(waiting.mr.r);
+      ++n_unpaired;
     }
+    mate_runs.clear();
+    pq_watch.stop();
   }
 
   // empty dangling mates of any excess reads
@@ -474,8 +1030,20 @@ load_counts_BAM_pe(const bool VERBOSE,
   }
   
   //final iteration
-  while(!read_pq.empty())
-    empty_pq(prev_gr, read_pq, input_file_name, counts_hist, current_count);
+  pq_high_water = max(pq_high_water, read_pq.size());
+  if (!SPILLING) {
+    while(!read_pq.empty())
+      empty_pq(prev_gr, read_pq, input_file_name, counts_hist,
+               current_count, pq_watch, hist_watch);
+  }
+  else {
+    n_spilled_fragments += read_pq.size();
+    spill_fragments(read_pq, fragment_runs);
+    hist_watch.start();
+    count_spilled_fragments(fragment_runs, prev_gr, input_file_name,
+                            counts_hist, current_count);
+    hist_watch.stop();
+  }
   
   if (counts_hist.size() < current_count + 1)
     counts_hist.resize(current_count + 1, 0.0);
@@ -489,63 +1057,621 @@ load_counts_BAM_pe(const bool VERBOSE,
   if (VERBOSE)
     cerr << "paired = " << n_paired << endl
          << "unpaired = " << n_unpaired << endl;
+  if (VERBOSE && (n_spilled_fragments > 0 || n_spilled_mates > 0))
+    cerr << "SPILLED " << n_spilled_fragments << " FRAGMENTS AND "
+         << n_spilled_mates << " MATES TO DISK" << endl;
+
+  if (stats) {
+    report_load_stats(stats, n_records, decode_watch, hist_watch);
+    stats->add_share("load.sort_pq", pq_watch.seconds);
+    stats->raise_to("pq_high_water", pq_high_water);
+    stats->raise_to("dangling_mates_high_water", dangling_high_water);
+    if (max_memory > 0) {
+      stats->set("max_memory_bytes", max_memory);
+      stats->raise_to("pe_buffer_bytes_high_water", buffer_high_water);
+      stats->add("spilled_fragments", n_spilled_fragments);
+      stats->add("spilled_mates", n_spilled_mates);
+    }
+  }
 
   return n_reads;
 }
 
-#endif
 
+// A fragment held until the input ends, by the position that counts
+// it.  Chromosomes are numbered as they are first seen; duplicates only
+// need equal fragments next to each other once sorted, not the order
+// of the chromosome names.
+struct FragmentKey {
+  size_t chrom;
+  size_t start;
+  size_t end;
+};
 
-/* this code is for BED file input */
+static bool
+fragment_key_greater(const FragmentKey &a, const FragmentKey &b) {
+  return a.chrom != b.chrom ? a.chrom > b.chrom :
+    (a.start != b.start ? a.start > b.start : a.end > b.end);
+}
 
-size_t
-load_counts_BED_se(const string input_file_name, 
-                   vector<double> &counts_hist) {
-  // resize vals_hist
-  counts_hist.clear();
-  counts_hist.resize(2, 0.0);
+static bool
+fragment_key_less(const FragmentKey &a, const FragmentKey &b) {
+  return fragment_key_greater(b, a);
+}
 
-  std::ifstream in(input_file_name.c_str());
-  if (!in)
-    throw SMITHLABException("problem opening file: " + input_file_name);
-  
-  GenomicRegion curr_gr, prev_gr;
-  if (!(in >> prev_gr))
-    throw SMITHLABException("problem opening file: " + input_file_name);
-  
-  size_t n_reads = 1;
-  size_t current_count = 1;
-  while (in >> curr_gr) {
-    update_se_duplicate_counts_hist(curr_gr, prev_gr, input_file_name,
-                                    counts_hist, current_count);
-    ++n_reads;
-    prev_gr.swap(curr_gr);
+static bool
+same_fragment(const FragmentKey &a, const FragmentKey &b) {
+  return a.chrom == b.chrom && a.start == b.start && a.end == b.end;
+}
+
+static void
+write_record(FILE *file, const FragmentKey &key) {
+  write_value(file, key);
+}
+
+static void
+read_record(FILE *file, FragmentKey &key) {
+  read_value(file, key);
+}
+
+// without -m, the keys held before they are spilled
+static const size_t default_fragment_memory = 1024*1024*1024;
+
+// sort the fragments and write them as one run, and free them
+static void
+spill_fragments(vector<FragmentKey> &fragments, SpillRuns &fragment_runs) {
+  std::sort(fragments.begin(), fragments.end(), fragment_key_less);
+  fragment_runs.push_back(std::unique_ptr<SpillRun>(new SpillRun));
+  SpillRun &run = *fragment_runs.back();
+  for (size_t i = 0; i < fragments.size(); ++i)
+    write_record(run.file, fragments[i]);
+  run.n_records = fragments.size();
+  vector<FragmentKey>().swap(fragments);
+  collapse_spill_runs<FragmentKey>(fragment_runs, fragment_key_greater);
+}
+
+// fragments come in order, so each run of equal ones is one count
+static void
+count_fragment_key(const FragmentKey &key, FragmentKey &prev,
+                   vector<double> &counts_hist, size_t &current_count) {
+  if (current_count > 0 && same_fragment(key, prev))
+    ++current_count;
+  else {
+    if (current_count > 0) {
+      if (counts_hist.size() < current_count + 1)
+        counts_hist.resize(current_count + 1, 0.0);
+      ++counts_hist[current_count];
+    }
+    current_count = 1;
   }
-  
-  // to account for the last read compared to the one before it.
-  if(counts_hist.size() < current_count + 1)
-    counts_hist.resize(current_count + 1, 0.0);
-  ++counts_hist[current_count];
-  
-  return n_reads;
+  prev = key;
 }
 
 
 size_t
-load_counts_BED_pe(const string input_file_name, 
-                   vector<double> &counts_hist) {
+load_counts_BAM_pe_name_sorted(const bool VERBOSE,
+                               const string &input_file_name,
+                               const size_t MAX_SEGMENT_LENGTH,
+                               const size_t max_memory,
+                               size_t &n_paired,
+                               size_t &n_mates,
+                               vector<double> &counts_hist,
+                               RunStats *stats) {
+
+  SAMStreamReader sam_reader(input_file_name);
+  if (!(sam_reader.is_good()))
+    throw SMITHLABException("problem opening input file " + input_file_name);
 
-  // resize vals_hist
+  SAMRecord samr, waiting;
+  bool WAITING = false;
   counts_hist.clear();
   counts_hist.resize(2, 0.0);
-
-  std::ifstream in(input_file_name.c_str());
-  if (!in)
-    throw SMITHLABException("problem opening file: " 
+  size_t current_count = 0;
+  const size_t suffix_len = 0;
+  n_paired = 0;
+  n_mates = 0;
+  size_t n_unpaired = 0;
+  size_t n_not_adjacent = 0;
+  const size_t progress_step = 1000000;
+
+  // Mates are paired as they arrive, so only the read before is held.
+  // The fragments come in no order and are counted by sorting them,
+  // in runs on disk if they would use more than max_memory.
+  const size_t fragment_memory =
+    max_memory > 0 ? max_memory : default_fragment_memory;
+  vector<FragmentKey> fragments;
+  unordered_map<string, size_t> chrom_ids;
+  const std::function<void(const GenomicRegion &)> push_fragment =
+    [&](const GenomicRegion &gr) {
+    const FragmentKey key = {
+      chrom_ids.insert(std::make_pair(gr.get_chrom(),
+                                      chrom_ids.size())).first->second,
+      gr.get_start(), gr.get_end()
+    };
+    fragments.push_back(key);
+  };
+  SpillRuns fragment_runs;
+  size_t n_spilled_fragments = 0;
+  size_t fragments_high_water = 0;
+
+  StopWatch decode_watch(stats != NULL), sort_watch(stats != NULL),
+    hist_watch(stats != NULL);
+  size_t n_records = 0;
+
+  while (timed_read(sam_reader, samr, decode_watch)) {
+    ++n_records;
+    if (!(samr.is_primary && samr.is_mapped))
+      continue;
+    ++n_mates;
+
+    if (samr.is_mapping_paired) {
+      if (WAITING && waiting.mr.r.get_name() == samr.mr.r.get_name()) {
+        pair_mates(VERBOSE, suffix_len, MAX_SEGMENT_LENGTH, samr, waiting,
+                   push_fragment, n_paired, n_unpaired);
+        WAITING = false;
+      }
+      else {
+        if (WAITING) {
+          push_fragment(waiting.mr.r);
+          ++n_unpaired;
+          ++n_not_adjacent;
+        }
+        std::swap(waiting, samr);
+        WAITING = true;
+      }
+    }
+    else {
+      push_fragment(samr.mr.r);
+      ++n_unpaired;
+    }
+
+    if (fragments.size()*sizeof(FragmentKey) > fragment_memory) {
+      fragments_high_water = max(fragments_high_water, fragments.size());
+      n_spilled_fragments += fragments.size();
+      sort_watch.start();
+      spill_fragments(fragments, fragment_runs);
+      sort_watch.stop();
+    }
+
+    if (VERBOSE && n_mates % progress_step == 0)
+      cerr << "Processed " << n_mates << " records" << endl;
+  }
+  if (WAITING) {
+    push_fragment(waiting.mr.r);
+    ++n_unpaired;
+    ++n_not_adjacent;
+  }
+  fragments_high_water = max(fragments_high_water, fragments.size());
+
+  FragmentKey prev = {0, 0, 0};
+  if (fragment_runs.empty()) {
+    sort_watch.start();
+    std::sort(fragments.begin(), fragments.end(), fragment_key_less);
+    sort_watch.stop();
+    hist_watch.start();
+    for (size_t i = 0; i < fragments.size(); ++i)
+      count_fragment_key(fragments[i], prev, counts_hist, current_count);
+    hist_watch.stop();
+  }
+  else {
+    n_spilled_fragments += fragments.size();
+    sort_watch.start();
+    spill_fragments(fragments, fragment_runs);
+    sort_watch.stop();
+    hist_watch.start();
+    merge_spill_runs<FragmentKey>(fragment_runs, fragment_key_greater,
+                                  [&](const FragmentKey &key) {
+        count_fragment_key(key, prev, counts_hist, current_count);
+      });
+    fragment_runs.clear();
+    hist_watch.stop();
+  }
+
+  if (counts_hist.size() < current_count + 1)
+    counts_hist.resize(current_count + 1, 0.0);
+  ++counts_hist[current_count];
+
+  if (VERBOSE)
+    cerr << "paired = " << n_paired << endl
+         << "unpaired = " << n_unpaired << endl;
+  if (VERBOSE && n_not_adjacent > 0)
+    cerr << "WARNING: " << n_not_adjacent << " PAIRED READS WITHOUT AN "
+         << "ADJACENT MATE, IS THE INPUT SORTED BY NAME?" << endl;
+  if (VERBOSE && n_spilled_fragments > 0)
+    cerr << "SPILLED " << n_spilled_fragments << " FRAGMENTS TO DISK" << endl;
+
+  if (stats) {
+    report_load_stats(stats, n_records, decode_watch, hist_watch);
+    stats->add_share("load.sort_fragments", sort_watch.seconds);
+    stats->raise_to("fragments_high_water", fragments_high_water);
+    stats->add("mates_not_adjacent", n_not_adjacent);
+    stats->set("max_memory_bytes", fragment_memory);
+    stats->add("spilled_fragments", n_spilled_fragments);
+  }
+
+  return n_unpaired + n_paired;
+}
+
+#endif
+
+
+/* memory mapped text input */
+
+// read-only view of a whole regular file
+class MappedFile {
+public:
+  MappedFile(const int fd, const size_t sz) : data(NULL), size(sz) {
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      madvise(addr, size, MADV_SEQUENTIAL);
+      data = static_cast<const char *>(addr);
+    }
+  }
+  ~MappedFile() {
+    if (data != NULL)
+      munmap(const_cast<char *>(data), size);
+  }
+  bool is_good() const {return data != NULL;}
+
+  const char *data;
+  const size_t size;
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+};
+
+
+// split [0, size) into n_chunks pieces that end just after a newline
+static void
+chunk_at_lines(const char *data, const size_t size, const size_t n_chunks,
+               vector<size_t> &bounds) {
+  bounds.assign(1, 0);
+  for (size_t i = 1; i < n_chunks; ++i) {
+    size_t b = max(bounds.back(), i*size/n_chunks);
+    const void *nl = b < size ? memchr(data + b, '\n', size - b) : NULL;
+    b = nl ? static_cast<const char *>(nl) - data + 1 : size;
+    bounds.push_back(b);
+  }
+  bounds.push_back(size);
+}
+
+
+// run chunk_job(i) for every chunk, one thread per chunk
+template <class T> static void
+run_chunk_jobs(const size_t n_chunks, const T &chunk_job) {
+  vector<std::thread> workers;
+  for (size_t i = 1; i < n_chunks; ++i)
+    workers.push_back(std::thread(chunk_job, i));
+  if (n_chunks > 0)
+    chunk_job(0);
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+}
+
+
+
+/* this code is for BED file input */
+
+// the fields of a BED line that decide whether two reads are duplicates
+struct BEDKey {
+  BEDKey() : chrom(NULL), chrom_len(0), start(0), end(0) {}
+  const char *chrom;
+  size_t chrom_len;
+  size_t start;
+  size_t end;
+};
+
+static inline bool
+same_chrom(const BEDKey &a, const BEDKey &b) {
+  return a.chrom_len == b.chrom_len &&
+    std::equal(a.chrom, a.chrom + a.chrom_len, b.chrom);
+}
+
+// same tests as update_se_duplicate_counts_hist and
+// update_pe_duplicate_counts_hist
+static inline bool
+is_unsorted(const bool PAIRED_END, const BEDKey &curr, const BEDKey &prev) {
+  return same_chrom(curr, prev) && curr.start < prev.start &&
+    (!PAIRED_END || curr.end < prev.end);
+}
+
+static inline bool
+is_duplicate(const bool PAIRED_END, const BEDKey &curr, const BEDKey &prev) {
+  return same_chrom(curr, prev) && curr.start == prev.start &&
+    (!PAIRED_END || curr.end == prev.end);
+}
+
+static inline const char *
+skip_blanks(const char *c, const char *end) {
+  while (c < end && (*c == ' ' || *c == '\t' || *c == '\r'))
+    ++c;
+  return c;
+}
+
+static inline const char *
+skip_field(const char *c, const char *end) {
+  while (c < end && *c != ' ' && *c != '\t' && *c != '\r')
+    ++c;
+  return c;
+}
+
+// positions are read the way atoi reads them
+static inline size_t
+parse_position(const char *c, const char *end) {
+  const bool NEGATIVE = (c < end && *c == '-');
+  if (c < end && (*c == '-' || *c == '+'))
+    ++c;
+  size_t pos = 0;
+  while (c < end && *c >= '0' && *c <= '9')
+    pos = 10*pos + (*c++ - '0');
+  return NEGATIVE ? -pos : pos;
+}
+
+static bool
+parse_bed_key(const char *line, const char *line_end, BEDKey &key) {
+  const char *c = skip_blanks(line, line_end);
+  key.chrom = c;
+  c = skip_field(c, line_end);
+  key.chrom_len = c - key.chrom;
+  c = skip_blanks(c, line_end);
+  const char *start = c;
+  c = skip_blanks(skip_field(c, line_end), line_end);
+  const char *end = c;
+  c = skip_field(c, line_end);
+  if (key.chrom_len == 0 || start == end || end == c)
+    return false;
+  key.start = parse_position(start, line_end);
+  key.end = parse_position(end, line_end);
+  return true;
+}
+
+static inline void
+add_duplicate_count(const size_t count, vector<double> &counts_hist) {
+  if (counts_hist.size() < count + 1)
+    counts_hist.resize(count + 1, 0.0);
+  ++counts_hist[count];
+}
+
+// What one chunk of a sorted BED file contributes.  The runs of
+// duplicates touching either end of the chunk may continue into the
+// neighbouring chunks, so they are kept apart from the histogram of
+// runs that lie entirely inside the chunk.
+struct BEDChunk {
+  BEDChunk() : n_reads(0), first_count(0), last_count(0),
+               ONE_RUN(true), error_line(NULL), UNSORTED(false) {}
+  vector<double> counts_hist;
+  size_t n_reads;
+  BEDKey first, last;
+  size_t first_count;
+  size_t last_count;
+  bool ONE_RUN;
+  const char *error_line;  // malformed or out of order, stops the chunk
+  bool UNSORTED;
+};
+
+static void
+count_bed_chunk(const bool PAIRED_END, const char *pos, const char *end,
+                BEDChunk &chunk) {
+  size_t current_count = 0;
+  BEDKey curr;
+  while (pos < end) {
+    const char *line_end =
+      static_cast<const char *>(memchr(pos, '\n', end - pos));
+    if (line_end == NULL)
+      line_end = end;
+    // reading regions from a stream passes over blank lines too
+    if (skip_blanks(pos, line_end) == line_end) {
+      pos = line_end + 1;
+      continue;
+    }
+    if (!parse_bed_key(pos, line_end, curr)) {
+      chunk.error_line = pos;
+      break;
+    }
+    if (chunk.n_reads == 0) {
+      chunk.first = curr;
+      current_count = 1;
+    }
+    else if (is_unsorted(PAIRED_END, curr, chunk.last)) {
+      chunk.error_line = pos;
+      chunk.UNSORTED = true;
+      break;
+    }
+    else if (is_duplicate(PAIRED_END, curr, chunk.last))
+      ++current_count;
+    else {
+      if (chunk.ONE_RUN)
+        chunk.first_count = current_count;
+      else
+        add_duplicate_count(current_count, chunk.counts_hist);
+      chunk.ONE_RUN = false;
+      current_count = 1;
+    }
+    chunk.last = curr;
+    ++chunk.n_reads;
+    pos = line_end + 1;
+  }
+  if (chunk.ONE_RUN)
+    chunk.first_count = current_count;
+  else
+    chunk.last_count = current_count;
+}
+
+static void
+throw_bed_chunk_error(const bool PAIRED_END, const string &input_file_name,
+                      const BEDChunk &chunk, const char *end) {
+  if (chunk.UNSORTED)
+    throw SMITHLABException(PAIRED_END ?
+                            "reads unsorted in " + input_file_name :
+                            "locations unsorted in: " + input_file_name);
+  const char *line_end = static_cast<const char *>(
+    memchr(chunk.error_line, '\n', end - chunk.error_line));
+  throw SMITHLABException("Invalid string representation: " +
+                          string(chunk.error_line,
+                                 line_end ? line_end : end));
+}
+
+// Parallel counterpart of the loops below for regular files: each
+// thread counts a line-aligned chunk, then the runs at the chunk
+// boundaries are joined in file order.  The histogram, read count and
+// errors are the same as from reading the file line by line.  Returns
+// false, leaving counts_hist alone, if the file cannot be mapped.
+static bool
+load_counts_BED_chunked(const bool PAIRED_END, const string &input_file_name,
+                        const size_t n_threads, vector<double> &counts_hist,
+                        size_t &n_reads) {
+  if (is_standard_input(input_file_name))
+    return false;
+  const int fd = open(input_file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat file_stat;
+  const bool REGULAR_FILE = fstat(fd, &file_stat) == 0 &&
+    S_ISREG(file_stat.st_mode) && file_stat.st_size > 0;
+  std::unique_ptr<MappedFile> mapped(REGULAR_FILE ?
+                                     new MappedFile(fd, file_stat.st_size) :
+                                     NULL);
+  close(fd);
+  if (!mapped.get() || !mapped->is_good())
+    return false;
+
+  const char *data = mapped->data;
+  const char *data_end = data + mapped->size;
+  vector<size_t> bounds;
+  chunk_at_lines(data, mapped->size, n_threads, bounds);
+  const size_t n_chunks = bounds.size() - 1;
+  vector<BEDChunk> chunks(n_chunks);
+  run_chunk_jobs(n_chunks, [&](const size_t i) {
+      count_bed_chunk(PAIRED_END, data + bounds[i], data + bounds[i + 1],
+                      chunks[i]);
+    });
+
+  counts_hist.clear();
+  counts_hist.resize(2, 0.0);
+  n_reads = 0;
+  BEDKey prev;
+  size_t current_count = 0;
+  for (size_t i = 0; i < n_chunks; ++i) {
+    const BEDChunk &chunk = chunks[i];
+    if (chunk.n_reads > 0) {
+      if (n_reads > 0 && is_unsorted(PAIRED_END, chunk.first, prev))
+        throw SMITHLABException(PAIRED_END ?
+                                "reads unsorted in " + input_file_name :
+                                "locations unsorted in: " + input_file_name);
+      if (n_reads > 0 && is_duplicate(PAIRED_END, chunk.first, prev))
+        current_count += chunk.first_count;
+      else {
+        if (current_count > 0)
+          add_duplicate_count(current_count, counts_hist);
+        current_count = chunk.first_count;
+      }
+      if (!chunk.ONE_RUN) {
+        add_duplicate_count(current_count, counts_hist);
+        if (counts_hist.size() < chunk.counts_hist.size())
+          counts_hist.resize(chunk.counts_hist.size(), 0.0);
+        for (size_t j = 0; j < chunk.counts_hist.size(); ++j)
+          counts_hist[j] += chunk.counts_hist[j];
+        current_count = chunk.last_count;
+      }
+      prev = chunk.last;
+      n_reads += chunk.n_reads;
+    }
+    if (chunk.error_line != NULL)
+      throw_bed_chunk_error(PAIRED_END, input_file_name, chunk, data_end);
+  }
+  if (n_reads == 0)
+    throw SMITHLABException("problem opening file: " + input_file_name);
+
+  // to account for the last read compared to the one before it.
+  add_duplicate_count(current_count, counts_hist);
+  return true;
+}
+
+
+size_t
+load_counts_BED_se(const string input_file_name, 
+                   const size_t n_threads,
+                   vector<double> &counts_hist,
+                   HistogramObserver *observer, RunStats *stats) {
+  // partial histograms are only reported by the serial loop
+  size_t n_chunked_reads = 0;
+  if (n_threads > 1 && observer == NULL &&
+      load_counts_BED_chunked(false, input_file_name, n_threads,
+                              counts_hist, n_chunked_reads)) {
+    if (stats)
+      stats->add("records", n_chunked_reads);
+    return n_chunked_reads;
+  }
+
+  // resize vals_hist
+  counts_hist.clear();
+  counts_hist.resize(2, 0.0);
+
+  std::ifstream in_file;
+  std::istream in(open_input_buffer(input_file_name, in_file));
+  if (!in)
+    throw SMITHLABException("problem opening file: " + input_file_name);
+  
+  StopWatch decode_watch(stats != NULL), hist_watch(stats != NULL);
+  GenomicRegion curr_gr, prev_gr;
+  if (!timed_read(in, prev_gr, decode_watch))
+    throw SMITHLABException("problem opening file: " + input_file_name);
+  
+  size_t n_reads = 1;
+  size_t current_count = 1;
+  while (timed_read(in, curr_gr, decode_watch)) {
+    hist_watch.start();
+    update_se_duplicate_counts_hist(curr_gr, prev_gr, input_file_name,
+                                    counts_hist, current_count);
+    hist_watch.stop();
+    ++n_reads;
+    prev_gr.swap(curr_gr);
+
+    if (observer && observer->is_due(n_reads))
+      report_partial_hist(observer, n_reads, counts_hist, current_count);
+  }
+  
+  // to account for the last read compared to the one before it.
+  if(counts_hist.size() < current_count + 1)
+    counts_hist.resize(current_count + 1, 0.0);
+  ++counts_hist[current_count];
+
+  if (stats)
+    report_load_stats(stats, n_reads, decode_watch, hist_watch);
+  return n_reads;
+}
+
+
+size_t
+load_counts_BED_pe(const string input_file_name, 
+                   const size_t n_threads,
+                   vector<double> &counts_hist,
+                   HistogramObserver *observer, RunStats *stats) {
+  // partial histograms are only reported by the serial loop
+  size_t n_chunked_reads = 0;
+  if (n_threads > 1 && observer == NULL &&
+      load_counts_BED_chunked(true, input_file_name, n_threads,
+                              counts_hist, n_chunked_reads)) {
+    if (stats)
+      stats->add("records", n_chunked_reads);
+    return n_chunked_reads;
+  }
+
+
+  // resize vals_hist
+  counts_hist.clear();
+  counts_hist.resize(2, 0.0);
+
+  std::ifstream in_file;
+  std::istream in(open_input_buffer(input_file_name, in_file));
+  if (!in)
+    throw SMITHLABException("problem opening file: " 
                             + input_file_name);
 
+  StopWatch decode_watch(stats != NULL), hist_watch(stats != NULL);
   GenomicRegion curr_gr, prev_gr;
-  if (!(in >> prev_gr))
+  if (!timed_read(in, prev_gr, decode_watch))
     throw SMITHLABException("problem opening file: " 
                             + input_file_name);
 
@@ -553,15 +1679,20 @@ load_counts_BED_pe(const string input_file_name,
   size_t current_count = 1;
 
   //read in file and compare each gr with the one before it
-  while (in >> curr_gr) {
+  while (timed_read(in, curr_gr, decode_watch)) {
+    hist_watch.start();
     const bool UPDATE_SUCCESS =
       update_pe_duplicate_counts_hist(curr_gr, prev_gr,
                                       counts_hist, current_count);
+    hist_watch.stop();
     if (!UPDATE_SUCCESS)
       throw SMITHLABException("reads unsorted in " + input_file_name);
     
     ++n_reads;
     prev_gr.swap(curr_gr);
+
+    if (observer && observer->is_due(n_reads))
+      report_partial_hist(observer, n_reads, counts_hist, current_count);
   }
 
   if (counts_hist.size() < current_count + 1)
@@ -569,42 +1700,184 @@ load_counts_BED_pe(const string input_file_name,
   
   // to account for the last read compared to the one before it.
   ++counts_hist[current_count];
-  
+
+  if (stats)
+    report_load_stats(stats, n_reads, decode_watch, hist_watch);
   return n_reads;
 
 }
 
 /* text file input */
+
+// One count per line, as in the original istream parser: the value is
+// truncated to an integer, zeros and lines that do not start with a
+// number are skipped, and a negative value is an error.  Returns the
+// offset of a line holding a negative value, or NULL.
+static const char *
+parse_counts(const char *pos, const char *end,
+             vector<double> &counts_hist, size_t &n_reads) {
+  while (pos < end) {
+    const char *line_end = static_cast<const char *>(memchr(pos, '\n', end - pos));
+    if (line_end == NULL)
+      line_end = end;
+
+    const char *c = pos;
+    while (c < line_end && (*c == ' ' || *c == '\t'))
+      ++c;
+    const bool NEGATIVE = (c < line_end && *c == '-');
+    if (c < line_end && (*c == '-' || *c == '+'))
+      ++c;
+
+    size_t count = 0;
+    const char *digits = c;
+    while (c < line_end && *c >= '0' && *c <= '9')
+      count = 10*count + (*c++ - '0');
+    // fractions and exponents are rare, leave them to strtod
+    if (c < line_end && (*c == '.' || *c == 'e' || *c == 'E')) {
+      const double val = strtod(string(digits, line_end).c_str(), NULL);
+      count = val > 0 ? static_cast<size_t>(val) : 0;
+    }
+
+    if (count > 0) {
+      if (NEGATIVE)
+        return pos;
+      // histogram is too small, resize
+      if (counts_hist.size() < count + 1)
+        counts_hist.resize(count + 1, 0.0);
+      ++counts_hist[count];
+      n_reads += count;
+    }
+    pos = line_end + 1;
+  }
+  return NULL;
+}
+
+
+static void
+throw_negative_count(const string &input_file_name, const char *begin,
+                     const char *bad_line) {
+  throw SMITHLABException("problem reading file " + input_file_name +
+                          " at line " +
+                          toa(std::count(begin, bad_line, '\n') + 1));
+}
+
+
+// bytes read from fd into buf, 0 at the end of the input
+static size_t
+read_input(const int fd, const string &input_file_name,
+           char *buf, const size_t n) {
+  while (true) {
+    const ssize_t n_read = read(fd, buf, n);
+    if (n_read >= 0)
+      return n_read;
+    if (errno != EINTR)
+      throw SMITHLABException("problem reading file " + input_file_name +
+                              ": " + strerror(errno));
+  }
+}
+
+
+// Regular files are mapped into memory and, with n_threads > 1, parsed
+// in line-aligned chunks into per-thread histograms that are summed at
+// the end.  Pipes and the standard input are parsed from a buffer.
 size_t
-load_counts(const string &input_file_name, vector<double> &counts_hist) {
-  
-  std::ifstream in(input_file_name.c_str());
-  if (!in) // if file doesn't open
+load_counts(const bool VERBOSE, const string &input_file_name,
+            const size_t n_threads, vector<double> &counts_hist,
+            RunStats *stats) {
+
+  const int fd = is_standard_input(input_file_name) ?
+    STDIN_FILENO : open(input_file_name.c_str(), O_RDONLY);
+  if (fd < 0) // if file doesn't open
     throw SMITHLABException("problem opening file: " 
                             + input_file_name);
-  
+
+  const std::chrono::steady_clock::time_point start_time =
+    std::chrono::steady_clock::now();
+
   size_t n_reads = 0;
-  while(!in.eof()){
-    string buffer;
-    getline(in, buffer);
-    
-    std::istringstream iss(buffer);
-    if (iss.good()) {
-      double val;
-      iss >> val;
-      if (val > 0) {
-        const size_t count = static_cast<size_t>(val);
-        // histogram is too small, resize
-        if (counts_hist.size() < count + 1)
-          counts_hist.resize(count + 1, 0.0);
-        ++counts_hist[count];
-        n_reads += count;
+  size_t n_bytes = 0;
+  struct stat file_stat;
+  const bool REGULAR_FILE = fstat(fd, &file_stat) == 0 &&
+    S_ISREG(file_stat.st_mode) && file_stat.st_size > 0;
+  std::unique_ptr<MappedFile> mapped(REGULAR_FILE ?
+                                     new MappedFile(fd, file_stat.st_size) :
+                                     NULL);
+
+  if (mapped.get() && mapped->is_good()) {
+    const char *data = mapped->data;
+    n_bytes = mapped->size;
+
+    vector<size_t> bounds;
+    chunk_at_lines(data, n_bytes, max(n_threads, static_cast<size_t>(1)),
+                   bounds);
+    const size_t n_chunks = bounds.size() - 1;
+    vector<vector<double> > chunk_hists(n_chunks);
+    vector<size_t> chunk_reads(n_chunks, 0);
+    vector<const char *> bad_lines(n_chunks, static_cast<const char *>(NULL));
+
+    run_chunk_jobs(n_chunks, [&](const size_t i) {
+        bad_lines[i] = parse_counts(data + bounds[i], data + bounds[i + 1],
+                                    chunk_hists[i], chunk_reads[i]);
+      });
+
+    for (size_t i = 0; i < n_chunks; ++i) {
+      if (bad_lines[i] != NULL)
+        throw_negative_count(input_file_name, data, bad_lines[i]);
+      if (counts_hist.size() < chunk_hists[i].size())
+        counts_hist.resize(chunk_hists[i].size(), 0.0);
+      for (size_t j = 0; j < chunk_hists[i].size(); ++j)
+        counts_hist[j] += chunk_hists[i][j];
+      n_reads += chunk_reads[i];
+    }
+  }
+  else {
+    // lines may straddle reads, carry the unfinished one over
+    const size_t buffer_size = 1 << 20;
+    vector<char> buffer(buffer_size);
+    size_t n_kept = 0, n_lines_before = 0, n_read = 0;
+    while ((n_read = read_input(fd, input_file_name, &buffer[n_kept],
+                                buffer_size - n_kept)) > 0 || n_kept > 0) {
+      const char *begin = &buffer[0];
+      const size_t filled = n_kept + n_read;
+      const char *last_nl = NULL;
+      for (size_t i = filled; i > 0 && last_nl == NULL; --i)
+        if (buffer[i - 1] == '\n')
+          last_nl = begin + i - 1;
+      // no newline in a full buffer, or the final line at end of file
+      const char *parse_end = (n_read == 0 || last_nl == NULL) ?
+        begin + filled : last_nl + 1;
+      if (last_nl == NULL && n_read > 0 && filled < buffer_size) {
+        n_kept = filled;
+        continue;
+      }
+
+      const char *bad_line =
+        parse_counts(begin, parse_end, counts_hist, n_reads);
+      if (bad_line != NULL) {
+        const size_t line = n_lines_before + std::count(begin, bad_line, '\n');
+        throw SMITHLABException("problem reading file " + input_file_name +
+                                " at line " + toa(line + 1));
       }
-      else if (val != 0)
-        throw SMITHLABException("problem reading file at line " 
-                                + toa(n_reads + 1));
+      n_lines_before += std::count(begin, parse_end, '\n');
+      n_bytes += parse_end - begin;
+
+      n_kept = begin + filled - parse_end;
+      std::copy(parse_end, begin + filled, buffer.begin());
+      if (n_read == 0)
+        break;
     }
-    in.peek();
+  }
+  if (fd != STDIN_FILENO)
+    close(fd);
+
+  if (stats)
+    stats->add("bytes", n_bytes);
+
+  if (VERBOSE) {
+    const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_time).count();
+    cerr << "PARSED " << n_bytes << " BYTES IN " << seconds << " SECONDS ("
+         << n_bytes/(1e6*max(seconds, 1e-9)) << " MB/s)" << endl;
   }
   return n_reads;
 }
@@ -614,12 +1887,21 @@ load_counts(const string &input_file_name, vector<double> &counts_hist) {
 size_t
 load_histogram(const string &filename, vector<double> &counts_hist) {
   
-  counts_hist.clear();
-  
-  std::ifstream in(filename.c_str());
+  std::ifstream in_file;
+  std::istream in(open_input_buffer(filename, in_file));
   if (!in) //if file doesn't open
     throw SMITHLABException("could not open histogram: " + filename);
-  
+
+  return read_histogram(in, filename, counts_hist);
+}
+
+
+size_t
+read_histogram(std::istream &in, const string &filename,
+               vector<double> &counts_hist, const size_t max_count) {
+
+  counts_hist.clear();
+
   size_t n_reads = 0;
   size_t line_count = 0ul, prev_read_count = 0ul;
   string buffer;
@@ -637,6 +1919,10 @@ load_histogram(const string &filename, vector<double> &counts_hist) {
     if (read_count < prev_read_count)
       throw SMITHLABException("bad line order in file " + filename + "\n" +
                               "(line " + toa(line_count) + ")");
+    if (max_count > 0 && read_count > max_count)
+      throw SMITHLABException("count " + toa(read_count) + " is above the "
+                              "largest accepted, " + toa(max_count) + "\n" +
+                              "(line " + toa(line_count) + ")");
     counts_hist.resize(read_count + 1, 0.0);
     counts_hist[read_count] = frequency;
     prev_read_count = read_count;
@@ -652,113 +1938,539 @@ load_histogram(const string &filename, vector<double> &counts_hist) {
 ////////////////////////////////////////////////////////
 
 
-// probabilistically split genomic regions into mutiple
-// genomic regions of width equal to bin_size
+// Hits to consecutive bins of one chromosome.  Reads arrive sorted by
+// start, so a bin ending more than max_width before the current read
+// can no longer be hit and its count goes into coverage_hist.
+class CoverageWindow {
+public:
+  CoverageWindow(const size_t bs, const size_t mw) :
+    bin_size(bs), max_width(mw), first_bin(0) {}
+
+  // bins are indices start/bin_size, in increasing order and not below
+  // read_start/bin_size; returns false if a bin was already flushed,
+  // which means the reads are unsorted
+  bool add(const string &read_chrom, const size_t read_start,
+           const vector<size_t> &bins, vector<double> &coverage_hist);
+  void flush(vector<double> &coverage_hist);
+
+private:
+  const size_t bin_size;
+  const size_t max_width;
+  string chrom;
+  size_t first_bin;
+  std::deque<size_t> counts;
+};
+
+
+void
+CoverageWindow::flush(vector<double> &coverage_hist) {
+  for (size_t i = 0; i < counts.size(); ++i)
+    if (counts[i] > 0)
+      add_duplicate_count(counts[i], coverage_hist);
+  first_bin += counts.size();
+  counts.clear();
+}
+
+
+bool
+CoverageWindow::add(const string &read_chrom, const size_t read_start,
+                    const vector<size_t> &bins,
+                    vector<double> &coverage_hist) {
+  if (read_chrom != chrom) {
+    flush(coverage_hist);
+    chrom = read_chrom;
+    first_bin = read_start/bin_size;
+  }
+
+  // bins ending before read_start - max_width are finished
+  while (!counts.empty() &&
+         (first_bin + 1)*bin_size + max_width < read_start) {
+    if (counts.front() > 0)
+      add_duplicate_count(counts.front(), coverage_hist);
+    counts.pop_front();
+    ++first_bin;
+  }
+  // no read starting here or later can hit a bin before its start
+  if (counts.empty())
+    first_bin = std::max(first_bin, read_start/bin_size);
+
+  for (size_t i = 0; i < bins.size(); ++i) {
+    if (bins[i] < first_bin)
+      return false;
+    const size_t offset = bins[i] - first_bin;
+    if (counts.size() < offset + 1)
+      counts.resize(offset + 1, 0);
+    ++counts[offset];
+  }
+  return true;
+}
+
+
+// probabilistically split genomic regions into mutiple bins of width
+// equal to bin_size, giving the bin indices start/bin_size
 static void
 SplitGenomicRegion(const GenomicRegion &inputGR,
                    Runif &runif, const size_t bin_size,
-                   vector<GenomicRegion> &outputGRs){
+                   vector<size_t> &outputBins){
   
-  outputGRs.clear();
-  GenomicRegion gr(inputGR);
+  outputBins.clear();
 
-  double frac = static_cast<double>(gr.get_start() % bin_size)/bin_size;
-  const size_t width = gr.get_width();
+  double frac = static_cast<double>(inputGR.get_start() % bin_size)/bin_size;
+  const size_t width = inputGR.get_width();
   
-  // ADS: this seems like a bunch of duplicated code just for a single
-  // function difference
-  if (runif.runif(0.0, 1.0) > frac) {
-    gr.set_start(std::floor(static_cast<double>(gr.get_start())/
-                            bin_size)*bin_size);
-    gr.set_end(gr.get_start() + width);
-  }
-  else {
-    gr.set_start(std::ceil(static_cast<double>(gr.get_start())/
-                           bin_size)*bin_size);
-    gr.set_end(gr.get_start() + width);
+  // shift the start down or up to a bin boundary
+  const size_t start = (runif.runif(0.0, 1.0) > frac) ?
+    inputGR.get_start()/bin_size :
+    (inputGR.get_start() + bin_size - 1)/bin_size;
+
+  for(size_t i = 0; i < width; i += bin_size){
+    frac = static_cast<double>(std::min(width - i, bin_size))/bin_size;
+    if(runif.runif(0.0, 1.0) <= frac)
+      outputBins.push_back(start + i/bin_size);
   }
+}
 
-  for(size_t i = 0; i < gr.get_width(); i += bin_size){
 
-    const size_t curr_start = gr.get_start() + i;
-    const size_t curr_end 
-      = std::min(gr.get_end(), curr_start + bin_size);
-    frac = static_cast<double>(curr_end - curr_start)/bin_size;
+// Bit i of the mask is set if base i of seq is not N.  Eight bases are
+// tested at once: a byte of seq XOR "NNNNNNNN" is zero exactly at an N.
+static void
+covered_base_mask(const string &seq, vector<uint64_t> &mask) {
+  const uint64_t all_N = 0x4E4E4E4E4E4E4E4EULL;
+  const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+  mask.assign((seq.size() + 63)/64, 0);
+  size_t i = 0;
+  for (; i + 8 <= seq.size(); i += 8) {
+    uint64_t v = 0;
+    for (size_t j = 0; j < 8; ++j)
+      v |= static_cast<uint64_t>(static_cast<unsigned char>(seq[i + j]))
+        << 8*j;
+    v ^= all_N;
+    // high bit of each byte set where the byte is non-zero
+    const uint64_t non_zero = (((v & low7) + low7) | v) & ~low7;
+    // gather the eight high bits into one byte, base i + j at bit j
+    const uint64_t bits = ((non_zero >> 7)*0x0102040810204080ULL) >> 56;
+    mask[i/64] |= bits << (i % 64);
+  }
+  for (; i < seq.size(); ++i)
+    if (seq[i] != 'N')
+      mask[i/64] |= 1ULL << (i % 64);
+}
 
-    if(runif.runif(0.0, 1.0) <= frac){
-      GenomicRegion binned_gr(gr.get_chrom(), curr_start, 
-                              curr_start + bin_size,
-                              gr.get_name(), gr.get_score(),
-                              gr.get_strand());
 
-      outputGRs.push_back(binned_gr);
-    }
+// number of set bits of the mask in [begin, end)
+static inline size_t
+count_mask_bits(const vector<uint64_t> &mask, size_t begin, const size_t end) {
+  size_t n_bits = 0;
+  while (begin < end) {
+    const size_t offset = begin % 64;
+    const size_t n = min(64 - offset, end - begin);
+    const uint64_t word = mask[begin/64] >> offset;
+    n_bits += __builtin_popcountll(n == 64 ? word : word & ((1ULL << n) - 1));
+    begin += n;
   }
+  return n_bits;
 }
 
 
-// split a mapped read into multiple genomic regions
-// based on the number of bases in each
+// split a mapped read into bins, each kept with probability equal to
+// the fraction of its bases covered by the read sequence.  Covered
+// bases are counted per bin from a bit mask of the non-N bases, and
+// the random draws, one per bin and in bin order, are made together.
 static void
 SplitMappedRead(const bool VERBOSE,
                 const MappedRead &inputMR,
                 Runif &runif,
                 const size_t bin_size,
-                vector<GenomicRegion> &outputGRs){
+                vector<size_t> &outputBins){
   
-  outputGRs.clear();
+  // scratch space kept between reads by each thread
+  static thread_local vector<uint64_t> mask;
+  static thread_local vector<double> draws;
+
+  outputBins.clear();
+  covered_base_mask(inputMR.seq, mask);
+
+  // the last bin is the one the sequence ends inside, or just after
+  const size_t start = inputMR.r.get_start();
+  const size_t end = start + inputMR.seq.size();
+  const size_t first_bin = start/bin_size;
+  draws.resize(end/bin_size - first_bin + 1);
+  for (size_t i = 0; i < draws.size(); ++i)
+    draws[i] = runif.runif(0.0, 1.0);
+
+  for (size_t i = 0; i < draws.size(); ++i) {
+    const size_t bin = first_bin + i;
+    const size_t bin_start = max(start, bin*bin_size);
+    const size_t bin_end = min(end, (bin + 1)*bin_size);
+    const size_t covered_bases =
+      count_mask_bits(mask, bin_start - start, bin_end - start);
+    if (draws[i] <= static_cast<double>(covered_bases)/bin_size)
+      outputBins.push_back(bin);
+  }
+}
 
-  size_t covered_bases = 0;
-  size_t read_iterator = inputMR.r.get_start();
-  size_t seq_iterator = 0;
-  size_t total_covered_bases = 0;
-  
-  while (seq_iterator < inputMR.seq.size()) {
-    if (inputMR.seq[seq_iterator] != 'N')
-      covered_bases++;
-    
-    // if we reach the end of a bin, probabilistically create a binned read
-    // with probability proportional to the number of covered bases
-    if (read_iterator % bin_size == bin_size - 1) {
-      const double frac = static_cast<double>(covered_bases)/bin_size;
-      if (runif.runif(0.0, 1.0) <= frac) {
-        const size_t curr_start = read_iterator - (read_iterator % bin_size);
-        const size_t curr_end = curr_start + bin_size;
-        const GenomicRegion binned_gr(inputMR.r.get_chrom(), curr_start, curr_end,
-                                      inputMR.r.get_name(), inputMR.r.get_score(),
-                                      inputMR.r.get_strand());
-        outputGRs.push_back(binned_gr);
+
+// give each chromosome its own random stream, so the bins kept do not
+// depend on which thread handles the chromosome (FNV-1a of the name)
+static size_t
+chrom_seed(const unsigned long int seed, const string &chrom) {
+  unsigned long long h = 14695981039346656037ULL;
+  for (size_t i = 0; i < chrom.length(); ++i)
+    h = (h ^ static_cast<unsigned char>(chrom[i]))*1099511628211ULL;
+  return static_cast<size_t>(seed + h);
+}
+
+static inline const GenomicRegion &
+read_region(const MappedRead &mr) {return mr.r;}
+static inline const GenomicRegion &
+read_region(const GenomicRegion &gr) {return gr;}
+
+static inline void
+split_into_bins(const MappedRead &mr, Runif &runif, const size_t bin_size,
+                vector<size_t> &bins) {
+  SplitMappedRead(false, mr, runif, bin_size, bins);
+}
+static inline void
+split_into_bins(const GenomicRegion &gr, Runif &runif, const size_t bin_size,
+                vector<size_t> &bins) {
+  SplitGenomicRegion(gr, runif, bin_size, bins);
+}
+
+
+// An aligned read, or a merged pair of mates, with the blocks of
+// reference positions [first, second) where it has a base other than N.
+// Blocks are sorted and do not overlap.
+struct CoveredRead {
+  GenomicRegion r;
+  vector<std::pair<size_t, size_t> > blocks;
+};
+
+// Same bins and random draws as SplitMappedRead gives for a read whose
+// sequence has N outside of the covered blocks, but counted a block at
+// a time rather than a base at a time.
+static void
+SplitCoveredRead(const CoveredRead &inputCR,
+                 Runif &runif,
+                 const size_t bin_size,
+                 vector<size_t> &outputBins) {
+
+  outputBins.clear();
+
+  const size_t start = inputCR.r.get_start();
+  const size_t end = inputCR.r.get_end();
+  const vector<std::pair<size_t, size_t> > &blocks = inputCR.blocks;
+  size_t first_block = 0;
+  for (size_t bin = start/bin_size; ; ++bin) {
+    const size_t bin_start = max(start, bin*bin_size);
+    const size_t bin_end = min(end, (bin + 1)*bin_size);
+    while (first_block < blocks.size() &&
+           blocks[first_block].second <= bin_start)
+      ++first_block;
+    size_t covered_bases = 0;
+    for (size_t i = first_block;
+         i < blocks.size() && blocks[i].first < bin_end; ++i)
+      covered_bases += min(bin_end, blocks[i].second) -
+        max(bin_start, blocks[i].first);
+
+    const double frac = static_cast<double>(covered_bases)/bin_size;
+    if (runif.runif(0.0, 1.0) <= frac)
+      outputBins.push_back(bin);
+    // the last bin is the one the read ends inside, or just after
+    if ((bin + 1)*bin_size > end)
+      break;
+  }
+}
+
+static inline const GenomicRegion &
+read_region(const CoveredRead &cr) {return cr.r;}
+static inline void
+split_into_bins(const CoveredRead &cr, Runif &runif, const size_t bin_size,
+                vector<size_t> &bins) {
+  SplitCoveredRead(cr, runif, bin_size, bins);
+}
+
+
+// Splits reads into bins and counts the bins, one chromosome at a
+// time.  With n_threads > 1 the reading thread hands batches of reads
+// to workers; every read of a chromosome goes to the same worker, in
+// input order, and each chromosome draws from a Runif seeded with
+// chrom_seed, so the histogram does not depend on n_threads.
+template <class T>
+class CoverageCounter {
+public:
+  CoverageCounter(const string &input_file_name,
+                  const unsigned long int seed, const size_t n_threads,
+                  const size_t bin_size, const size_t max_width);
+  ~CoverageCounter() {stop();}
+
+  void add(const T &read);
+  void finish(vector<double> &coverage_hist);
+
+private:
+  struct ChromCoverage {
+    ChromCoverage(const size_t seed, const size_t bin_size,
+                  const size_t max_width) :
+      runif(seed), window(bin_size, max_width) {}
+    Runif runif;
+    CoverageWindow window;
+  };
+
+  struct Worker {
+    Worker() : DONE(false) {}
+    std::map<string, std::unique_ptr<ChromCoverage> > chroms;
+    vector<double> coverage_hist;
+    vector<size_t> bins;
+    std::exception_ptr error;
+
+    std::deque<vector<T> > batches;
+    vector<T> pending;
+    std::mutex mtx;
+    std::condition_variable batches_cv;
+    bool DONE;
+    std::thread thread;
+  };
+
+  void count_read(Worker &worker, const T &read);
+  void run_worker(Worker &worker);
+  void send_pending(Worker &worker);
+  void stop();
+
+  static const size_t batch_size = 4096;
+  static const size_t max_batches = 16;
+
+  const string input_file_name;
+  const unsigned long int seed;
+  const size_t bin_size;
+  const size_t max_width;
+  vector<std::unique_ptr<Worker> > workers;
+  bool THREADED;
+
+  std::map<string, size_t> chrom_worker;
+  string last_chrom;
+  size_t last_worker;
+};
+
+
+template <class T>
+CoverageCounter<T>::CoverageCounter(const string &infile,
+                                    const unsigned long int s,
+                                    const size_t n_threads,
+                                    const size_t bs, const size_t mw) :
+  input_file_name(infile), seed(s), bin_size(bs), max_width(mw),
+  THREADED(n_threads > 1), last_worker(0) {
+  for (size_t i = 0; i < max(n_threads, static_cast<size_t>(1)); ++i)
+    workers.push_back(std::unique_ptr<Worker>(new Worker));
+  if (THREADED)
+    for (size_t i = 0; i < workers.size(); ++i) {
+      Worker &worker = *workers[i];
+      worker.thread = std::thread([this, &worker] {run_worker(worker);});
+    }
+}
+
+
+template <class T> void
+CoverageCounter<T>::count_read(Worker &worker, const T &read) {
+  const GenomicRegion &r = read_region(read);
+  std::unique_ptr<ChromCoverage> &chrom = worker.chroms[r.get_chrom()];
+  if (!chrom)
+    chrom.reset(new ChromCoverage(chrom_seed(seed, r.get_chrom()),
+                                  bin_size, max_width));
+  split_into_bins(read, chrom->runif, bin_size, worker.bins);
+  if (!chrom->window.add(r.get_chrom(), r.get_start(), worker.bins,
+                         worker.coverage_hist))
+    throw SMITHLABException("reads unsorted in: " + input_file_name);
+}
+
+
+template <class T> void
+CoverageCounter<T>::run_worker(Worker &worker) {
+  vector<T> batch;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(worker.mtx);
+      worker.batches_cv.wait(lock, [&worker] {
+          return worker.DONE || !worker.batches.empty();
+        });
+      if (worker.batches.empty())
+        return;
+      batch.swap(worker.batches.front());
+      worker.batches.pop_front();
+    }
+    worker.batches_cv.notify_all();
+    // after an error keep taking batches so the reader is not blocked
+    if (!worker.error)
+      try {
+        for (size_t i = 0; i < batch.size(); ++i)
+          count_read(worker, batch[i]);
+      }
+      catch (...) {
+        worker.error = std::current_exception();
+      }
+  }
+}
+
+
+template <class T> void
+CoverageCounter<T>::send_pending(Worker &worker) {
+  std::unique_lock<std::mutex> lock(worker.mtx);
+  worker.batches_cv.wait(lock, [&worker] {
+      return worker.batches.size() < max_batches;
+    });
+  worker.batches.push_back(vector<T>());
+  worker.batches.back().swap(worker.pending);
+  lock.unlock();
+  worker.batches_cv.notify_all();
+}
+
+
+template <class T> void
+CoverageCounter<T>::add(const T &read) {
+  const string &chrom = read_region(read).get_chrom();
+  if (chrom != last_chrom) {
+    // chromosomes go to the workers in turn as they first appear
+    std::map<string, size_t>::const_iterator w = chrom_worker.find(chrom);
+    if (w == chrom_worker.end())
+      w = chrom_worker.insert(std::make_pair(chrom, chrom_worker.size() %
+                                             workers.size())).first;
+    last_chrom = chrom;
+    last_worker = w->second;
+  }
+  Worker &worker = *workers[last_worker];
+  if (!THREADED)
+    count_read(worker, read);
+  else {
+    worker.pending.push_back(read);
+    if (worker.pending.size() == batch_size)
+      send_pending(worker);
+  }
+}
+
+
+template <class T> void
+CoverageCounter<T>::stop() {
+  for (size_t i = 0; i < workers.size(); ++i)
+    if (workers[i]->thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(workers[i]->mtx);
+        workers[i]->DONE = true;
       }
-      total_covered_bases += covered_bases;
-      covered_bases = 0;
+      workers[i]->batches_cv.notify_all();
+      workers[i]->thread.join();
     }
-    seq_iterator++;
-    read_iterator++;
+}
+
+
+template <class T> void
+CoverageCounter<T>::finish(vector<double> &coverage_hist) {
+  if (THREADED)
+    for (size_t i = 0; i < workers.size(); ++i)
+      if (!workers[i]->pending.empty())
+        send_pending(*workers[i]);
+  stop();
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    Worker &worker = *workers[i];
+    if (worker.error)
+      std::rethrow_exception(worker.error);
+    typename std::map<string, std::unique_ptr<ChromCoverage> >::iterator c;
+    for (c = worker.chroms.begin(); c != worker.chroms.end(); ++c)
+      c->second->window.flush(worker.coverage_hist);
+
+    if (coverage_hist.size() < worker.coverage_hist.size())
+      coverage_hist.resize(worker.coverage_hist.size(), 0.0);
+    for (size_t j = 0; j < worker.coverage_hist.size(); ++j)
+      coverage_hist[j] += worker.coverage_hist[j];
   }
+}
+
+
+// Reads written by bam2mr --binary, decoded straight from the mapped
+// file.  Returns false, leaving coverage_hist alone, if the file cannot
+// be mapped or is not in the binary format.
+static bool
+load_coverage_counts_binary(const string &input_file_name,
+                            const unsigned long int seed,
+                            const size_t n_threads,
+                            const size_t bin_size,
+                            const size_t max_width,
+                            vector<double> &coverage_hist,
+                            size_t &n_reads) {
+  if (is_standard_input(input_file_name))
+    return false;
+  const int fd = open(input_file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat file_stat;
+  const bool REGULAR_FILE = fstat(fd, &file_stat) == 0 &&
+    S_ISREG(file_stat.st_mode) && file_stat.st_size > 0;
+  std::unique_ptr<MappedFile> mapped(REGULAR_FILE ?
+                                     new MappedFile(fd, file_stat.st_size) :
+                                     NULL);
+  close(fd);
+  if (!mapped.get() || !mapped->is_good() ||
+      !has_binary_reads_magic(mapped->data, mapped->size))
+    return false;
 
-  const double frac = static_cast<double>(covered_bases)/bin_size;
-  if (runif.runif(0.0, 1.0) <= frac) {
-    const size_t curr_start = read_iterator - (read_iterator % bin_size);
-    const size_t curr_end = curr_start + bin_size;
-    const GenomicRegion binned_gr(inputMR.r.get_chrom(), curr_start, curr_end,
-                                  inputMR.r.get_name(), inputMR.r.get_score(),
-                                  inputMR.r.get_strand());
-    outputGRs.push_back(binned_gr);
+  BinaryReadDecoder decoder(mapped->data, mapped->size);
+  CoverageCounter<CoveredRead> counter(input_file_name, seed, n_threads,
+                                       bin_size, max_width);
+  BinaryRead br;
+  CoveredRead cr;
+  size_t chrom_id = std::numeric_limits<size_t>::max();
+  n_reads = 0;
+  while (decoder.next(br)) {
+    if (br.end - br.start > max_width)
+      throw SMITHLABException("Encountered read of width " + 
+                              toa(br.end - br.start) +
+                              "max_width set too small");
+    if (br.chrom_id != chrom_id) {
+      chrom_id = br.chrom_id;
+      cr.r.set_chrom(decoder.chrom_name(chrom_id));
+    }
+    // bins run to the end of the sequence, as in SplitMappedRead
+    cr.r.set_start(br.start);
+    cr.r.set_end(br.start + br.seq_length);
+    cr.blocks.clear();
+    size_t covered_start = 0;
+    for (size_t i = 0; i <= br.n_runs.size(); ++i) {
+      const size_t covered_end =
+        (i < br.n_runs.size()) ? br.n_runs[i].first : br.seq_length;
+      if (covered_start < covered_end)
+        cr.blocks.push_back(std::make_pair(br.start + covered_start,
+                                           br.start + covered_end));
+      if (i < br.n_runs.size())
+        covered_start = br.n_runs[i].second;
+    }
+    counter.add(cr);
+    n_reads++;
   }
+  if (n_reads == 0)
+    throw SMITHLABException("problem reading from: " + input_file_name);
+
+  counter.finish(coverage_hist);
+  return true;
 }
 
 
 size_t
 load_coverage_counts_MR(const bool VERBOSE,
                         const string input_file_name,
+                        const unsigned long int seed,
+                        const size_t n_threads,
                         const size_t bin_size,
                         const size_t max_width,
                         vector<double> &coverage_hist) {
 
-  srand(time(0) + getpid());
-  Runif runif(rand());
+  size_t n_binary_reads = 0;
+  if (load_coverage_counts_binary(input_file_name, seed, n_threads, bin_size,
+                                  max_width, coverage_hist, n_binary_reads)) {
+    if (VERBOSE)
+      cerr << "BINARY_MAPPED_READS" << endl;
+    return n_binary_reads;
+  }
 
-  std::ifstream in(input_file_name.c_str());
+  std::ifstream in_file;
+  std::istream in(open_input_buffer(input_file_name, in_file));
   if (!in)
     throw SMITHLABException("problem opening file: " + input_file_name);
   
@@ -766,13 +2478,9 @@ load_coverage_counts_MR(const bool VERBOSE,
   if (!(in >> mr))
     throw SMITHLABException("problem reading from: " + input_file_name);
   
-  // initialize prioirty queue to reorder the split reads
-  ReadPQ PQ;
-
+  CoverageCounter<MappedRead> counter(input_file_name, seed, n_threads,
+                                      bin_size, max_width);
   size_t n_reads = 0;
-  size_t n_bins = 0;
-  GenomicRegion curr_gr, prev_gr;
-  size_t current_count = 1;
   
   do {
     
@@ -781,29 +2489,13 @@ load_coverage_counts_MR(const bool VERBOSE,
                               toa(mr.r.get_width()) +
                               "max_width set too small");
     
-    vector<GenomicRegion> splitGRs;
-    SplitMappedRead(VERBOSE, mr, runif, bin_size, splitGRs);
-
+    counter.add(mr);
     n_reads++;
-    n_bins += splitGRs.size();
-
-    // add split Genomic Regions to the priority queue
-    for (size_t i = 0; i < splitGRs.size(); i++)
-      PQ.push(splitGRs[i]);
-
-    // remove Genomic Regions from the priority queue
-    if (splitGRs.size() > 0)
-      while (!PQ.empty() && is_ready_to_pop(PQ, splitGRs.back(), max_width))
-        empty_pq(curr_gr, prev_gr, current_count, 
-                 coverage_hist, PQ, input_file_name);
-    
   } 
   while (in >> mr);
 
   // done adding reads, now spit the rest out
-  while (!PQ.empty())
-    empty_pq(curr_gr, prev_gr, current_count,
-             coverage_hist, PQ, input_file_name);
+  counter.finish(coverage_hist);
   
   return n_reads;
 }
@@ -811,14 +2503,14 @@ load_coverage_counts_MR(const bool VERBOSE,
 
 size_t
 load_coverage_counts_GR(const string input_file_name,
+                        const unsigned long int seed,
+                        const size_t n_threads,
                         const size_t bin_size,
                         const size_t max_width,
                         vector<double> &coverage_hist) {
 
-  srand(time(0) + getpid());
-  Runif runif(rand());
-
-  std::ifstream in(input_file_name.c_str());
+  std::ifstream in_file;
+  std::istream in(open_input_buffer(input_file_name, in_file));
   if (!in)
     throw "problem opening file: " + input_file_name;
 
@@ -826,37 +2518,178 @@ load_coverage_counts_GR(const string input_file_name,
   if (!(in >> inputGR))
     throw "problem reading from: " + input_file_name;
 
-  // initialize prioirty queue to reorder the split reads
-  ReadPQ PQ;
-
-  // prev and current Genomic Regions to compare
-  GenomicRegion curr_gr, prev_gr;
+  CoverageCounter<GenomicRegion> counter(input_file_name, seed, n_threads,
+                                         bin_size, max_width);
   size_t n_reads = 0;
-  size_t current_count = 1;
 
   do {
-    
-    vector<GenomicRegion> splitGRs;
-    SplitGenomicRegion(inputGR, runif, bin_size, splitGRs);
-    
-    // add split Genomic Regions to the priority queue
-    for(size_t i = 0; i < splitGRs.size(); i++)
-      PQ.push(splitGRs[i]);
-    
-    if (splitGRs.size() > 0) {
-      // remove Genomic Regions from the priority queue
-      while (!PQ.empty() && is_ready_to_pop(PQ, splitGRs.back(), max_width))
-        empty_pq(curr_gr, prev_gr, current_count,
-                 coverage_hist, PQ, input_file_name);
-    }
+    counter.add(inputGR);
     n_reads++;
   } 
   while (in >> inputGR);
   
   // done adding reads, now spit the rest out
-  while (!PQ.empty())
-    empty_pq(curr_gr, prev_gr, current_count,
-             coverage_hist, PQ, input_file_name);
+  counter.finish(coverage_hist);
   
   return n_reads;
 }
+
+
+#ifdef HAVE_SAMTOOLS
+// reference span of a BAM record and the aligned positions holding a
+// base other than N; deletions and skipped regions are not covered
+static void
+bam_to_covered_read(const SAMRecord &samr, const bam1_t *algn_p,
+                    CoveredRead &cr) {
+  cr.r = samr.mr.r;
+  cr.blocks.clear();
+
+  const uint32_t *cigar = bam1_cigar(algn_p);
+  const uint8_t *seq = bam1_seq(algn_p);
+  const bool HAS_SEQUENCE = algn_p->core.l_qseq > 0;
+  size_t ref_pos = algn_p->core.pos;
+  size_t query_pos = 0;
+  for (size_t i = 0; i < algn_p->core.n_cigar; ++i) {
+    const int op = cigar[i] & BAM_CIGAR_MASK;
+    const size_t len = cigar[i] >> BAM_CIGAR_SHIFT;
+    // '=' and 'X' (7 and 8) postdate this samtools but are matches
+    if (op == BAM_CMATCH || op == 7 || op == 8) {
+      for (size_t j = 0; j < len; ++j)
+        if (!HAS_SEQUENCE || bam1_seqi(seq, query_pos + j) != 15) {
+          const size_t pos = ref_pos + j;
+          if (!cr.blocks.empty() && cr.blocks.back().second == pos)
+            ++cr.blocks.back().second;
+          else
+            cr.blocks.push_back(std::make_pair(pos, pos + 1));
+        }
+      ref_pos += len;
+      query_pos += len;
+    }
+    else if (op == BAM_CDEL || op == BAM_CREF_SKIP)
+      ref_pos += len;
+    else if (op == BAM_CINS || op == BAM_CSOFT_CLIP)
+      query_pos += len;
+  }
+  cr.r.set_end(ref_pos);
+}
+
+
+// the fragment spanned by two mates, covered where either mate is
+static void
+merge_covered_mates(const CoveredRead &one, CoveredRead &two) {
+  vector<std::pair<size_t, size_t> > blocks;
+  blocks.reserve(one.blocks.size() + two.blocks.size());
+  std::merge(one.blocks.begin(), one.blocks.end(),
+             two.blocks.begin(), two.blocks.end(),
+             std::back_inserter(blocks));
+  two.blocks.clear();
+  for (size_t i = 0; i < blocks.size(); ++i)
+    if (!two.blocks.empty() && blocks[i].first <= two.blocks.back().second)
+      two.blocks.back().second =
+        max(two.blocks.back().second, blocks[i].second);
+    else
+      two.blocks.push_back(blocks[i]);
+
+  two.r.set_start(min(one.r.get_start(), two.r.get_start()));
+  two.r.set_end(max(one.r.get_end(), two.r.get_end()));
+}
+
+
+// Reads gc_extrap input straight from SAM or BAM.  Properly paired
+// mates on the same chromosome spanning at most max_width are merged
+// into one fragment; other mates are counted as single reads.  Reads
+// wait in a queue, in the order they arrive, until any mate they are
+// waiting for has been seen or can no longer arrive, which keeps the
+// reads passed on sorted by start.
+size_t
+load_coverage_counts_BAM(const bool VERBOSE,
+                         const string input_file_name,
+                         const unsigned long int seed,
+                         const size_t n_threads,
+                         const size_t bin_size,
+                         const size_t max_width,
+                         vector<double> &coverage_hist) {
+
+  SAMStreamReader sam_reader(input_file_name);
+  if (!sam_reader.is_good())
+    throw SMITHLABException("problem opening input file " 
+                            + input_file_name);
+
+  CoverageCounter<CoveredRead> counter(input_file_name, seed, n_threads,
+                                       bin_size, max_width);
+
+  // queued reads, numbered from n_released, and the mates still
+  // waiting for their other end, by read name
+  std::deque<std::pair<CoveredRead, bool> > waiting;
+  size_t n_released = 0;
+  std::tr1::unordered_map<string, size_t> dangling_mates;
+  const std::function<void()> release_ready = [&] {
+    while (!waiting.empty() && waiting.front().second) {
+      counter.add(waiting.front().first);
+      waiting.pop_front();
+      ++n_released;
+    }
+  };
+
+  SAMRecord samr;
+  CoveredRead cr;
+  size_t n_reads = 0, n_merged = 0;
+  while ((sam_reader >> samr, sam_reader.is_good())) {
+    if (!samr.is_primary || !samr.is_mapped)
+      continue;
+    bam_to_covered_read(samr, sam_reader.record(), cr);
+    if (cr.r.get_width() > max_width)
+      throw SMITHLABException("Encountered read of width " + 
+                              toa(cr.r.get_width()) +
+                              "max_width set too small");
+    ++n_reads;
+
+    // mates too far behind this read can no longer be merged
+    while (!waiting.empty() && !waiting.front().second &&
+           (!waiting.front().first.r.same_chrom(cr.r) ||
+            waiting.front().first.r.get_start() + max_width <
+            cr.r.get_start())) {
+      dangling_mates.erase(waiting.front().first.r.get_name());
+      waiting.front().second = true;
+      release_ready();
+    }
+
+    bool READY = true, MERGED = false;
+    if (samr.is_mapping_paired) {
+      std::tr1::unordered_map<string, size_t>::iterator mate =
+        dangling_mates.find(cr.r.get_name());
+      if (mate == dangling_mates.end()) {
+        dangling_mates[cr.r.get_name()] = n_released + waiting.size();
+        READY = false;
+      }
+      else {
+        std::pair<CoveredRead, bool> &first =
+          waiting[mate->second - n_released];
+        dangling_mates.erase(mate);
+        first.second = true;
+        if (first.first.r.same_chrom(cr.r) &&
+            max(first.first.r.get_end(), cr.r.get_end()) <=
+            first.first.r.get_start() + max_width) {
+          merge_covered_mates(cr, first.first);
+          ++n_merged;
+          MERGED = true;
+        }
+      }
+    }
+    if (!MERGED)
+      waiting.push_back(std::make_pair(cr, READY));
+    release_ready();
+  }
+
+  // mates whose other end never came are counted alone
+  for (size_t i = 0; i < waiting.size(); ++i)
+    counter.add(waiting[i].first);
+  counter.finish(coverage_hist);
+
+  if (VERBOSE)
+    cerr << "MERGED MATES:\t" << n_merged << endl
+         << "UNMERGED MATES:\t" << dangling_mates.size() << endl;
+
+  return n_reads - n_merged;
+}
+#endif
@@ -22,10 +22,43 @@
 
 #include <string>
 #include <vector>
+#include <iosfwd>
+
+// true for "-" or "/dev/stdin"; every loader below reads these as a
+// single forward pass over the standard input
+bool
+is_standard_input(const std::string &filename);
+
+// Loaders that read sorted input can hand out snapshots of the partial
+// histogram every report_every reads, so estimates can be made while
+// the input is still streaming in. snapshot() is called on the loading
+// thread and may take the contents of partial_hist.
+class HistogramObserver {
+public:
+  HistogramObserver(const size_t re) : report_every(re) {}
+  virtual ~HistogramObserver() {}
+
+  bool is_due(const size_t n_reads) const {
+    return report_every > 0 && n_reads % report_every == 0;
+  }
+  virtual void snapshot(const size_t n_reads,
+                        std::vector<double> &partial_hist) = 0;
+
+  const size_t report_every;
+};
+
+// Given a RunStats, the loaders of sorted reads count the records they
+// read and time their shares of the loading: decoding records
+// ("load.decode"), pairing mates in the priority queue of paired-end
+// BAM ("load.sort_pq") and counting duplicates ("load.histogram").
+// load_counts counts the bytes it parsed.
+class RunStats;
 
 size_t
 load_coverage_counts_MR(const bool VERBOSE,
                         const std::string input_file_name,
+                        const unsigned long int seed,
+                        const size_t n_threads,
                         const size_t bin_size,
                         const size_t max_width,
                         std::vector<double> &coverage_hist);
@@ -33,6 +66,8 @@ load_coverage_counts_MR(const bool VERBOSE,
 
 size_t
 load_coverage_counts_GR(const std::string input_file_name,
+                        const unsigned long int seed,
+                        const size_t n_threads,
                         const size_t bin_size,
                         const size_t max_width,
                         std::vector<double> &coverage_hist);
@@ -41,30 +76,78 @@ load_coverage_counts_GR(const std::string input_file_name,
 size_t
 load_histogram(const std::string &filename, std::vector<double> &counts_hist);
 
+// the lines of a histogram file from in; name is used in errors and
+// counts above max_count are refused unless it is 0
 size_t
-load_counts(const std::string &input_file_name, std::vector<double> &counts_hist);
+read_histogram(std::istream &in, const std::string &name,
+               std::vector<double> &counts_hist,
+               const size_t max_count = 0);
+
+size_t
+load_counts(const bool VERBOSE, const std::string &input_file_name,
+            const size_t n_threads, std::vector<double> &counts_hist,
+            RunStats *stats = NULL);
 
 size_t
 load_counts_BED_pe(const std::string input_file_name, 
-                   std::vector<double> &counts_hist);
+                   const size_t n_threads,
+                   std::vector<double> &counts_hist,
+                   HistogramObserver *observer = NULL,
+                   RunStats *stats = NULL);
 
 size_t
 load_counts_BED_se(const std::string input_file_name, 
-                   std::vector<double> &counts_hist);
+                   const size_t n_threads,
+                   std::vector<double> &counts_hist,
+                   HistogramObserver *observer = NULL,
+                   RunStats *stats = NULL);
 
 #ifdef HAVE_SAMTOOLS
+// With max_memory > 0 (bytes), the mates waiting for their other end
+// and the fragments waiting to be counted in order are written to
+// sorted runs in temporary files when they would use more than that,
+// and merged once the input has been read; 0 keeps them all in memory.
 size_t
 load_counts_BAM_pe(const bool VERBOSE,
                    const std::string &input_file_name,
                    const size_t MAX_SEGMENT_LENGTH,
                    const size_t MAX_READS_TO_HOLD,
+                   const size_t max_memory,
                    size_t &n_paired,
                    size_t &n_mates,
-                   std::vector<double> &counts_hist);
+                   std::vector<double> &counts_hist,
+                   HistogramObserver *observer = NULL,
+                   RunStats *stats = NULL);
  
+// For input with the mates of a pair next to each other, as sorted by
+// name or collated: mates are paired without holding reads for their
+// other end, and the fragments are counted once the input has been
+// read, by sorting them, in runs on disk beyond max_memory bytes (1 GB
+// if max_memory is 0).
+size_t
+load_counts_BAM_pe_name_sorted(const bool VERBOSE,
+                               const std::string &input_file_name,
+                               const size_t MAX_SEGMENT_LENGTH,
+                               const size_t max_memory,
+                               size_t &n_paired,
+                               size_t &n_mates,
+                               std::vector<double> &counts_hist,
+                               RunStats *stats = NULL);
+
 size_t
 load_counts_BAM_se(const std::string &input_file_name, 
-                   std::vector<double> &counts_hist);
+                   std::vector<double> &counts_hist,
+                   HistogramObserver *observer = NULL,
+                   RunStats *stats = NULL);
+
+size_t
+load_coverage_counts_BAM(const bool VERBOSE,
+                         const std::string input_file_name,
+                         const unsigned long int seed,
+                         const size_t n_threads,
+                         const size_t bin_size,
+                         const size_t max_width,
+                         std::vector<double> &coverage_hist);
 #endif // HAVE_SAMTOOLS
 
 
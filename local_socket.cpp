@@ -0,0 +1,170 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "local_socket.hpp"
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "smithlab_utils.hpp"
+
+using std::string;
+
+
+static string
+system_error(const string &what) {
+  return what + ": " + strerror(errno);
+}
+
+
+static void
+make_address(const string &path, sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    throw SMITHLABException("bad socket path: " + path);
+  strcpy(addr.sun_path, path.c_str());
+}
+
+
+int
+connect_local_socket(const string &path) {
+  sockaddr_un addr;
+  make_address(path, addr);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    throw SMITHLABException(system_error("could not make socket"));
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    const string message = system_error("could not connect to " + path);
+    close(fd);
+    throw SMITHLABException(message);
+  }
+  return fd;
+}
+
+
+int
+listen_local_socket(const string &path) {
+  sockaddr_un addr;
+  make_address(path, addr);
+
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode))
+      throw SMITHLABException("not a socket: " + path);
+    bool IN_USE = false;
+    try {
+      close(connect_local_socket(path));
+      IN_USE = true;
+    }
+    catch (SMITHLABException &e) {}
+    if (IN_USE)
+      throw SMITHLABException("socket already being served: " + path);
+    unlink(path.c_str());
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    throw SMITHLABException(system_error("could not make socket"));
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    const string message = system_error("could not listen on " + path);
+    close(fd);
+    throw SMITHLABException(message);
+  }
+  return fd;
+}
+
+
+int
+accept_local_connection(const int listen_fd, const int timeout_ms) {
+  pollfd waiting;
+  waiting.fd = listen_fd;
+  waiting.events = POLLIN;
+  waiting.revents = 0;
+  const int ready = poll(&waiting, 1, timeout_ms);
+  if (ready < 0 && errno != EINTR)
+    throw SMITHLABException(system_error("could not wait for clients"));
+  if (ready <= 0)
+    return -1;
+
+  const int fd = accept(listen_fd, NULL, NULL);
+  // the client may have given up between the poll and the accept
+  if (fd < 0 && errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
+    throw SMITHLABException(system_error("could not accept client"));
+  return fd;
+}
+
+
+void
+set_receive_timeout(const int fd, const int seconds) {
+  timeval timeout;
+  timeout.tv_sec = seconds;
+  timeout.tv_usec = 0;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0)
+    throw SMITHLABException(system_error("could not set socket timeout"));
+}
+
+
+void
+read_until_eof(const int fd, string &data, const size_t max_bytes) {
+  data.clear();
+  char buf[1 << 16];
+  while (true) {
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw SMITHLABException(system_error("failed to read from socket"));
+    if (n == 0)
+      return;
+    if (max_bytes > 0 && data.size() + n > max_bytes)
+      throw SMITHLABException("more than " + toa(max_bytes) +
+                              " bytes received");
+    data.append(buf, n);
+  }
+}
+
+
+void
+write_all(const int fd, const char *data, const size_t n) {
+  size_t written = 0;
+  while (written < n) {
+    const ssize_t w = write(fd, data + written, n - written);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      throw SMITHLABException(system_error("failed to write to socket"));
+    written += w;
+  }
+}
+
+
+void
+shutdown_writing(const int fd) {
+  if (shutdown(fd, SHUT_WR) != 0)
+    throw SMITHLABException(system_error("failed to shut down socket"));
+}
@@ -0,0 +1,57 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOCAL_SOCKET_HPP
+#define LOCAL_SOCKET_HPP
+
+#include <string>
+
+// Unix domain stream sockets for preseq serve and its clients. Every
+// function throws SMITHLABException on failure.
+
+// a socket listening at path; a stale socket file left by a server
+// that is gone is replaced, but not one that is still being served
+int
+listen_local_socket(const std::string &path);
+
+int
+connect_local_socket(const std::string &path);
+
+// the next connection, or -1 if no client came within timeout_ms or
+// a signal arrived
+int
+accept_local_connection(const int listen_fd, const int timeout_ms);
+
+// fails reads that wait more than seconds for the peer
+void
+set_receive_timeout(const int fd, const int seconds);
+
+// everything fd gives until the peer shuts down its side, failing
+// once it passes max_bytes unless that is 0
+void
+read_until_eof(const int fd, std::string &data, const size_t max_bytes = 0);
+
+void
+write_all(const int fd, const char *data, const size_t n);
+
+// tells the peer that nothing more will be written
+void
+shutdown_writing(const int fd);
+
+#endif
@@ -20,9 +20,7 @@
 
 #include <gsl/gsl_sf_gamma.h>
 #include <gsl/gsl_vector.h>
-#include <gsl/gsl_matrix.h>
 #include <gsl/gsl_multiroots.h>
-#include <gsl/gsl_linalg.h>
 #include <gsl/gsl_poly.h>
 #include <gsl/gsl_randist.h>
 
@@ -34,6 +32,10 @@
 #include <iomanip>
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <algorithm>
 
 using std::string;
 using std::vector;
@@ -45,12 +47,86 @@ using std::setprecision;
 
 /////////////////////////////////////////////////////
 // test Hankel moment matrix
+
+// LDL^T factorization of the Hankel matrix [moments[i + j + shift]],
+// grown by one row and column at a time.  Adding row k costs O(k^2)
+// and the determinant is kept as the sum of the log pivots, which does
+// not underflow the way the determinant of a large Hankel matrix does.
+class HankelLDL {
+public:
+  HankelLDL(const vector<double> &m, const size_t s, const size_t max_dim) :
+    dim(0), log_det(0.0), moments(m), shift(s) {
+    L.reserve(max_dim*(max_dim + 1)/2);
+    d.reserve(max_dim);
+    scaled.reserve(max_dim);
+  }
+  // factor the next leading submatrix, returns false unless its last
+  // pivot is positive by more than rounding error
+  bool extend();
+
+  size_t dim;
+  double log_det;
+
+private:
+  const vector<double> &moments;
+  const size_t shift;
+  vector<double> L;  // unit lower triangle, packed by rows
+  vector<double> d;  // pivots
+  vector<double> scaled;
+};
+
+
+bool
+HankelLDL::extend() {
+  const size_t k = dim;
+  const size_t row = k*(k + 1)/2;
+  L.resize(row + k + 1);
+  scaled.resize(k);
+  double pivot = moments[2*k + shift];
+  for (size_t j = 0; j < k; ++j) {
+    const size_t row_j = j*(j + 1)/2;
+    double x = moments[k + j + shift];
+    for (size_t p = 0; p < j; ++p)
+      x -= scaled[p]*L[row_j + p];
+    L[row + j] = x/d[j];
+    scaled[j] = x;
+    pivot -= x*L[row + j];
+  }
+  L[row + k] = 1.0;
+  d.push_back(pivot);
+  log_det += log(fabs(pivot));
+  ++dim;
+  const double diagonal = moments[2*k + shift];
+  return pivot > dim*std::numeric_limits<double>::epsilon()*fabs(diagonal);
+}
+
+
+double
+scale_log_moments(const vector<double> &log_moments,
+                  vector<double> &moments) {
+  // moments after the first infinite one are dropped by
+  // check_moment_sequence, so they do not set the scale
+  size_t last = 0;
+  while (last + 1 < log_moments.size() &&
+         std::isfinite(log_moments[last + 1]))
+    ++last;
+  const double log_scale = (last > 0 && std::isfinite(log_moments[0])) ?
+    (log_moments[last] - log_moments[0])/last : 0.0;
+
+  moments.resize(log_moments.size());
+  for (size_t k = 0; k < log_moments.size(); ++k)
+    moments[k] = exp(log_moments[k] - k*log_scale);
+  return log_scale;
+}
+
+
 // ensure moment sequence is positive definite
 // truncate moment sequence to ensure pos def
 size_t
 ensure_pos_def_mom_seq(vector <double> &moments,
 		       const double tolerance,
-		       const bool VERBOSE){
+		       const bool VERBOSE,
+		       const double log_scale){
 
   const size_t min_hankel_dim = 1;
   size_t hankel_dim = 2;
@@ -60,48 +136,41 @@ ensure_pos_def_mom_seq(vector <double> &moments,
     return min_hankel_dim;
   }
 
-  bool ACCEPT_HANKEL = true;
-  while(ACCEPT_HANKEL && 
-	(2*hankel_dim - 1 < moments.size())){
-    gsl_matrix *hankel_matrix = gsl_matrix_alloc(hankel_dim, 
-						 hankel_dim);
-    for(size_t col_indx = 0; col_indx < hankel_dim; col_indx++){
-      for(size_t row_indx = 0; row_indx < hankel_dim; row_indx++){
-	gsl_matrix_set(hankel_matrix, col_indx, row_indx, 
-		       moments[col_indx + row_indx]);
-      }
-    }
-    int s;
-    gsl_permutation *perm = gsl_permutation_alloc(hankel_dim);
-    gsl_linalg_LU_decomp(hankel_matrix, perm, &s);
-    double hankel_matrix_det = gsl_linalg_LU_det(hankel_matrix, s);
-
-    gsl_matrix *shifted_hankel_matrix = gsl_matrix_alloc(hankel_dim, 
-						 hankel_dim);
-    for(size_t col_indx = 0; col_indx < hankel_dim; col_indx++){
-      for(size_t row_indx = 0; row_indx < hankel_dim; row_indx++){
-	gsl_matrix_set(shifted_hankel_matrix, col_indx, row_indx, 
-		       moments[col_indx + row_indx + 1]);
-      }
-    }
-    gsl_permutation *s_perm = gsl_permutation_alloc(hankel_dim);
-    gsl_linalg_LU_decomp(shifted_hankel_matrix, s_perm, &s);
-    double shifted_hankel_matrix_det = gsl_linalg_LU_det(shifted_hankel_matrix, s);
+  // the Hankel matrix and the shifted Hankel matrix, both factored
+  // up to dimension hankel_dim - 1, which has been accepted
+  const size_t max_dim = (moments.size() + 1)/2;
+  HankelLDL hankel(moments, 0, max_dim);
+  HankelLDL shifted_hankel(moments, 1, max_dim);
+  bool POS_PIVOTS = hankel.extend() && shifted_hankel.extend();
+
+  const double log_tolerance = (tolerance > 0.0) ?
+    log(tolerance) : -std::numeric_limits<double>::infinity();
+
+  while(2*hankel_dim - 1 < moments.size()){
+    POS_PIVOTS = POS_PIVOTS && hankel.extend() && shifted_hankel.extend();
+
+    // scaling moment j by exp(-j*log_scale) scales the determinants of
+    // the k x k Hankel and shifted Hankel matrices by exp(-k(k-1)
+    // log_scale) and exp(-k^2 log_scale)
+    const double k = hankel_dim;
+    const double hankel_log_det = hankel.log_det + k*(k - 1)*log_scale;
+    const double shifted_log_det = shifted_hankel.log_det + k*k*log_scale;
 
     if(VERBOSE){
-      cerr << "dim" << '\t' << "hankel_det" << '\t' << "shifted_hankel_det" << endl;
-      cerr << hankel_dim << '\t' << hankel_matrix_det   
-	   << '\t' << shifted_hankel_matrix_det << endl;
+      cerr << "dim" << '\t' << "hankel_log_det" << '\t'
+           << "shifted_hankel_log_det" << endl;
+      cerr << hankel_dim << '\t' << hankel_log_det
+	   << '\t' << shifted_log_det << endl;
     }
-  
 
-    if(hankel_matrix_det > tolerance &&
-       shifted_hankel_matrix_det > tolerance){
-      ACCEPT_HANKEL = true;
+    // with every pivot positive the matrices are positive definite
+    // and the determinants are the exponentials of the log dets
+    if(POS_PIVOTS &&
+       hankel_log_det > log_tolerance &&
+       shifted_log_det > log_tolerance){
       hankel_dim++;
     }
     else{
-      ACCEPT_HANKEL = false;
       hankel_dim--;
       moments.resize(2*hankel_dim);
       return hankel_dim;
@@ -153,34 +222,55 @@ check_moment_sequence(vector<double> &obs_moms){
 }
 
 
-void
-MomentSequence::unmodified_Chebyshev(const bool VERBOSE){
+// Recurrence coefficients of the orthogonal polynomials for the first
+// 2*n_points moments, by the unmodified Chebyshev algorithm (Gautschi
+// 2004, sec 2.1.7).  Row k of the mixed moments sigma[k][l] needs only
+// rows k-1 and k-2, so three rows are kept and rotated; their storage
+// is reused between calls by each thread.
+static void
+three_term_recurrence(const vector<double> &moments,
+                      vector<double> &a, vector<double> &b) {
+
+  const size_t n_points = moments.size()/2;
+  if (n_points == 0) {
+    a.clear();
+    b.clear();
+    return;
+  }
+  a.assign(n_points, 0.0);
+  b.assign(n_points - 1, 0.0);
 
-  const size_t n_points = static_cast<size_t>(floor(moments.size()/2));
-  vector<double> a(n_points, 0.0);
-  vector<double> b(n_points - 1, 0.0);
+  const size_t row_size = 2*n_points;
+  static thread_local vector<double> sigma_rows;
+  sigma_rows.assign(3*row_size, 0.0);
+  // sigma[-1][l] = 0
+  double *two_back = &sigma_rows[0];
+  double *one_back = &sigma_rows[row_size];
+  double *current = &sigma_rows[2*row_size];
 
-  vector< vector<double> > sigma(2*n_points, vector<double>(2*n_points, 0.0));
   // initialization
   a[0] = moments[1]/moments[0];
-  // sigma[-1][l] = 0
-  for(size_t l = 0; l < 2*n_points; l++)
-    sigma[0][l] = moments[l];
+  std::copy(moments.begin(), moments.begin() + row_size, one_back);
 
   for(size_t k = 1; k <= n_points; k++){
     for(size_t l = k; l < 2*n_points - k; l++){
-      sigma[k][l] = sigma[k-1][l+1] - a[k-1]*sigma[k-1][l];
+      current[l] = one_back[l+1] - a[k-1]*one_back[l];
       if(k > 1)
-	sigma[k][l] -= b[k-2]*sigma[k-2][l];
+	current[l] -= b[k-2]*two_back[l];
     }
     if(k != n_points){
-      a[k] = sigma[k][k+1]/sigma[k][k] - sigma[k-1][k]/sigma[k-1][k-1];
-      b[k-1] = sigma[k][k]/sigma[k-1][k-1];
+      a[k] = current[k+1]/current[k] - one_back[k]/one_back[k-1];
+      b[k-1] = current[k]/one_back[k-1];
     }
-  }  
+    std::swap(two_back, one_back);
+    std::swap(one_back, current);
+  }
+}
+
 
-  alpha = a;
-  beta = b;
+void
+MomentSequence::unmodified_Chebyshev(const bool VERBOSE){
+  three_term_recurrence(moments, alpha, beta);
 }
 
 // un-normalized 3 term recurrence
@@ -188,32 +278,7 @@ void
 MomentSequence::full_3term_recurrence(const bool VERBOSE,
 				      vector<double> &full_alpha,
 				      vector<double> &full_beta){
-
-  const size_t n_points = static_cast<size_t>(floor(moments.size()/2));
-  vector<double> a(n_points, 0.0);
-  vector<double> b(n_points - 1, 0.0);
-
-  vector< vector<double> > sigma(2*n_points, vector<double>(2*n_points, 0.0));
-  // initialization
-  a[0] = moments[1]/moments[0];
-  // sigma[-1][l] = 0
-  for(size_t l = 0; l < 2*n_points; l++)
-    sigma[0][l] = moments[l];
-
-  for(size_t k = 1; k <= n_points; k++){
-    for(size_t l = k; l < 2*n_points - k; l++){
-      sigma[k][l] = sigma[k-1][l+1] - a[k-1]*sigma[k-1][l];
-      if(k > 1)
-	sigma[k][l] -= b[k-2]*sigma[k-2][l];
-    }
-    if(k != n_points){
-      a[k] = sigma[k][k+1]/sigma[k][k] - sigma[k-1][k]/sigma[k-1][k-1];
-      b[k-1] = sigma[k][k]/sigma[k-1][k-1];
-    }
-  }  
-
-  full_alpha.swap(a);
-  full_beta.swap(b);
+  three_term_recurrence(moments, full_alpha, full_beta);
 }
 
 
@@ -221,92 +286,102 @@ MomentSequence::full_3term_recurrence(const bool VERBOSE,
 // Constructor
 
 MomentSequence::MomentSequence(const vector<double> &obs_moms) :
-  moments(obs_moms) {
-  vector<double> holding_moms(moments);
+  moments(obs_moms), log_scale(0.0) {
   // make sure the moments are all positive
-  check_moment_sequence(holding_moms);
-  moments = holding_moms;
+  check_moment_sequence(moments);
 
   // calculate 3-term recurrence
   unmodified_Chebyshev(false);
 }
 
+MomentSequence::MomentSequence(vector<double> &&obs_moms) :
+  moments(std::move(obs_moms)), log_scale(0.0) {
+  check_moment_sequence(moments);
+  unmodified_Chebyshev(false);
+}
 
-/////////////////////////////////////////////////////
-// Quadrature Methods
-
-// one iteration of QR: 
-// following eq's 3.3 of Golub & Welsh
-// one iteration is Z_N-1*Z_N-2*...*Z_1*X*Z_1*...*Z_N-1
-// Z_j is givens matrix to zero out the j+1,j'th element of X
-static void
-QRiteration(vector<double> &alpha,
-	    vector<double> &beta,
-	    vector<double> &weights){
-  // initialize variables
-  vector<double> sin_theta(alpha.size(), 0.0);
-  vector<double> cos_theta(alpha.size(), 0.0);
-
-  vector<double> a(alpha.size(), 0.0);
-  vector<double> a_bar(alpha.size(), 0.0);
-  a_bar[0] = alpha[0];
-
-  vector<double> b(beta);
-  vector<double> b_bar(alpha.size(), 0.0);
-  b_bar[0] = alpha[0];
-  vector<double> b_tilde(alpha.size(), 0.0);
-  b_tilde[0] = beta[0];
-
-  vector<double> d(alpha.size(), 0.0);
-  d[0] = beta[0];
-
-  vector<double> z(weights);
-  vector<double> z_bar(weights.size(), 0.0);
-  z_bar[0] = z[0];
-
-
-  for(size_t j = 0; j < alpha.size() - 1; j++){
-    // for d and b_bar, j here is j-1 in G&W 
-    if(d[j] == 0.0 && b_bar[j] == 0.0){
-      sin_theta[j] = 0.0;
-      cos_theta[j] = 1.0;
-    }
-    else {
-      sin_theta[j] = d[j]/sqrt(d[j]*d[j] + b_bar[j]*b_bar[j]);
-      cos_theta[j] = b_bar[j]/sqrt(d[j]*d[j] + b_bar[j]*b_bar[j]);
-    }
-
-    a[j] = a_bar[j]*cos_theta[j]*cos_theta[j]
-      + 2*b_tilde[j]*cos_theta[j]*sin_theta[j] 
-      + alpha[j+1]*sin_theta[j]*sin_theta[j];
-
-    a_bar[j+1] = a_bar[j]*sin_theta[j]*sin_theta[j]
-      - 2*b_tilde[j]*cos_theta[j]*sin_theta[j] 
-      + alpha[j+1]*cos_theta[j]*cos_theta[j];
-
-    if(j != 0)
-      b[j-1] = sqrt(d[j]*d[j] + b_bar[j]*b_bar[j]);
-
-    b_bar[j+1] = (a_bar[j] - alpha[j+1])*sin_theta[j]*cos_theta[j]
-      + b_tilde[j]*(sin_theta[j]*sin_theta[j] - cos_theta[j]*cos_theta[j]);
+MomentSequence::MomentSequence(vector<double> &&scaled_moms,
+                               const double ls) :
+  moments(std::move(scaled_moms)), log_scale(ls) {
+  check_moment_sequence(moments);
+  unmodified_Chebyshev(false);
+}
 
-    b_tilde[j+1] = -beta[j+1]*cos_theta[j];
-    
-    d[j+1] = beta[j+1]*sin_theta[j];
 
-    z[j] = z_bar[j]*cos_theta[j] + weights[j+1]*sin_theta[j];
+/////////////////////////////////////////////////////
+// Quadrature Methods
 
-    z_bar[j+1] = z_bar[j]*sin_theta[j] - weights[j+1]*cos_theta[j];
+// Eigenvalues of the symmetric tridiagonal matrix with diagonal d and
+// off-diagonal e (e[i] joins rows i and i+1, e.back() is ignored) by
+// implicit QL iterations with Wilkinson shifts, deflating as soon as an
+// off-diagonal element is negligible.  Only the first components of
+// the eigenvectors are carried along, which is all Golub & Welsch need
+// for the quadrature weights, so each sweep is O(n).  On return d holds
+// the eigenvalues and z, which must start as (1, 0, ..., 0), the first
+// eigenvector components.  Returns false if an eigenvalue needs more
+// than max_iter sweeps.
+static bool
+tridiagonal_QL(const double tol, const size_t max_iter,
+               vector<double> &d, vector<double> &e, vector<double> &z) {
+  const size_t n = d.size();
+  if (n == 0)
+    return true;
+  e.back() = 0.0;
+
+  for (size_t l = 0; l < n; ++l) {
+    size_t iter = 0;
+    size_t m = l;
+    do {
+      // find the first negligible off-diagonal element at or after l
+      for (m = l; m + 1 < n; ++m) {
+        const double dd = fabs(d[m]) + fabs(d[m + 1]);
+        if (fabs(e[m]) <= max(tol, std::numeric_limits<double>::epsilon()*dd))
+          break;
+      }
+      if (m != l) {
+        if (iter++ == max_iter)
+          return false;
+
+        // Wilkinson shift from the leading 2x2 block
+        double g = (d[l + 1] - d[l])/(2.0*e[l]);
+        double r = hypot(g, 1.0);
+        g = d[m] - d[l] + e[l]/(g + (g >= 0.0 ? fabs(r) : -fabs(r)));
+        double s = 1.0, c = 1.0, p = 0.0;
+        bool UNDERFLOW = false;
+        // chase the bulge from m - 1 up to l with Givens rotations
+        for (size_t i = m; i-- > l; ) {
+          const double f = s*e[i];
+          const double b = c*e[i];
+          r = hypot(f, g);
+          e[i + 1] = r;
+          if (r == 0.0) {
+            // recover from underflow
+            d[i + 1] -= p;
+            e[m] = 0.0;
+            UNDERFLOW = true;
+            break;
+          }
+          s = f/r;
+          c = g/r;
+          g = d[i + 1] - p;
+          r = (d[i] - g)*s + 2.0*c*b;
+          p = s*r;
+          d[i + 1] = g + p;
+          g = c*r - b;
+
+          const double z_next = z[i + 1];
+          z[i + 1] = s*z[i] + c*z_next;
+          z[i] = c*z[i] - s*z_next;
+        }
+        if (!UNDERFLOW) {
+          d[l] -= p;
+          e[l] = g;
+          e[m] = 0.0;
+        }
+      }
+    } while (m != l);
   }
-
-// last entries set equal to final "holding" values
-  a.back() = a_bar.back();
-  b.back() = b_bar.back();
-  z.back() = z_bar.back();
-
-  alpha.swap(a);
-  beta.swap(b);
-  weights.swap(z);
+  return true;
 }
 
 static bool
@@ -359,27 +434,23 @@ MomentSequence::Lower_quadrature_rules(const bool VERBOSE,
   }
   */
 
+  // Golub & Welsch: the points are the eigenvalues of the Jacobi
+  // matrix, the weights the squared first components of its
+  // normalized eigenvectors
   vector<double> eigenvec(a.size(), 0.0);
-  eigenvec[0] = 1.0;
+  if (!eigenvec.empty())
+    eigenvec[0] = 1.0;
   vector<double> eigenvals(a);
-  vector<double> qr_beta(b);
-  // in QR, off-diagonals go to zero
-  // use off diags for convergence
-  double error = 0.0;
-  for(size_t i = 0; i < qr_beta.size(); i++)
-    error += fabs(qr_beta[i]);
-  size_t iter = 0;
-  while(iter < max_iter && error > tol){
-    QRiteration(eigenvals, qr_beta, eigenvec);
-
-    error = 0.0;
-    for(size_t i = 0; i < qr_beta.size(); i++)
-      error += fabs(qr_beta[i]);
-    iter++;
-
-  }
-  // eigenvalues are on diagonal of J
-  bool POSITIVE_POINTS = check_positivity(eigenvals);
+  vector<double> off_diag(b);
+  off_diag.resize(a.size(), 0.0);
+  const bool CONVERGED = tridiagonal_QL(tol, max_iter, eigenvals,
+                                        off_diag, eigenvec);
+
+  // eigenvalues are on diagonal of J, undo the scaling of the moments
+  const double scale = exp(log_scale);
+  for(size_t i = 0; i < eigenvals.size(); i++)
+    eigenvals[i] *= scale;
+  bool POSITIVE_POINTS = CONVERGED && check_positivity(eigenvals);
 
   /*
   if(VERBOSE){
@@ -22,22 +22,36 @@
 
 #include <vector>
 #include <numeric>
+#include <utility>
+
+// moments exp(log_moments[k] - k*log_scale), those of the measure with
+// its support divided by exp(log_scale), which is chosen to make the
+// first and last of the leading finite moments equal; returns log_scale
+double scale_log_moments(const std::vector<double> &log_moments,
+			 std::vector<double> &moments);
 
 // test Hankel moment matrix to ensure the moment sequence
-// is positive definite
+// is positive definite; scaled moments are tested as if unscaled
 size_t ensure_pos_def_mom_seq(std::vector<double> &moments,
 			      const double tolerance,
-			      const bool VERBOSE);
+			      const bool VERBOSE,
+			      const double log_scale = 0.0);
 
 struct MomentSequence {
 
   // Constructors
-  MomentSequence() {}
+  MomentSequence() : log_scale(0.0) {}
   MomentSequence(const std::vector<double> &obs_moms);
+  MomentSequence(std::vector<double> &&obs_moms);
+  // moments from scale_log_moments
+  MomentSequence(std::vector<double> &&scaled_moms, const double log_scale);
 
   MomentSequence(const std::vector<double> &a,
 		 const std::vector<double> &b):
-    alpha(a), beta(b) {};
+    alpha(a), beta(b), log_scale(0.0) {};
+  MomentSequence(std::vector<double> &&a,
+		 std::vector<double> &&b):
+    alpha(std::move(a)), beta(std::move(b)), log_scale(0.0) {};
 
 
 
@@ -62,6 +76,9 @@ struct MomentSequence {
   // 3-term recurrence
   std::vector<double> alpha;
   std::vector<double> beta;
+  // the moments, and so alpha and beta, are those of the measure with
+  // support divided by exp(log_scale); quadrature points are unscaled
+  double log_scale;
 };
 
 
@@ -21,18 +21,29 @@
  */
 
 #include <fstream>
-#include <numeric>
 #include <vector>
 #include <iomanip>
 #include <queue>
 #include <sys/types.h>
 #include <unistd.h>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <tr1/unordered_map>
 #include <cmath>
+#include <limits>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <stdint.h>
 
 #include <gsl/gsl_cdf.h>
 #include <gsl/gsl_randist.h>
@@ -50,8 +61,13 @@
 // AS: might not be good to depend on mapped read here
 // TD: if we're including gc_extrap, we need the dependence
 
+#include "complexity_estimates.hpp"
+#include "run_stats.hpp"
 #include "continued_fraction.hpp"
 #include "load_data_for_complexity.hpp"
+#include "buffered_output.hpp"
+#include "thread_pool.hpp"
+#include "local_socket.hpp"
 #include "moment_sequence.hpp"
 
 using std::string;
@@ -71,508 +87,607 @@ using std::tr1::unordered_map;
 
 
 /////////////////////////////////////////////////////////
-// Confidence interval stuff
-
-/*
-static inline double
-alpha_log_confint_multiplier(const double estimate,
-                             const double variance, const double alpha) {
-  const double inv_norm_alpha = gsl_cdf_ugaussian_Qinv(alpha/2.0);
-  return exp(inv_norm_alpha*
-             sqrt(log(1.0 + variance/pow(estimate, 2))));
+// Progress reports while loading (lc_extrap --report-every)
+
+// Receives snapshots of the partial histogram from a loader and
+// extrapolates each on a background thread, appending the curve to the
+// progress file. Only the latest snapshot is held, so a slow estimate
+// skips snapshots rather than holding up the loader.
+class ProgressReporter : public HistogramObserver {
+public:
+  ProgressReporter(const size_t report_every, const string &progress_file,
+                   const bool DEFECTS, const size_t max_terms,
+                   const int diagonal, const double step_size,
+                   const double max_extrapolation);
+  ~ProgressReporter();
+
+  void snapshot(const size_t n_reads, vector<double> &partial_hist);
+
+private:
+  void run();
+  void write_estimate(const size_t n_reads, vector<double> &hist);
+
+  std::ofstream out;
+  const bool DEFECTS;
+  const size_t max_terms;
+  const int diagonal;
+  const double step_size;
+  const double max_extrapolation;
+
+  std::mutex mtx;
+  std::condition_variable pending_cv;
+  vector<double> pending_hist;
+  size_t pending_reads;
+  bool HAS_PENDING;
+  bool DONE;
+  std::thread worker;
+};
+
+
+ProgressReporter::ProgressReporter(const size_t report_every,
+                                   const string &progress_file,
+                                   const bool D, const size_t mt,
+                                   const int di, const double ss,
+                                   const double me) :
+  HistogramObserver(report_every), out(progress_file.c_str(), std::ios::app),
+  DEFECTS(D), max_terms(mt), diagonal(di), step_size(ss),
+  max_extrapolation(me), pending_reads(0), HAS_PENDING(false), DONE(false) {
+  if (!out)
+    throw SMITHLABException("could not open progress file: " + progress_file);
+  out << "READS_LOADED\tTOTAL_READS\tEXPECTED_DISTINCT" << endl;
+  worker = std::thread(&ProgressReporter::run, this);
 }
-*/
-
-
-static void
-median_and_ci(const vector<double> &estimates,
-              const double ci_level,
-              double &median_estimate,
-              double &lower_ci_estimate,
-              double &upper_ci_estimate){
-  assert(!estimates.empty());
-  const double alpha = 1.0 - ci_level;
-  const size_t n_est = estimates.size();
-  vector<double> sorted_estimates(estimates);
-  sort(sorted_estimates.begin(), sorted_estimates.end());
-  median_estimate =
-    gsl_stats_median_from_sorted_data(&sorted_estimates[0], 
-                                      1, n_est);
-
-  lower_ci_estimate = 
-    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
-					1, n_est, alpha/2);
-  upper_ci_estimate = 
-    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
-					1, n_est, 1.0 - alpha/2);
 
-}
 
-static void
-vector_median_and_ci(const vector<vector<double> > &bootstrap_estimates,
-                     const double ci_level, 
-                     vector<double> &yield_estimates,
-                     vector<double> &lower_ci_lognormal,
-                     vector<double> &upper_ci_lognormal) {
-
-  yield_estimates.clear();
-  lower_ci_lognormal.clear();
-  upper_ci_lognormal.clear();
-  assert(!bootstrap_estimates.empty());
-
-  const size_t n_est = bootstrap_estimates.size();
-  vector<double> estimates_row(bootstrap_estimates.size(), 0.0);
-  for (size_t i = 0; i < bootstrap_estimates[0].size(); i++) {
-
-    // estimates is in wrong order, work locally on const val
-    for (size_t k = 0; k < n_est; ++k)
-      estimates_row[k] = bootstrap_estimates[k][i];
-
-    double median_estimate, lower_ci_estimate, upper_ci_estimate;
-    median_and_ci(estimates_row, ci_level, median_estimate,
-                  lower_ci_estimate, upper_ci_estimate);
-    sort(estimates_row.begin(), estimates_row.end());
-
-    yield_estimates.push_back(median_estimate);
-    lower_ci_lognormal.push_back(lower_ci_estimate);
-    upper_ci_lognormal.push_back(upper_ci_estimate);
+// the last snapshot is still estimated before the worker stops
+ProgressReporter::~ProgressReporter() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    DONE = true;
   }
+  pending_cv.notify_one();
+  worker.join();
 }
 
-void
-log_mean(const bool VERBOSE,
-	 const vector<double> &estimates,
-	 const double c_level,
-	 double &log_mean, 
-	 double &log_lower_ci,
-	 double &log_upper_ci){
-  vector<double> log_estimates(estimates);
-  for(size_t i = 0; i < log_estimates.size(); i++)
-    log_estimates[i] = log(log_estimates[i]);
-
-  log_mean = exp(gsl_stats_mean(&log_estimates[0], 1,
-				log_estimates.size()) );
-
-  double log_std_dev = std::sqrt(gsl_stats_variance(&log_estimates[0], 1, 
-						    log_estimates.size()) );
-
-  const double inv_norm_alpha = gsl_cdf_ugaussian_Qinv((1.0 - c_level)/2.0);
-  log_lower_ci = exp(log(log_mean) - inv_norm_alpha*log_std_dev);
-  log_upper_ci = exp(log(log_mean) + inv_norm_alpha*log_std_dev);
-}
 
 void
-mean_and_ci(const vector<double> &estimates,
-	const double ci_level,
-	double &mean_estimate,
-	double &lower_ci_estimate,
-	double &upper_ci_estimate){
-  assert(!estimates.empty());
-  const double alpha = 1.0 - ci_level;
-  const size_t n_est = estimates.size();
-  vector<double> sorted_estimates(estimates);
-  sort(sorted_estimates.begin(), sorted_estimates.end());
-  mean_estimate =
-    gsl_stats_mean(&sorted_estimates[0], 1, n_est);
-
-  lower_ci_estimate = 
-    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
-					1, n_est, alpha/2);
-  upper_ci_estimate = 
-    gsl_stats_quantile_from_sorted_data(&sorted_estimates[0],
-					1, n_est, 1.0 - alpha/2);
+ProgressReporter::snapshot(const size_t n_reads, vector<double> &partial_hist) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    pending_hist.swap(partial_hist);
+    pending_reads = n_reads;
+    HAS_PENDING = true;
+  }
+  pending_cv.notify_one();
 }
 
 
+void
+ProgressReporter::run() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (true) {
+    pending_cv.wait(lock, [this] {return HAS_PENDING || DONE;});
+    if (!HAS_PENDING)
+      break;
+    vector<double> hist;
+    hist.swap(pending_hist);
+    const size_t n_reads = pending_reads;
+    HAS_PENDING = false;
 
-////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////
-/////
-/////  EXTRAP MODE BELOW HERE
-/////
+    lock.unlock();
+    try {
+      write_estimate(n_reads, hist);
+    }
+    // nothing may leave the worker thread, or the program terminates
+    catch (SMITHLABException &e) {
+      out << "# " << n_reads << " reads: " << e.what() << endl;
+    }
+    catch (std::bad_alloc &ba) {
+      out << "# " << n_reads << " reads: could not allocate memory" << endl;
+    }
+    catch (std::exception &e) {
+      out << "# " << n_reads << " reads: " << e.what() << endl;
+    }
+    lock.lock();
+  }
+}
 
 
-// vals_hist[j] = n_{j} = # (counts = j)
-// vals_hist_distinct_counts[k] = kth index j s.t. vals_hist[j] > 0
-// stores kth index of vals_hist that is positive
-// distinct_counts_hist[k] = vals_hist[vals_hist_distinct_counts[k]]
-// stores the kth positive value of vals_hist
 void
-resample_hist(const gsl_rng *rng, const vector<size_t> &vals_hist_distinct_counts,
-              const vector<double> &distinct_counts_hist,
-              vector<double> &out_hist) {
+ProgressReporter::write_estimate(const size_t n_reads, vector<double> &hist) {
+  const size_t MIN_REQUIRED_COUNTS = 4;
+
+  const HistogramSummary summary = summarize_histogram(hist);
+  const size_t terms = usable_max_terms(summary, max_terms);
+
+  vector<double> yield_estimates;
+  if (summary.good_toulmin_2x < 0.0)
+    out << "# " << n_reads << " reads: library expected to saturate "
+        << "in doubling of size" << endl;
+  else if (terms < MIN_REQUIRED_COUNTS)
+    out << "# " << n_reads << " reads: too few duplicates to extrapolate"
+        << endl;
+  else if (!extrap_single_estimate(false, DEFECTS, hist, terms, diagonal,
+                                   step_size, max_extrapolation,
+                                   yield_estimates))
+    out << "# " << n_reads << " reads: single estimate failed" << endl;
+  else {
+    out.setf(std::ios_base::fixed, std::ios_base::floatfield);
+    out.precision(1);
+    for (size_t i = 0; i < yield_estimates.size(); ++i)
+      out << n_reads << '\t' << (i + 1)*step_size << '\t'
+          << yield_estimates[i] << '\n';
+    out.flush();
+  }
+}
 
-  vector<unsigned int> sample_distinct_counts_hist(distinct_counts_hist.size(), 0);
 
-  const unsigned int distinct =
-    static_cast<unsigned int>(accumulate(distinct_counts_hist.begin(),
-                                         distinct_counts_hist.end(), 0.0));
+static void
+write_predicted_complexity_curve(BufferedOutput &out,
+                                 const double c_level, const double step_size,
+                                 const vector<double> &yield_estimates,
+                                 const vector<double> &yield_lower_ci_lognormal,
+                                 const vector<double> &yield_upper_ci_lognormal) {
+  out << "TOTAL_READS\tEXPECTED_DISTINCT\t"
+      << "LOWER_" << c_level << "CI\t"
+      << "UPPER_" << c_level << "CI" << '\n';
 
-  gsl_ran_multinomial(rng, distinct_counts_hist.size(), distinct,
-                      &distinct_counts_hist.front(),
-                      &sample_distinct_counts_hist.front());
+  out.set_fixed_precision(1);
 
-  out_hist.clear();
-  out_hist.resize(vals_hist_distinct_counts.back() + 1, 0.0);
-  for(size_t i = 0; i < sample_distinct_counts_hist.size(); i++)
-    out_hist[vals_hist_distinct_counts[i]] =
-      static_cast<double>(sample_distinct_counts_hist[i]);
+  out << 0 << '\t' << 0 << '\t' << 0 << '\t' << 0 << '\n';
+  for (size_t i = 0; i < yield_estimates.size(); ++i)
+    out << (i + 1)*step_size << '\t'
+        << yield_estimates[i] << '\t'
+        << yield_lower_ci_lognormal[i] << '\t'
+        << yield_upper_ci_lognormal[i] << '\n';
 }
 
-// interpolate by explicit calculating the expectation 
-// for sampling without replacement; 
-// see K.L Heck 1975
-// N total sample size; S the total number of distincts
-// n sub sample size
-static double
-interpolate_distinct(vector<double> &hist, size_t N,
-                      size_t S, const size_t n) {
-  double denom = gsl_sf_lngamma(N + 1) - gsl_sf_lngamma(n + 1) - gsl_sf_lngamma(N - n + 1);
-  vector<double> numer(hist.size(), 0); 
-  for (size_t i = 1; i < hist.size(); i++) {
-	// N - i -n + 1 should be greater than 0
-	if (N < i + n) {
-	  numer[i] = 0;
-	} else {
-	  numer[i] = gsl_sf_lngamma(N - i + 1) - gsl_sf_lngamma(n + 1) - gsl_sf_lngamma(N - i - n + 1);
-	  numer[i] = exp(numer[i] - denom) * hist[i];
-	}
-  }
-  return S - accumulate(numer.begin(), numer.end(), 0);
+static void
+write_predicted_complexity_curve(const string outfile,
+                                 const double c_level, const double step_size,
+                                 const vector<double> &yield_estimates,
+                                 const vector<double> &yield_lower_ci_lognormal,
+                                 const vector<double> &yield_upper_ci_lognormal) {
+  BufferedOutput out(outfile);
+  write_predicted_complexity_curve(out, c_level, step_size, yield_estimates,
+                                   yield_lower_ci_lognormal,
+                                   yield_upper_ci_lognormal);
+  out.close();
 }
 
+static void
+write_predicted_coverage_curve(const string outfile,
+                               const double c_level,
+                               const double base_step_size,
+                               const size_t bin_size,
+                               const vector<double> &coverage_estimates,
+                               const vector<double> &coverage_lower_ci_lognormal,
+                               const vector<double> &coverage_upper_ci_lognormal) {
+  BufferedOutput out(outfile);
 
-// check if estimates are finite, increasing, and concave
-static bool
-check_yield_estimates(const vector<double> &estimates) {
+  out << "TOTAL_BASES\tEXPECTED_COVERED_BASES\t"
+      << "LOWER_" << 100*c_level << "%CI\t"
+      << "UPPER_" << 100*c_level << "%CI" << '\n';
 
-  if (estimates.empty())
-    return false;
+  out.set_fixed_precision(1);
+
+  out << 0 << '\t' << 0 << '\t' << 0 << '\t' << 0 << '\n';
+  for (size_t i = 0; i < coverage_estimates.size(); ++i)
+    out << (i + 1)*base_step_size << '\t'
+        << coverage_estimates[i]*bin_size << '\t'
+        << coverage_lower_ci_lognormal[i]*bin_size << '\t'
+        << coverage_upper_ci_lognormal[i]*bin_size << '\n';
+  out.close();
+}
 
-  // make sure that the estimate is increasing in the time_step and is
-  // below the initial distinct per step_size
-  if (!isfinite(accumulate(estimates.begin(), estimates.end(), 0.0)))
-    return false;
 
-  for (size_t i = 1; i < estimates.size(); ++i)
-    if ((estimates[i] < estimates[i - 1]) ||
-        (i >= 2 && (estimates[i] - estimates[i - 1] >
-                    estimates[i - 1] - estimates[i - 2])) ||
-        (estimates[i] < 0.0))
-      return false;
+static void
+write_predicted_yield(BufferedOutput &out, const double step_size,
+                      const vector<double> &yield_estimates) {
+  out << "TOTAL_READS\tEXPECTED_DISTINCT" << '\n';
 
-  return true;
+  out.set_fixed_precision(1);
+
+  out << 0 << '\t' << 0 << '\n';
+  for (size_t i = 0; i < yield_estimates.size(); ++i)
+    out << (i + 1)*step_size << '\t'
+        << yield_estimates[i] << '\n';
 }
 
+static void
+write_predicted_yield(const string outfile, const double step_size,
+                      const vector<double> &yield_estimates) {
+  BufferedOutput out(outfile);
+  write_predicted_yield(out, step_size, yield_estimates);
+  out.close();
+}
 
-void
-extrap_bootstrap(const bool VERBOSE, const bool DEFECTS,
-		 const unsigned long int seed,
-		 const vector<double> &orig_hist,
-                 const size_t bootstraps, const size_t orig_max_terms,
-                 const int diagonal, const double bin_step_size,
-                 const double max_extrapolation, const size_t max_iter,
-                 vector< vector<double> > &bootstrap_estimates) {
-  // clear returning vectors
-  bootstrap_estimates.clear();
-
-  //setup rng
-  srand(time(0) + getpid());
-  gsl_rng_env_setup();
-  gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
-  gsl_rng_set(rng, seed);
 
-  double vals_sum = 0.0;
-  for(size_t i = 0; i < orig_hist.size(); i++)
-    vals_sum += orig_hist[i]*i;
+static void
+write_interpolated_curve(BufferedOutput &out,
+                         const vector<size_t> &sample_sizes,
+                         const vector<double> &expected_distinct) {
+  out << "total_reads" << "\t" << "distinct_reads" << '\n';
+  out << 0 << '\t' << 0 << '\n';
+  for (size_t i = 0; i < sample_sizes.size(); ++i)
+    out << sample_sizes[i] << "\t" << expected_distinct[i] << '\n';
+}
 
-  const double initial_distinct 
-    = accumulate(orig_hist.begin(), orig_hist.end(), 0.0);
 
+static void
+write_bound_pop_estimate(BufferedOutput &out, const bool QUICK_MODE,
+                         const BoundPopEstimate &estimate) {
+  out.set_fixed_precision(1);
 
-  vector<size_t> orig_hist_distinct_counts;
-  vector<double> distinct_orig_hist;
-  for (size_t i = 0; i < orig_hist.size(); i++){
-    if (orig_hist[i] > 0) {
-      orig_hist_distinct_counts.push_back(i);
-      distinct_orig_hist.push_back(orig_hist[i]);
-    }
+  if(QUICK_MODE){
+    out << "quadrature_estimated_unobs" << '\t' << "n_points" << '\n';
+    out << estimate.estimate << '\t' << estimate.n_points << '\n';
   }
-  
-  for (size_t iter = 0;
-       (iter < max_iter && bootstrap_estimates.size() < bootstraps);
-       ++iter) {
+  else{
+    out << "median_estimated_unobs" << '\t'
+	<< "lower_ci" << '\t'
+	<< "upper_ci" << '\n';
+    out << estimate.estimate << '\t'
+	<< estimate.lower_ci << '\t'
+	<< estimate.upper_ci << '\n';
+  }
+}
 
-    vector<double> yield_vector;
-    vector<double> hist;
-    resample_hist(rng, orig_hist_distinct_counts, distinct_orig_hist, hist);
-
-    double sample_vals_sum = 0.0;
-    for(size_t i = 0; i < hist.size(); i++)
-      sample_vals_sum += i*hist[i];
-
-    //resize boot_hist to remove excess zeros
-    while (hist.back() == 0)
-      hist.pop_back();
-
-    // compute complexity curve by random sampling w/out replacement
-    const size_t upper_limit = static_cast<size_t>(sample_vals_sum);
-	const size_t distinct = static_cast<size_t>(accumulate(hist.begin(), hist.end(), 0.0));
-    const size_t step = static_cast<size_t>(bin_step_size);
-    size_t sample = step;
-    while(sample < upper_limit){
-      yield_vector.push_back(interpolate_distinct(hist, upper_limit, distinct, sample));
-      sample += step;
-    }
-
-    // ENSURE THAT THE MAX TERMS ARE ACCEPTABLE
-    size_t counts_before_first_zero = 1;
-    while (counts_before_first_zero < hist.size() &&
-           hist[counts_before_first_zero] > 0)
-      ++counts_before_first_zero;
-    
-    size_t max_terms = std::min(orig_max_terms, counts_before_first_zero - 1);
-    // refit curve for lower bound (degree of approx is 1 less than
-    // max_terms)
-    max_terms = max_terms - (max_terms % 2 == 1);
-    
-    // defect mode, simple extrapolation
-    if(DEFECTS){
-      vector<double> ps_coeffs;
-      for (size_t j = 1; j <= max_terms; j++)
-	ps_coeffs.push_back(hist[j]*std::pow((double)(-1), (int)(j + 1)) );
-    
-      const ContinuedFraction
-	defect_cf(ps_coeffs, diagonal, max_terms);
-
-      double sample_size = static_cast<double>(sample);
-      while(sample_size < max_extrapolation){
-	double t = (sample_size - sample_vals_sum)/sample_vals_sum;
-	assert(t >= 0.0);
-	yield_vector.push_back(initial_distinct + t*defect_cf(t));
-	sample_size += bin_step_size;
-      }
-      // no checking of curve in defect mode
-      bootstrap_estimates.push_back(yield_vector);
-      if (VERBOSE) cerr << '.';
-    }
-    else{
-      //refit curve for lower bound
-      const ContinuedFractionApproximation
-	lower_cfa(diagonal, max_terms);
-
-      const ContinuedFraction
-	lower_cf(lower_cfa.optimal_cont_frac_distinct(hist));
-
-      //extrapolate the curve start
-      if (lower_cf.is_valid()){
-	double sample_size = static_cast<double>(sample);
-	while(sample_size < max_extrapolation){
-	  double t = (sample_size - sample_vals_sum)/sample_vals_sum;
-	  assert(t >= 0.0);
-	  yield_vector.push_back(initial_distinct + t*lower_cf(t));
-	  sample_size += bin_step_size;
-	}
-
-	// SANITY CHECK
-	if (check_yield_estimates(yield_vector)) {
-	  bootstrap_estimates.push_back(yield_vector);
-	  if (VERBOSE) cerr << '.';
-	}
-	else if (VERBOSE){
-	  cerr << "_";
-	}
-      }
-      else if (VERBOSE){
-	cerr << "_";
-      }
 
+// how the reads or counts given to lc_extrap are stored
+struct CountsInput {
+  CountsInput() : HIST_INPUT(false), VALS_INPUT(false), PAIRED_END(false),
+                  BAM_FORMAT_INPUT(false), NAME_SORTED(false),
+                  MAX_SEGMENT_LENGTH(5000), max_memory(0) {}
+  bool HIST_INPUT;
+  bool VALS_INPUT;
+  bool PAIRED_END;
+  bool BAM_FORMAT_INPUT;
+  // paired end BAM with mates next to each other
+  bool NAME_SORTED;
+  size_t MAX_SEGMENT_LENGTH;
+  // bytes for paired end BAM loading before spilling to disk, 0 for none
+  size_t max_memory;
+};
+
+// bytes in --max-mem megabytes
+static const size_t bytes_per_megabyte = 1024*1024;
+
+static size_t
+load_counts_hist(const bool VERBOSE, const CountsInput &input,
+                 const string &input_file_name, const size_t n_threads,
+                 vector<double> &counts_hist,
+                 HistogramObserver *observer = NULL,
+                 RunStats *stats = NULL) {
+  size_t n_reads = 0;
+  if(input.HIST_INPUT){
+    if(VERBOSE)
+      cerr << "HIST_INPUT" << endl;
+    n_reads = load_histogram(input_file_name, counts_hist);
+  }
+  else if(input.VALS_INPUT){
+    if(VERBOSE)
+      cerr << "VALS_INPUT" << endl;
+    n_reads = load_counts(VERBOSE, input_file_name, n_threads,
+                          counts_hist, stats);
+  }
+#ifdef HAVE_SAMTOOLS
+  else if (input.BAM_FORMAT_INPUT && input.PAIRED_END &&
+           input.NAME_SORTED) {
+    if (VERBOSE)
+      cerr << "NAME_SORTED_PAIRED_END_BAM_INPUT" << endl;
+    size_t n_paired = 0;
+    size_t n_mates = 0;
+    n_reads = load_counts_BAM_pe_name_sorted(VERBOSE, input_file_name,
+                                             input.MAX_SEGMENT_LENGTH,
+                                             input.max_memory, n_paired,
+                                             n_mates, counts_hist, stats);
+    if (VERBOSE)
+      cerr << "MERGED PAIRED END READS = " << n_paired << endl
+           << "MATES PROCESSED = " << n_mates << endl;
+  }
+  else if (input.BAM_FORMAT_INPUT && input.PAIRED_END){
+    if(VERBOSE)
+      cerr << "PAIRED_END_BAM_INPUT" << endl;
+    const size_t MAX_READS_TO_HOLD = 5000000;
+    size_t n_paired = 0;
+    size_t n_mates = 0;
+    n_reads = load_counts_BAM_pe(VERBOSE, input_file_name,
+                                 input.MAX_SEGMENT_LENGTH,
+                                 MAX_READS_TO_HOLD, input.max_memory,
+                                 n_paired, n_mates, counts_hist, observer,
+                                 stats);
+    if(VERBOSE){
+      cerr << "MERGED PAIRED END READS = " << n_paired << endl;
+      cerr << "MATES PROCESSED = " << n_mates << endl;
     }
   }
-  if (VERBOSE)
-    cerr << endl;
-  if (bootstrap_estimates.size() < bootstraps)
-    throw SMITHLABException("too many defects in the approximation, consider running in defect mode");
+  else if(input.BAM_FORMAT_INPUT){
+    if(VERBOSE)
+      cerr << "BAM_INPUT" << endl;
+    n_reads = load_counts_BAM_se(input_file_name, counts_hist, observer,
+                                 stats);
+  }
+#endif
+  else if(input.PAIRED_END){
+    if(VERBOSE)
+      cerr << "PAIRED_END_BED_INPUT" << endl;
+    n_reads = load_counts_BED_pe(input_file_name, n_threads, counts_hist,
+                                 observer, stats);
+  }
+  else{ // default is single end bed file
+    if(VERBOSE)
+      cerr << "BED_INPUT" << endl;
+    n_reads = load_counts_BED_se(input_file_name, n_threads, counts_hist,
+                                 observer, stats);
+  }
+  return n_reads;
 }
 
-static bool
-extrap_single_estimate(const bool VERBOSE, const bool DEFECTS,
-		       vector<double> &hist,
-                       size_t max_terms, const int diagonal,
-                       const double step_size, 
-                       const double max_extrapolation,
-                       vector<double> &yield_estimate) {
-
-  yield_estimate.clear();
-  double vals_sum = 0.0;
-  for(size_t i = 0; i < hist.size(); i++)
-    vals_sum += i*hist[i];
-  const double initial_distinct 
-    = accumulate(hist.begin(), hist.end(), 0.0);
-
-  // interpolate complexity curve by random sampling w/out replacement
-  size_t upper_limit = static_cast<size_t>(vals_sum);
-  size_t step = static_cast<size_t>(step_size);
-  size_t sample = step;
-  while (sample < upper_limit){
-    yield_estimate.push_back(
-		interpolate_distinct(hist, upper_limit, 
-		                      static_cast<size_t>(initial_distinct), sample));
-    sample += step;
+
+// --stats-json: the stats of one run, started before its input is read
+static std::unique_ptr<RunStats>
+start_run_stats(const string &stats_file, const string &command,
+                const string &input_file_name) {
+  std::unique_ptr<RunStats> stats;
+  if (!stats_file.empty()) {
+    stats.reset(new RunStats);
+    stats->set_info("command", command);
+    stats->set_info("input", input_file_name);
   }
+  return stats;
+}
 
-  // ENSURE THAT THE MAX TERMS ARE ACCEPTABLE
-  size_t counts_before_first_zero = 1;
-  while (counts_before_first_zero < hist.size() &&
-         hist[counts_before_first_zero] > 0)
-    ++counts_before_first_zero;
 
+static void
+write_run_stats(const string &stats_file, const size_t n_reads,
+                const vector<double> &hist, RunStats &stats) {
+  stats.set("reads", n_reads);
+  stats.set("distinct", summarize_histogram(hist).distinct);
+  // records read by the loaders of sorted reads, otherwise the reads
+  const double n_records = stats.counter("records") > 0.0 ?
+    stats.counter("records") : n_reads;
+  stats.set("records_per_second", n_records/stats.wall_seconds("load"));
+  stats.write_json(stats_file);
+}
 
-  // Ensure we are not using a zero term
-  max_terms = std::min(max_terms, counts_before_first_zero - 1);
 
-  // refit curve for lower bound (degree of approx is 1 less than
-  // max_terms)
-  max_terms = max_terms - (max_terms % 2 == 1);
+/////////////////////////////////////////////////////////
+// lc_extrap --batch: many samples in one process
+//
+// Every sample is a task on one WorkStealingPool: it loads the counts
+// and then submits its bootstraps as tasks of batch_chunk_size
+// replicates each, which other threads steal when they run out of
+// samples of their own. The last chunk of a sample to finish computes
+// the intervals and writes the curve. Each chunk has its own generator,
+// seeded from the seed, the sample and the chunk, so the results do not
+// depend on the number of threads.
+
+static const size_t batch_chunk_size = 10;
+
+struct BatchSample {
+  BatchSample() : n_reads(0), distinct_reads(0.0), max_terms(0),
+                  chunks_left(0) {}
+  string input_file_name;
+  string outfile;
+
+  vector<double> counts_hist;
+  size_t n_reads;
+  double distinct_reads;
+  size_t max_terms;
+  vector<vector<vector<double> > > chunk_estimates;
+  std::atomic<size_t> chunks_left;
+
+  std::mutex mtx;
+  string error;
+  ExtrapCurve curve;
+};
 
-  if(DEFECTS){
-    vector<double> ps_coeffs;
-    for (size_t j = 1; j <= max_terms; j++)
-      ps_coeffs.push_back(hist[j]*std::pow((double)(-1), (int)(j + 1)) );
-    
-    const ContinuedFraction
-      defect_cf(ps_coeffs, diagonal, max_terms);
 
-    double sample_size = static_cast<double>(sample);
-    while(sample_size < max_extrapolation){
-      const double one_minus_fold_extrap 
-	= (sample_size - vals_sum)/vals_sum;
-      assert(one_minus_fold_extrap >= 0.0);
-      double tmp = one_minus_fold_extrap*defect_cf(one_minus_fold_extrap);
-      yield_estimate.push_back(initial_distinct + tmp);
-      sample_size += step_size;
-    }
+static void
+read_batch_manifest(const string &manifest_file,
+                    vector<std::unique_ptr<BatchSample> > &samples) {
+  std::ifstream in(manifest_file.c_str());
+  if (!in)
+    throw SMITHLABException("could not open manifest: " + manifest_file);
+
+  string line;
+  size_t line_number = 0;
+  while (getline(in, line)) {
+    ++line_number;
+    if (line.empty() || line[0] == '#')
+      continue;
+    const size_t tab = line.find('\t');
+    if (tab == string::npos || tab == 0 || tab + 1 == line.size())
+      throw SMITHLABException("manifest line " + toa(line_number) +
+                              " is not <input>\\t<output>: " + manifest_file);
+    samples.push_back(std::unique_ptr<BatchSample>(new BatchSample));
+    samples.back()->input_file_name = line.substr(0, tab);
+    samples.back()->outfile = line.substr(tab + 1);
+  }
+}
 
-    if (VERBOSE) {
-      if(defect_cf.offset_coeffs.size() > 0){
-	cerr << "CF_OFFSET_COEFF_ESTIMATES" << endl;
-	copy(defect_cf.offset_coeffs.begin(), defect_cf.offset_coeffs.end(),
-	     std::ostream_iterator<double>(cerr, "\n"));
-      }
-      if(defect_cf.cf_coeffs.size() > 0){
-	cerr << "CF_COEFF_ESTIMATES" << endl;
-	copy(defect_cf.cf_coeffs.begin(), defect_cf.cf_coeffs.end(),
-	     std::ostream_iterator<double>(cerr, "\n"));
-      }
-    }
 
-    // NO FAIL!  DEFECT MODE DOESN'T CARE ABOUT FAILURE
-  }
-  else{
-    const ContinuedFractionApproximation
-      lower_cfa(diagonal, max_terms);
-
-    const ContinuedFraction
-      lower_cf(lower_cfa.optimal_cont_frac_distinct(hist));
-
-    // extrapolate curve
-    if (lower_cf.is_valid()){
-      double sample_size = static_cast<double>(sample);
-      while(sample_size < max_extrapolation){
-	const double one_minus_fold_extrap 
-	  = (sample_size - vals_sum)/vals_sum;
-	assert(one_minus_fold_extrap >= 0.0);
-	double tmp = one_minus_fold_extrap*lower_cf(one_minus_fold_extrap);
-	yield_estimate.push_back(initial_distinct + tmp);
-	sample_size += step_size;
-      }
-    }
-    else{
-    // FAIL!
-    // lower_cf unacceptable, need to bootstrap to obtain estimates
-      return false;
-    }
+// well mixed seeds for nearby (seed, sample, chunk)
+static unsigned long int
+batch_seed(const unsigned long int seed, const size_t sample,
+           const size_t chunk) {
+  unsigned long long x = seed;
+  x = (x ^ sample)*0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 31) ^ chunk)*0xBF58476D1CE4E5B9ULL;
+  return static_cast<unsigned long int>(x ^ (x >> 29));
+}
 
-    if (VERBOSE) {
-      if(lower_cf.offset_coeffs.size() > 0){
-	cerr << "CF_OFFSET_COEFF_ESTIMATES" << endl;
-	copy(lower_cf.offset_coeffs.begin(), lower_cf.offset_coeffs.end(),
-	     std::ostream_iterator<double>(cerr, "\n"));
-      }
-      if(lower_cf.cf_coeffs.size() > 0){
-	cerr << "CF_COEFF_ESTIMATES" << endl;
-	copy(lower_cf.cf_coeffs.begin(), lower_cf.cf_coeffs.end(),
-	     std::ostream_iterator<double>(cerr, "\n"));
-      }
+
+static void
+set_batch_error(BatchSample &sample, const string &message) {
+  std::lock_guard<std::mutex> lock(sample.mtx);
+  if (sample.error.empty())
+    sample.error = message;
+}
+
+
+static void
+finish_batch_sample(const bool VERBOSE, const ExtrapOptions &options,
+                    BatchSample &sample) {
+  try {
+    if (sample.error.empty() && !options.SINGLE_ESTIMATE) {
+      vector<vector<double> > bootstrap_estimates;
+      for (size_t i = 0; i < sample.chunk_estimates.size(); ++i)
+        bootstrap_estimates.insert(bootstrap_estimates.end(),
+                                   sample.chunk_estimates[i].begin(),
+                                   sample.chunk_estimates[i].end());
+      vector_median_and_ci(bootstrap_estimates, options.c_level,
+                           sample.curve.estimates, sample.curve.lower_ci,
+                           sample.curve.upper_ci);
+      write_predicted_complexity_curve(sample.outfile, options.c_level,
+                                       options.step_size,
+                                       sample.curve.estimates,
+                                       sample.curve.lower_ci,
+                                       sample.curve.upper_ci);
     }
   }
+  catch (SMITHLABException &e) {
+    set_batch_error(sample, e.what());
+  }
+  catch (std::bad_alloc &ba) {
+    set_batch_error(sample, "could not allocate memory");
+  }
+  vector<double>().swap(sample.counts_hist);
+  vector<vector<vector<double> > >().swap(sample.chunk_estimates);
+  if (VERBOSE)
+    cerr << (sample.error.empty() ? "DONE\t" : "FAILED\t")
+         + sample.input_file_name + '\n';
+}
+
 
-  // SUCCESS!!
-  return true;
+static void
+run_batch_chunk(const bool VERBOSE, const ExtrapOptions &options,
+                const size_t sample_id, const size_t chunk,
+                BatchSample &sample) {
+  try {
+    const size_t first = chunk*batch_chunk_size;
+    const size_t n = std::min(batch_chunk_size, options.bootstraps - first);
+    extrap_bootstrap(false, options.DEFECTS,
+                     batch_seed(options.seed, sample_id, chunk),
+                     sample.counts_hist, n, sample.max_terms,
+                     options.diagonal, options.step_size,
+                     options.max_extrapolation, 10*n, "", 0, false,
+                     sample.chunk_estimates[chunk]);
+  }
+  catch (SMITHLABException &e) {
+    set_batch_error(sample, e.what());
+  }
+  catch (std::bad_alloc &ba) {
+    set_batch_error(sample, "could not allocate memory");
+  }
+  if (--sample.chunks_left == 0)
+    finish_batch_sample(VERBOSE, options, sample);
 }
 
-static double
-GoodToulmin2xExtrap(const vector<double> &counts_hist){
-  double two_fold_extrap = 0.0;
-  for(size_t i = 0; i < counts_hist.size(); i++)
-    two_fold_extrap += pow(-1.0, i + 1)*counts_hist[i];
 
-  return two_fold_extrap;
+static void
+run_batch_sample(const bool VERBOSE, const CountsInput &input,
+                 const ExtrapOptions &options, WorkStealingPool &pool,
+                 const size_t sample_id, BatchSample &sample) {
+  try {
+    sample.n_reads = load_counts_hist(false, input, sample.input_file_name,
+                                      1, sample.counts_hist);
+    sample.distinct_reads = summarize_histogram(sample.counts_hist).distinct;
+    sample.max_terms = extrapolation_max_terms(sample.counts_hist,
+                                               options.max_terms);
+    if (options.SINGLE_ESTIMATE) {
+      extrap_curve(false, sample.counts_hist, options, sample.curve);
+      write_predicted_yield(sample.outfile, options.step_size,
+                            sample.curve.estimates);
+    }
+  }
+  catch (SMITHLABException &e) {
+    sample.error = e.what();
+  }
+  catch (std::bad_alloc &ba) {
+    sample.error = "could not allocate memory";
+  }
+  if (!sample.error.empty() || options.SINGLE_ESTIMATE) {
+    finish_batch_sample(VERBOSE, options, sample);
+    return;
+  }
+
+  const size_t n_chunks =
+    (options.bootstraps + batch_chunk_size - 1)/batch_chunk_size;
+  sample.chunk_estimates.resize(n_chunks);
+  sample.chunks_left = n_chunks;
+  for (size_t i = 0; i < n_chunks; ++i)
+    pool.submit([VERBOSE, &options, sample_id, i, &sample] {
+        run_batch_chunk(VERBOSE, options, sample_id, i, sample);
+      });
 }
 
 
+// one line per sample: the expected yield at the largest extrapolation
 static void
-write_predicted_complexity_curve(const string outfile,
-                                 const double c_level, const double step_size,
-                                 const vector<double> &yield_estimates,
-                                 const vector<double> &yield_lower_ci_lognormal,
-                                 const vector<double> &yield_upper_ci_lognormal) {
-  std::ofstream of;
-  if (!outfile.empty()) of.open(outfile.c_str());
-  std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
+write_batch_summary(const string &outfile, const double c_level,
+                    const double step_size,
+                    const vector<std::unique_ptr<BatchSample> > &samples) {
+  BufferedOutput out(outfile);
 
-  out << "TOTAL_READS\tEXPECTED_DISTINCT\t"
+  out << "INPUT\tOUTPUT\tTOTAL_READS\tDISTINCT_READS\t"
+      << "MAX_TOTAL_READS\tEXPECTED_DISTINCT\t"
       << "LOWER_" << c_level << "CI\t"
-      << "UPPER_" << c_level << "CI" << endl;
+      << "UPPER_" << c_level << "CI\tSTATUS" << '\n';
 
-  out.setf(std::ios_base::fixed, std::ios_base::floatfield);
-  out.precision(1);
+  out.set_fixed_precision(1);
 
-  out << 0 << '\t' << 0 << '\t' << 0 << '\t' << 0 << endl;
-  for (size_t i = 0; i < yield_estimates.size(); ++i)
-    out << (i + 1)*step_size << '\t'
-        << yield_estimates[i] << '\t'
-        << yield_lower_ci_lognormal[i] << '\t'
-        << yield_upper_ci_lognormal[i] << endl;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const BatchSample &sample = *samples[i];
+    const ExtrapCurve &curve = sample.curve;
+    out << sample.input_file_name << '\t' << sample.outfile << '\t'
+        << sample.n_reads << '\t' << sample.distinct_reads << '\t';
+    if (!sample.error.empty() || curve.estimates.empty())
+      out << "NA\tNA\tNA\tNA\t";
+    else {
+      const size_t last = curve.estimates.size() - 1;
+      out << curve.estimates.size()*step_size << '\t'
+          << curve.estimates[last] << '\t';
+      if (curve.lower_ci.empty())
+        out << "NA\tNA\t";
+      else
+        out << curve.lower_ci[last] << '\t' << curve.upper_ci[last] << '\t';
+    }
+    out << (sample.error.empty() ? string("OK") : "ERROR: " + sample.error)
+        << '\n';
+  }
+  out.close();
 }
 
-static void
-write_predicted_coverage_curve(const string outfile,
-                               const double c_level,
-                               const double base_step_size,
-                               const size_t bin_size,
-                               const vector<double> &coverage_estimates,
-                               const vector<double> &coverage_lower_ci_lognormal,
-                               const vector<double> &coverage_upper_ci_lognormal) {
-  std::ofstream of;
-  if (!outfile.empty()) of.open(outfile.c_str());
-  std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
 
-  out << "TOTAL_BASES\tEXPECTED_COVERED_BASES\t"
-      << "LOWER_" << 100*c_level << "%CI\t"
-      << "UPPER_" << 100*c_level << "%CI" << endl;
+// returns the number of samples that failed
+static size_t
+lc_extrap_batch(const bool VERBOSE, const string &manifest_file,
+                const string &summary_file, const CountsInput &input,
+                const size_t n_threads, const ExtrapOptions &options) {
+  vector<std::unique_ptr<BatchSample> > samples;
+  read_batch_manifest(manifest_file, samples);
+  if (VERBOSE)
+    cerr << "BATCH SAMPLES   = " << samples.size() << endl
+         << "THREADS         = " << n_threads << endl;
+
+  WorkStealingPool pool(n_threads);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    BatchSample &sample = *samples[i];
+    pool.submit([VERBOSE, &input, &options, &pool, i, &sample] {
+        run_batch_sample(VERBOSE, input, options, pool, i, sample);
+      });
+  }
+  pool.wait();
 
-  out.setf(std::ios_base::fixed, std::ios_base::floatfield);
-  out.precision(1);
+  write_batch_summary(summary_file, options.c_level, options.step_size,
+                      samples);
 
-  out << 0 << '\t' << 0 << '\t' << 0 << '\t' << 0 << endl;
-  for (size_t i = 0; i < coverage_estimates.size(); ++i)
-    out << (i + 1)*base_step_size << '\t'
-        << coverage_estimates[i]*bin_size << '\t'
-        << coverage_lower_ci_lognormal[i]*bin_size << '\t'
-        << coverage_upper_ci_lognormal[i]*bin_size << endl;
+  size_t n_failed = 0;
+  for (size_t i = 0; i < samples.size(); ++i)
+    n_failed += !samples[i]->error.empty();
+  return n_failed;
 }
 
 
@@ -580,8 +695,6 @@ static int
 lc_extrap(const int argc, const char **argv) {
   
   try {
-    const size_t MIN_REQUIRED_COUNTS = 4;
-    
     /* FILES */
     string outfile;
     
@@ -592,6 +705,13 @@ lc_extrap(const int argc, const char **argv) {
     int diagonal = 0;
     double c_level = 0.95;
     unsigned long int seed = 0;
+    size_t report_every = 0;
+    string progress_file;
+    string checkpoint_file;
+    size_t checkpoint_every = 10;
+    size_t n_threads = 1;
+    string batch_file;
+    string stats_file;
       
     /* FLAGS */
     bool VERBOSE = false;
@@ -600,10 +720,13 @@ lc_extrap(const int argc, const char **argv) {
     bool HIST_INPUT = false;
     bool SINGLE_ESTIMATE = false;
     bool DEFECTS = false;
+    bool RESUME = false;
       
 #ifdef HAVE_SAMTOOLS
     bool BAM_FORMAT_INPUT = false;
     size_t MAX_SEGMENT_LENGTH = 5000;
+    size_t max_mem = 0;
+    bool NAME_SORTED = false;
 #endif
       
     /********** GET COMMAND LINE ARGUMENTS  FOR LC EXTRAP ***********/
@@ -633,12 +756,21 @@ lc_extrap(const int argc, const char **argv) {
                       "paired end bam reads (default: "
                       + toa(MAX_SEGMENT_LENGTH) + ")",
                       false, MAX_SEGMENT_LENGTH);
+    opt_parse.add_opt("max-mem", 'm', "megabytes for pairing paired end "
+                      "bam reads, spilling to temporary files beyond "
+                      "(default: no limit, 1024 with -N)", false, max_mem);
+    opt_parse.add_opt("name-sorted", 'N', "paired end bam input is sorted "
+                      "by name or collated, mates next to each other",
+                      false, NAME_SORTED);
 #endif
     opt_parse.add_opt("pe", 'P', "input is paired end read file",
                       false, PAIRED_END);
     opt_parse.add_opt("vals", 'V',
                       "input is a text file containing only the observed counts",
                       false, VALS_INPUT);
+    opt_parse.add_opt("threads", 'T', "number of threads for parsing sorted "
+                      "BED or --vals input (default: " + toa(n_threads) + ")",
+                      false, n_threads);
     opt_parse.add_opt("hist", 'H',
                       "input is a text file containing the observed histogram",
                       false, HIST_INPUT);
@@ -650,6 +782,26 @@ lc_extrap(const int argc, const char **argv) {
 		      false, DEFECTS);
     opt_parse.add_opt("seed", 'r', "seed for random number generator",
 		      false, seed);
+    opt_parse.add_opt("report-every", 'R', "while loading sorted input, "
+                      "extrapolate from the partial histogram every N reads "
+                      "(default: off)", false, report_every);
+    opt_parse.add_opt("progress", 'p', "file to append --report-every "
+                      "curves to (default: <output>.progress)",
+                      false, progress_file);
+    opt_parse.add_opt("checkpoint", 'k', "file to save bootstrap progress to",
+                      false, checkpoint_file);
+    opt_parse.add_opt("checkpoint-every", 'K', "bootstraps between "
+                      "checkpoints (default: " + toa(checkpoint_every) + ")",
+                      false, checkpoint_every);
+    opt_parse.add_opt("resume", 'u', "continue from the checkpoint file "
+                      "if it exists", false, RESUME);
+    opt_parse.add_opt("batch", 'M', "estimate every sample in a manifest of "
+                      "<input>\\t<output> lines on a pool of --threads "
+                      "threads; the output file gets a summary",
+                      false, batch_file);
+    opt_parse.add_opt("stats-json", 'j', "write the time of each phase, "
+                      "counters and peak memory as JSON to this file",
+                      false, stats_file);
 
     vector<string> leftover_args;
     opt_parse.parse(argc-1, argv+1, leftover_args);
@@ -665,89 +817,99 @@ lc_extrap(const int argc, const char **argv) {
       cerr << opt_parse.option_missing_message() << endl;
       return EXIT_SUCCESS;
     }
-    if (leftover_args.empty()) {
+    if (leftover_args.empty() && batch_file.empty()) {
       cerr << opt_parse.help_message() << endl;
       return EXIT_SUCCESS;
     }
-    const string input_file_name = leftover_args.front();
     /******************************************************************/
 
+#ifdef HAVE_SAMTOOLS
+    if (NAME_SORTED && !(BAM_FORMAT_INPUT && PAIRED_END))
+      throw SMITHLABException("--name-sorted is for paired end bam input, "
+                              "given with -B and -P");
+#endif
+
     // if seed is not set, make it random
     if(seed == 0){
       seed = rand();
     }
 
-    vector<double> counts_hist;
-    size_t n_reads = 0;
-
-    // LOAD VALUES
-    if(HIST_INPUT){
-      if(VERBOSE)
-        cerr << "HIST_INPUT" << endl;
-      n_reads = load_histogram(input_file_name, counts_hist);
-    }
-    else if(VALS_INPUT){
-      if(VERBOSE)
-        cerr << "VALS_INPUT" << endl;
-      n_reads = load_counts(input_file_name, counts_hist);
-    }
+    CountsInput input;
+    input.HIST_INPUT = HIST_INPUT;
+    input.VALS_INPUT = VALS_INPUT;
+    input.PAIRED_END = PAIRED_END;
 #ifdef HAVE_SAMTOOLS
-    else if (BAM_FORMAT_INPUT && PAIRED_END){
-      if(VERBOSE)
-        cerr << "PAIRED_END_BAM_INPUT" << endl;
-      const size_t MAX_READS_TO_HOLD = 5000000;
-      size_t n_paired = 0;
-      size_t n_mates = 0;
-      n_reads = load_counts_BAM_pe(VERBOSE, input_file_name, 
-                                   MAX_SEGMENT_LENGTH, 
-                                   MAX_READS_TO_HOLD, n_paired, 
-                                   n_mates, counts_hist);
-      if(VERBOSE){
-        cerr << "MERGED PAIRED END READS = " << n_paired << endl;
-        cerr << "MATES PROCESSED = " << n_mates << endl;
-      }
-    }
-    else if(BAM_FORMAT_INPUT){
-      if(VERBOSE)
-        cerr << "BAM_INPUT" << endl;
-      n_reads = load_counts_BAM_se(input_file_name, counts_hist);
-    }
+    input.BAM_FORMAT_INPUT = BAM_FORMAT_INPUT;
+    input.MAX_SEGMENT_LENGTH = MAX_SEGMENT_LENGTH;
+    input.max_memory = max_mem*bytes_per_megabyte;
+    input.NAME_SORTED = NAME_SORTED;
 #endif
-    else if(PAIRED_END){
-      if(VERBOSE)
-        cerr << "PAIRED_END_BED_INPUT" << endl;
-      n_reads = load_counts_BED_pe(input_file_name, counts_hist);
+
+    ExtrapOptions options;
+    options.max_terms = orig_max_terms;
+    options.max_extrapolation = max_extrapolation;
+    options.step_size = step_size;
+    options.bootstraps = bootstraps;
+    options.diagonal = diagonal;
+    options.c_level = c_level;
+    options.seed = seed;
+    options.DEFECTS = DEFECTS;
+    options.SINGLE_ESTIMATE = SINGLE_ESTIMATE;
+    options.checkpoint_file = checkpoint_file;
+    options.checkpoint_every = checkpoint_every;
+    options.RESUME = RESUME;
+
+    if (!batch_file.empty()) {
+      if (!leftover_args.empty())
+        throw SMITHLABException("--batch takes its inputs from the manifest");
+      if (report_every > 0 || !checkpoint_file.empty() ||
+          !stats_file.empty())
+        throw SMITHLABException("--batch does not take --report-every, "
+                                "--checkpoint or --stats-json");
+      const size_t n_failed = lc_extrap_batch(VERBOSE, batch_file, outfile,
+                                              input, n_threads, options);
+      if (n_failed > 0)
+        throw SMITHLABException(toa(n_failed) + " samples failed, "
+                                "see the summary");
+      return EXIT_SUCCESS;
     }
-    else{ // default is single end bed file
-      if(VERBOSE)
-        cerr << "BED_INPUT" << endl;
-      n_reads = load_counts_BED_se(input_file_name, counts_hist);
+    const string input_file_name = leftover_args.front();
+    std::unique_ptr<RunStats> stats =
+      start_run_stats(stats_file, "lc_extrap", input_file_name);
+    options.stats = stats.get();
+
+    // estimates from partial histograms run beside the loader
+    std::unique_ptr<ProgressReporter> reporter;
+    if (report_every > 0) {
+      if (progress_file.empty() && outfile.empty())
+        throw SMITHLABException("--report-every needs an output file "
+                                "or a progress file");
+      if (progress_file.empty())
+        progress_file = outfile + ".progress";
+      reporter.reset(new ProgressReporter(report_every, progress_file,
+                                          DEFECTS, orig_max_terms, diagonal,
+                                          step_size, max_extrapolation));
+      if (VERBOSE && (HIST_INPUT || VALS_INPUT || input.NAME_SORTED))
+        cerr << "--report-every only applies to sorted read input" << endl;
     }
 
-    const size_t max_observed_count = counts_hist.size() - 1;
-    const double distinct_reads = accumulate(counts_hist.begin(),
-                                             counts_hist.end(), 0.0);
-
-    // ENSURE THAT THE MAX TERMS ARE ACCEPTABLE
-    size_t counts_before_first_zero = 1;
-    while (counts_before_first_zero < counts_hist.size() &&
-           counts_hist[counts_before_first_zero] > 0)
-      ++counts_before_first_zero;
-
-    orig_max_terms = std::min(orig_max_terms, counts_before_first_zero - 1);
-    orig_max_terms = orig_max_terms - (orig_max_terms % 2 == 1);
-
+    vector<double> counts_hist;
+    PhaseTimer load_timer(stats.get(), "load");
+    const size_t n_reads = load_counts_hist(VERBOSE, input, input_file_name,
+                                            n_threads, counts_hist,
+                                            reporter.get(), stats.get());
+    load_timer.stop();
 
-    const size_t distinct_counts =
-      static_cast<size_t>(std::count_if(counts_hist.begin(), counts_hist.end(),
-                                        bind2nd(std::greater<double>(), 0.0)));
+    const size_t max_observed_count = counts_hist.size() - 1;
+    const HistogramSummary summary = summarize_histogram(counts_hist);
     if (VERBOSE)
       cerr << "TOTAL READS     = " << n_reads << endl
-           << "DISTINCT READS  = " << distinct_reads << endl
-           << "DISTINCT COUNTS = " << distinct_counts << endl
+           << "DISTINCT READS  = " << summary.distinct << endl
+           << "DISTINCT COUNTS = " << summary.distinct_counts << endl
            << "MAX COUNT       = " << max_observed_count << endl
            << "COUNTS OF 1     = " << counts_hist[1] << endl
-           << "MAX TERMS       = " << orig_max_terms << endl;
+           << "MAX TERMS       = "
+           << usable_max_terms(summary, orig_max_terms) << endl;
 
     if (VERBOSE) {
       // OUTPUT THE ORIGINAL HISTOGRAM
@@ -758,25 +920,6 @@ lc_extrap(const int argc, const char **argv) {
       cerr << endl;
     }
 
-    // check to make sure library is not overly saturated
-    const double two_fold_extrap = GoodToulmin2xExtrap(counts_hist);
-    if(two_fold_extrap < 0.0)
-      throw SMITHLABException("Library expected to saturate in doubling of "
-                              "size, unable to extrapolate");
-
-
-    size_t total_reads = 0;
-    for(size_t i = 0; i < counts_hist.size(); i++){
-      total_reads += i*counts_hist[i];
-    }
-    //assert(total_reads == n_reads);
-
-    // catch if all reads are distinct
-    if (orig_max_terms < MIN_REQUIRED_COUNTS)
-      throw SMITHLABException("max count before zero is les than min required "
-                              "count (4), sample not sufficiently deep or "
-                              "duplicates removed");
-
     /////////////////////////////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////
@@ -784,64 +927,25 @@ lc_extrap(const int argc, const char **argv) {
 
     if(VERBOSE)
       cerr << "[ESTIMATING YIELD CURVE]" << endl;
-    vector<double> yield_estimates;
-
-
-    if(SINGLE_ESTIMATE){
-      bool SINGLE_ESTIMATE_SUCCESS =
-        extrap_single_estimate(VERBOSE, DEFECTS, counts_hist, orig_max_terms, 
-                               diagonal, step_size, max_extrapolation, 
-                               yield_estimates);
-      // IF FAILURE, EXIT
-      if(!SINGLE_ESTIMATE_SUCCESS)
-        throw SMITHLABException("SINGLE ESTIMATE FAILED, NEED TO RUN "
-                                "FULL MODE FOR ESTIMATES");
-
-      std::ofstream of;
-      if (!outfile.empty()) of.open(outfile.c_str());
-      std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
 
-      out << "TOTAL_READS\tEXPECTED_DISTINCT" << endl;
+    ExtrapCurve curve;
+    extrap_curve(VERBOSE, counts_hist, options, curve);
 
-      out.setf(std::ios_base::fixed, std::ios_base::floatfield);
-      out.precision(1);
-
-      out << 0 << '\t' << 0 << endl;
-      for (size_t i = 0; i < yield_estimates.size(); ++i)
-        out << (i + 1)*step_size << '\t'
-            << yield_estimates[i] << endl;
-
-    }
+    PhaseTimer output_timer(stats.get(), "output");
+    if(SINGLE_ESTIMATE)
+      write_predicted_yield(outfile, step_size, curve.estimates);
     else{
-      if (VERBOSE)
-        cerr << "[BOOTSTRAPPING HISTOGRAM]" << endl;
-
-      const size_t max_iter = 10*bootstraps;
-
-      vector<vector <double> > bootstrap_estimates;
-      extrap_bootstrap(VERBOSE, DEFECTS, seed, counts_hist, bootstraps, 
-		       orig_max_terms, diagonal, step_size, max_extrapolation, 
-		       max_iter, bootstrap_estimates);
-
-
-      /////////////////////////////////////////////////////////////////////
-      if (VERBOSE)
-        cerr << "[COMPUTING CONFIDENCE INTERVALS]" << endl;
-
-      // yield ci
-      vector<double> yield_upper_ci_lognormal, yield_lower_ci_lognormal;
-
-      vector_median_and_ci(bootstrap_estimates, c_level, yield_estimates,
-                           yield_lower_ci_lognormal, yield_upper_ci_lognormal);
-
-      /////////////////////////////////////////////////////////////////////
       if (VERBOSE)
         cerr << "[WRITING OUTPUT]" << endl;
 
       write_predicted_complexity_curve(outfile, c_level, step_size,
-                                       yield_estimates, yield_lower_ci_lognormal,
-                                       yield_upper_ci_lognormal);
+                                       curve.estimates, curve.lower_ci,
+                                       curve.upper_ci);
     }
+    output_timer.stop();
+
+    if (stats)
+      write_run_stats(stats_file, n_reads, counts_hist, *stats);
   }
   catch (SMITHLABException &e) {
     cerr << "ERROR:\t" << e.what() << endl;
@@ -865,8 +969,6 @@ gc_extrap(const int argc, const char **argv) {
 
   try {
 
-    const size_t MIN_REQUIRED_COUNTS = 4;
-    
     int diagonal = 0;
     size_t orig_max_terms = 100;
     size_t bin_size = 10;
@@ -879,8 +981,16 @@ gc_extrap(const int argc, const char **argv) {
     size_t bootstraps = 100;
     unsigned long int seed = 0;
     bool DEFECTS = false;
+    string checkpoint_file;
+    size_t checkpoint_every = 10;
+    bool RESUME = false;
+    size_t n_threads = 1;
+    string stats_file;
 
     bool NO_SEQUENCE = false;
+#ifdef HAVE_SAMTOOLS
+    bool BAM_FORMAT_INPUT = false;
+#endif
     double c_level = 0.95;
 
     // ********* GET COMMAND LINE ARGUMENTS  FOR GC EXTRAP **********
@@ -912,6 +1022,14 @@ gc_extrap(const int argc, const char **argv) {
     opt_parse.add_opt("bed", 'B',
                       "input is in bed format without sequence information",
                       false, NO_SEQUENCE);
+#ifdef HAVE_SAMTOOLS
+    opt_parse.add_opt("bam", 'a', "input is in SAM or BAM format, with mates "
+                      "merged into fragments of at most max_width",
+                      false, BAM_FORMAT_INPUT);
+#endif
+    opt_parse.add_opt("threads", 'T', "number of threads for binning reads, "
+                      "one chromosome per thread (default: "
+                      + toa(n_threads) + ")", false, n_threads);
     opt_parse.add_opt("quick",'Q',
                       "quick mode: run gc_extrap without "
                       "bootstrapping for confidence intervals",
@@ -921,7 +1039,16 @@ gc_extrap(const int argc, const char **argv) {
 		      false, DEFECTS);
     opt_parse.add_opt("seed", 'r', "seed for random number generator",
 		      false, seed);
-
+    opt_parse.add_opt("checkpoint", 'k', "file to save bootstrap progress to",
+                      false, checkpoint_file);
+    opt_parse.add_opt("checkpoint-every", 'K', "bootstraps between "
+                      "checkpoints (default: " + toa(checkpoint_every) + ")",
+                      false, checkpoint_every);
+    opt_parse.add_opt("resume", 'u', "continue from the checkpoint file "
+                      "if it exists", false, RESUME);
+    opt_parse.add_opt("stats-json", 'j', "write the time of each phase, "
+                      "counters and peak memory as JSON to this file",
+                      false, stats_file);
 
 
     vector<string> leftover_args;
@@ -950,43 +1077,49 @@ gc_extrap(const int argc, const char **argv) {
       seed = rand();
     }
 
+    std::unique_ptr<RunStats> stats =
+      start_run_stats(stats_file, "gc_extrap", input_file_name);
+
     vector<double> coverage_hist;
     size_t n_reads = 0;
     if(VERBOSE)
       cerr << "LOADING READS" << endl;
 
+    PhaseTimer load_timer(stats.get(), "load");
+
     if(NO_SEQUENCE){
       if(VERBOSE)
         cerr << "BED FORMAT" << endl;
-      n_reads = load_coverage_counts_GR(input_file_name, bin_size,
-                                        max_width, coverage_hist);
+      n_reads = load_coverage_counts_GR(input_file_name, seed, n_threads,
+                                        bin_size, max_width, coverage_hist);
     }
+#ifdef HAVE_SAMTOOLS
+    else if (BAM_FORMAT_INPUT) {
+      if (VERBOSE)
+        cerr << "BAM_INPUT" << endl;
+      n_reads = load_coverage_counts_BAM(VERBOSE, input_file_name, seed,
+                                         n_threads, bin_size, max_width,
+                                         coverage_hist);
+    }
+#endif
     else{
       if(VERBOSE)
         cerr << "MAPPED READ FORMAT" << endl;
-      n_reads = load_coverage_counts_MR(VERBOSE, input_file_name, bin_size,
-                                        max_width, coverage_hist);
+      n_reads = load_coverage_counts_MR(VERBOSE, input_file_name, seed,
+                                        n_threads, bin_size, max_width,
+                                        coverage_hist);
     }
+    load_timer.stop();
 
-    double total_bins = 0.0;
-    for(size_t i = 0; i < coverage_hist.size(); i++)
-      total_bins += coverage_hist[i]*i;
-    const double distinct_bins = 
-      accumulate(coverage_hist.begin(), coverage_hist.end(), 0.0);
+    const HistogramSummary summary = summarize_histogram(coverage_hist);
+    const double total_bins = summary.total;
+    const double distinct_bins = summary.distinct;
     
     const double avg_bins_per_read = total_bins/n_reads;
     double bin_step_size = base_step_size/bin_size;
 
     const size_t max_observed_count = coverage_hist.size() - 1;
 
-    // ENSURE THAT THE MAX TERMS ARE ACCEPTABLE
-    size_t counts_before_first_zero = 1;
-    while (counts_before_first_zero < coverage_hist.size() &&
-           coverage_hist[counts_before_first_zero] > 0)
-      ++counts_before_first_zero;
-
-    orig_max_terms = std::min(orig_max_terms, counts_before_first_zero - 1);
-
     if (VERBOSE)
       cerr << "TOTAL READS         = " << n_reads << endl
            << "BASE STEP SIZE      = " << base_step_size << endl
@@ -1008,19 +1141,6 @@ gc_extrap(const int argc, const char **argv) {
       cerr << endl;
     }
 
-    // catch if all reads are distinct
-    if (orig_max_terms < MIN_REQUIRED_COUNTS)
-      throw SMITHLABException("max count before zero is les than min required "
-                              "count (4), sample not sufficiently deep or "
-                              "duplicates removed");
-
-    // check to make sure library is not overly saturated
-    const double two_fold_extrap = GoodToulmin2xExtrap(coverage_hist);
-    if(two_fold_extrap < 0.0)
-      throw SMITHLABException("Library expected to saturate in doubling of "
-                              "experiment size, unable to extrapolate");
-
-
     /////////////////////////////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////
     /////////////////////////////////////////////////////////////////////
@@ -1028,66 +1148,51 @@ gc_extrap(const int argc, const char **argv) {
 
     if(VERBOSE)
       cerr << "[ESTIMATING COVERAGE CURVE]" << endl;
-    vector<double> coverage_estimates;
-
 
+    // the curve is extrapolated in bins
+    ExtrapOptions options;
+    options.max_terms = orig_max_terms;
+    options.max_extrapolation = max_extrapolation/bin_size;
+    options.step_size = bin_step_size;
+    options.bootstraps = bootstraps;
+    options.diagonal = diagonal;
+    options.c_level = c_level;
+    options.seed = seed;
+    options.DEFECTS = DEFECTS;
+    options.SINGLE_ESTIMATE = SINGLE_ESTIMATE;
+    options.checkpoint_file = checkpoint_file;
+    options.checkpoint_every = checkpoint_every;
+    options.RESUME = RESUME;
+    options.stats = stats.get();
+
+    ExtrapCurve curve;
+    extrap_curve(VERBOSE, coverage_hist, options, curve);
+
+    PhaseTimer output_timer(stats.get(), "output");
     if (SINGLE_ESTIMATE) {
+      BufferedOutput out(outfile);
       
-      bool SINGLE_ESTIMATE_SUCCESS =
-        extrap_single_estimate(VERBOSE, DEFECTS, coverage_hist, orig_max_terms, diagonal,
-                               bin_step_size, max_extrapolation/bin_size,
-                               coverage_estimates);
+      out << "TOTAL_BASES\tEXPECTED_DISTINCT" << '\n';
       
+      out.set_fixed_precision(1);
       
-      // IF FAILURE, EXIT
-      if (!SINGLE_ESTIMATE_SUCCESS)
-        throw SMITHLABException("SINGLE ESTIMATE FAILED, NEED TO RUN IN "
-                                "FULL MODE FOR ESTIMATES");
-      
-      std::ofstream of;
-      if (!outfile.empty()) of.open(outfile.c_str());
-      std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
-      
-      out << "TOTAL_BASES\tEXPECTED_DISTINCT" << endl;
-      
-      out.setf(std::ios_base::fixed, std::ios_base::floatfield);
-      out.precision(1);
-      
-      out << 0 << '\t' << 0 << endl;
-      for (size_t i = 0; i < coverage_estimates.size(); ++i)
+      out << 0 << '\t' << 0 << '\n';
+      for (size_t i = 0; i < curve.estimates.size(); ++i)
         out << (i + 1)*base_step_size << '\t'
-            << coverage_estimates[i]*bin_size << endl;
+            << curve.estimates[i]*bin_size << '\n';
+      out.close();
     }
     else {
-      
-      if (VERBOSE)
-        cerr << "[BOOTSTRAPPING HISTOGRAM]" << endl;
-      
-      const size_t max_iter = 10*bootstraps;
-      
-      vector<vector <double> > bootstrap_estimates;
-      extrap_bootstrap(VERBOSE, DEFECTS, seed, coverage_hist, bootstraps, orig_max_terms,
-                       diagonal, bin_step_size, max_extrapolation/bin_size,
-                       max_iter, bootstrap_estimates);
-      
-      
-      /////////////////////////////////////////////////////////////////////
-      if (VERBOSE)
-        cerr << "[COMPUTING CONFIDENCE INTERVALS]" << endl;
-      
-      vector<double> coverage_upper_ci_lognormal, coverage_lower_ci_lognormal;
-      vector_median_and_ci(bootstrap_estimates, c_level, 
-                           coverage_estimates, coverage_lower_ci_lognormal, 
-                           coverage_upper_ci_lognormal);
-      
-      /////////////////////////////////////////////////////////////////////
       if (VERBOSE)
         cerr << "[WRITING OUTPUT]" << endl;
       write_predicted_coverage_curve(outfile, c_level, base_step_size,
-                                     bin_size, coverage_estimates,
-                                     coverage_lower_ci_lognormal,
-                                     coverage_upper_ci_lognormal);
+                                     bin_size, curve.estimates,
+                                     curve.lower_ci, curve.upper_ci);
     }
+    output_timer.stop();
+
+    if (stats)
+      write_run_stats(stats_file, n_reads, coverage_hist, *stats);
   }
   catch (SMITHLABException &e) {
     cerr << "ERROR:\t" << e.what() << endl;
@@ -1125,10 +1230,14 @@ c_curve(const int argc, const char **argv) {
 
     size_t upper_limit = 0;
     double step_size = 1e6;
+    size_t n_threads = 1;
+    string stats_file;
   
 #ifdef HAVE_SAMTOOLS
     bool BAM_FORMAT_INPUT = false;
     size_t MAX_SEGMENT_LENGTH = 5000;
+    size_t max_mem = 0;
+    bool NAME_SORTED = false;
 #endif
 
     /********** GET COMMAND LINE ARGUMENTS  FOR C_CURVE ***********/
@@ -1149,6 +1258,9 @@ c_curve(const int argc, const char **argv) {
     opt_parse.add_opt("vals", 'V',
                       "input is a text file containing only the observed counts",
                       false, VALS_INPUT);
+    opt_parse.add_opt("threads", 'T', "number of threads for parsing sorted "
+                      "BED or --vals input (default: " + toa(n_threads) + ")",
+                      false, n_threads);
 #ifdef HAVE_SAMTOOLS
     opt_parse.add_opt("bam", 'B', "input is in BAM format",
                       false, BAM_FORMAT_INPUT);
@@ -1156,9 +1268,18 @@ c_curve(const int argc, const char **argv) {
                       "paired end bam reads (default: "
                       + toa(MAX_SEGMENT_LENGTH) + ")",
                       false, MAX_SEGMENT_LENGTH);
+    opt_parse.add_opt("max-mem", 'm', "megabytes for pairing paired end "
+                      "bam reads, spilling to temporary files beyond "
+                      "(default: no limit, 1024 with -N)", false, max_mem);
+    opt_parse.add_opt("name-sorted", 'N', "paired end bam input is sorted "
+                      "by name or collated, mates next to each other",
+                      false, NAME_SORTED);
 #endif
     opt_parse.add_opt("seed", 'r', "seed for random number generator",
 		      false, seed);
+    opt_parse.add_opt("stats-json", 'j', "write the time of each phase, "
+                      "counters and peak memory as JSON to this file",
+                      false, stats_file);
 
   
     vector<string> leftover_args;
@@ -1181,6 +1302,12 @@ c_curve(const int argc, const char **argv) {
     }
     const string input_file_name = leftover_args.front();
     /******************************************************************/
+
+#ifdef HAVE_SAMTOOLS
+    if (NAME_SORTED && !(BAM_FORMAT_INPUT && PAIRED_END))
+      throw SMITHLABException("--name-sorted is for paired end bam input, "
+                              "given with -B and -P");
+#endif
   
     if(seed == 0){
       seed = rand();
@@ -1188,13 +1315,16 @@ c_curve(const int argc, const char **argv) {
     // Setup the random number generator
     gsl_rng_env_setup();
     gsl_rng *rng = gsl_rng_alloc(gsl_rng_default); // use default type
-    srand(time(0) + getpid()); //give the random fxn a new seed
     gsl_rng_set(rng, seed); //initialize random number generator with the seed
 
+    std::unique_ptr<RunStats> stats =
+      start_run_stats(stats_file, "c_curve", input_file_name);
+
     vector<double> counts_hist;
     size_t n_reads = 0;
 
     // LOAD VALUES
+    PhaseTimer load_timer(stats.get(), "load");
     if(HIST_INPUT){
       if(VERBOSE)
         cerr << "INPUT_HIST" << endl;
@@ -1203,9 +1333,24 @@ c_curve(const int argc, const char **argv) {
     else if (VALS_INPUT) {
       if (VERBOSE)
         cerr << "VALS_INPUT" << endl;
-      n_reads = load_counts(input_file_name, counts_hist);
+      n_reads = load_counts(VERBOSE, input_file_name, n_threads,
+                            counts_hist, stats.get());
     }
 #ifdef HAVE_SAMTOOLS
+    else if (BAM_FORMAT_INPUT && PAIRED_END && NAME_SORTED) {
+      if (VERBOSE)
+        cerr << "NAME_SORTED_PAIRED_END_BAM_INPUT" << endl;
+      size_t n_paired = 0;
+      size_t n_mates = 0;
+      n_reads = load_counts_BAM_pe_name_sorted(VERBOSE, input_file_name,
+                                               MAX_SEGMENT_LENGTH,
+                                               max_mem*bytes_per_megabyte,
+                                               n_paired, n_mates,
+                                               counts_hist, stats.get());
+      if (VERBOSE)
+        cerr << "MERGED PAIRED END READS = " << n_paired << endl
+             << "MATES PROCESSED = " << n_mates << endl;
+    }
     else if (BAM_FORMAT_INPUT && PAIRED_END){
       if(VERBOSE)
         cerr << "PAIRED_END_BAM_INPUT" << endl;
@@ -1214,7 +1359,9 @@ c_curve(const int argc, const char **argv) {
       size_t n_mates = 0;
       n_reads = load_counts_BAM_pe(VERBOSE, input_file_name, 
                                    MAX_SEGMENT_LENGTH, MAX_READS_TO_HOLD, 
-                                   n_paired, n_mates, counts_hist);
+                                   max_mem*bytes_per_megabyte,
+                                   n_paired, n_mates, counts_hist, NULL,
+                                   stats.get());
       if (VERBOSE)
         cerr << "MERGED PAIRED END READS = " << n_paired << endl
              << "MATES PROCESSED = " << n_mates << endl;
@@ -1223,31 +1370,29 @@ c_curve(const int argc, const char **argv) {
     else if (BAM_FORMAT_INPUT) {
       if (VERBOSE)
         cerr << "BAM_INPUT" << endl;
-      n_reads = load_counts_BAM_se(input_file_name, counts_hist);
+      n_reads = load_counts_BAM_se(input_file_name, counts_hist, NULL,
+                                   stats.get());
     }
 #endif
     else if (PAIRED_END) {
       if (VERBOSE)
         cerr << "PAIRED_END_BED_INPUT" << endl;
-      n_reads = load_counts_BED_pe(input_file_name, counts_hist);
+      n_reads = load_counts_BED_pe(input_file_name, n_threads, counts_hist,
+                                   NULL, stats.get());
     }
     else { // default is single end bed file
       if (VERBOSE)
         cerr << "BED_INPUT" << endl;
-      n_reads = load_counts_BED_se(input_file_name, counts_hist);
+      n_reads = load_counts_BED_se(input_file_name, n_threads, counts_hist,
+                                   NULL, stats.get());
     }
+    load_timer.stop();
   
     const size_t max_observed_count = counts_hist.size() - 1;
-    const double distinct_reads = accumulate(counts_hist.begin(),
-                                             counts_hist.end(), 0.0);
-  
-    size_t total_reads = 0;
-    for(size_t i = 0; i < counts_hist.size(); i++)
-      total_reads += i*counts_hist[i];
-  
-    const size_t distinct_counts =
-      static_cast<size_t>(std::count_if(counts_hist.begin(), counts_hist.end(),
-                                        bind2nd(std::greater<double>(), 0.0)));
+    const HistogramSummary summary = summarize_histogram(counts_hist);
+    const double distinct_reads = summary.distinct;
+    const size_t total_reads = static_cast<size_t>(summary.total);
+    const size_t distinct_counts = summary.distinct_counts;
 
     if (VERBOSE)
       cerr << "TOTAL READS     = " << n_reads << endl
@@ -1270,21 +1415,26 @@ c_curve(const int argc, const char **argv) {
     if (upper_limit == 0)
       upper_limit = n_reads; //set upper limit to equal the number of molecules
 
+    vector<size_t> sample_sizes;
+    vector<double> expected_distinct;
+    PhaseTimer interpolation_timer(stats.get(), "interpolation");
+    interpolate_curve(counts_hist, step_size, upper_limit, sample_sizes,
+                      expected_distinct);
+    interpolation_timer.stop();
+
+    if (VERBOSE)
+      for (size_t i = 0; i < sample_sizes.size(); ++i)
+        cerr << "sample size: " << sample_sizes[i] << endl;
+
     //handles output of c_curve
-    std::ofstream of;
-    if (!outfile.empty()) of.open(outfile.c_str());
-    std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
-
-    //prints the complexity curve
-    out << "total_reads" << "\t" << "distinct_reads" << endl;
-    out << 0 << '\t' << 0 << endl;
-    for (size_t i = step_size; i <= upper_limit; i += step_size) {
-      if (VERBOSE)
-        cerr << "sample size: " << i << endl;
-      out << i << "\t" 
-		  << interpolate_distinct(counts_hist, total_reads, distinct_reads, i) 
-		  << endl;
-    }
+    PhaseTimer output_timer(stats.get(), "output");
+    BufferedOutput out(outfile);
+    write_interpolated_curve(out, sample_sizes, expected_distinct);
+    out.close();
+    output_timer.stop();
+
+    if (stats)
+      write_run_stats(stats_file, n_reads, counts_hist, *stats);
   }
   catch (SMITHLABException &e) {
     cerr << "ERROR:\t" << e.what() << endl;
@@ -1318,10 +1468,14 @@ bound_pop(const int argc, const char **argv) {
 #ifdef HAVE_SAMTOOLS
     bool BAM_FORMAT_INPUT = false;
     size_t MAX_SEGMENT_LENGTH = 5000;
+    size_t max_mem = 0;
+    bool NAME_SORTED = false;
 #endif
 
     size_t max_num_points = 10;
     double tolerance = 1e-20;
+    size_t n_threads = 1;
+    string stats_file;
     size_t bootstraps = 500;
     double c_level = 0.95;
     size_t max_iter = 100;
@@ -1354,6 +1508,9 @@ bound_pop(const int argc, const char **argv) {
     opt_parse.add_opt("vals", 'V',
                       "input is a text file containing only the observed duplicate counts",
                       false, VALS_INPUT);
+    opt_parse.add_opt("threads", 'T', "number of threads for parsing sorted "
+                      "BED or --vals input (default: " + toa(n_threads) + ")",
+                      false, n_threads);
 #ifdef HAVE_SAMTOOLS
     opt_parse.add_opt("bam", 'B', "input is in BAM format",
                       false, BAM_FORMAT_INPUT);
@@ -1361,11 +1518,20 @@ bound_pop(const int argc, const char **argv) {
                       "paired end bam reads (default: "
                       + toa(MAX_SEGMENT_LENGTH) + ")",
                       false, MAX_SEGMENT_LENGTH);
+    opt_parse.add_opt("max-mem", 'm', "megabytes for pairing paired end "
+                      "bam reads, spilling to temporary files beyond "
+                      "(default: no limit, 1024 with -N)", false, max_mem);
+    opt_parse.add_opt("name-sorted", 'N', "paired end bam input is sorted "
+                      "by name or collated, mates next to each other",
+                      false, NAME_SORTED);
 #endif
     opt_parse.add_opt("quick", 'Q', "quick mode, estimate without bootstrapping",
 		      false, QUICK_MODE);
     opt_parse.add_opt("seed", 'r', "seed for random number generator",
 		      false, seed);
+    opt_parse.add_opt("stats-json", 'j', "write the time of each phase, "
+                      "counters and peak memory as JSON to this file",
+                      false, stats_file);
 
 
     vector<string> leftover_args;
@@ -1389,10 +1555,20 @@ bound_pop(const int argc, const char **argv) {
     const string input_file_name = leftover_args.front();
     // ****************************************************************
 
+#ifdef HAVE_SAMTOOLS
+    if (NAME_SORTED && !(BAM_FORMAT_INPUT && PAIRED_END))
+      throw SMITHLABException("--name-sorted is for paired end bam input, "
+                              "given with -B and -P");
+#endif
+
+    std::unique_ptr<RunStats> stats =
+      start_run_stats(stats_file, "bound_pop", input_file_name);
+
     vector<double> counts_hist;
     size_t n_obs = 0;
 
     // LOAD VALUES
+    PhaseTimer load_timer(stats.get(), "load");
     if(HIST_INPUT){
       if(VERBOSE)
         cerr << "HIST_INPUT" << endl;
@@ -1401,9 +1577,24 @@ bound_pop(const int argc, const char **argv) {
     else if(VALS_INPUT){
       if(VERBOSE)
         cerr << "VALS_INPUT" << endl;
-      n_obs = load_counts(input_file_name, counts_hist);
+      n_obs = load_counts(VERBOSE, input_file_name, n_threads, counts_hist,
+                          stats.get());
     }
 #ifdef HAVE_SAMTOOLS
+    else if (BAM_FORMAT_INPUT && PAIRED_END && NAME_SORTED) {
+      if (VERBOSE)
+        cerr << "NAME_SORTED_PAIRED_END_BAM_INPUT" << endl;
+      size_t n_paired = 0;
+      size_t n_mates = 0;
+      n_obs = load_counts_BAM_pe_name_sorted(VERBOSE, input_file_name,
+                                             MAX_SEGMENT_LENGTH,
+                                             max_mem*bytes_per_megabyte,
+                                             n_paired, n_mates,
+                                             counts_hist, stats.get());
+      if (VERBOSE)
+        cerr << "MERGED PAIRED END READS = " << n_paired << endl
+             << "MATES PROCESSED = " << n_mates << endl;
+    }
     else if (BAM_FORMAT_INPUT && PAIRED_END){
       if(VERBOSE)
         cerr << "PAIRED_END_BAM_INPUT" << endl;
@@ -1412,8 +1603,9 @@ bound_pop(const int argc, const char **argv) {
       size_t n_mates = 0;
       n_obs = load_counts_BAM_pe(VERBOSE, input_file_name, 
                                    MAX_SEGMENT_LENGTH, 
-                                   MAX_READS_TO_HOLD, n_paired, 
-                                   n_mates, counts_hist);
+                                   MAX_READS_TO_HOLD,
+                                   max_mem*bytes_per_megabyte, n_paired, 
+                                   n_mates, counts_hist, NULL, stats.get());
       if(VERBOSE){
         cerr << "MERGED PAIRED END READS = " << n_paired << endl;
         cerr << "MATES PROCESSED = " << n_mates << endl;
@@ -1422,39 +1614,27 @@ bound_pop(const int argc, const char **argv) {
     else if(BAM_FORMAT_INPUT){
       if(VERBOSE)
         cerr << "BAM_INPUT" << endl;
-      n_obs = load_counts_BAM_se(input_file_name, counts_hist);
+      n_obs = load_counts_BAM_se(input_file_name, counts_hist, NULL,
+                                 stats.get());
     }
 #endif
     else if(PAIRED_END){
       if(VERBOSE)
         cerr << "PAIRED_END_BED_INPUT" << endl;
-      n_obs = load_counts_BED_pe(input_file_name, counts_hist);
+      n_obs = load_counts_BED_pe(input_file_name, n_threads, counts_hist,
+                                 NULL, stats.get());
     }
     else{ // default is single end bed file
       if(VERBOSE)
         cerr << "BED_INPUT" << endl;
-      n_obs = load_counts_BED_se(input_file_name, counts_hist);
+      n_obs = load_counts_BED_se(input_file_name, n_threads, counts_hist,
+                                 NULL, stats.get());
     }
+    load_timer.stop();
 
-    const double distinct_obs = accumulate(counts_hist.begin(), 
-					   counts_hist.end(), 0.0);
+    const double distinct_obs = summarize_histogram(counts_hist).distinct;
 
 
-    vector<double> measure_moments;
-    // mu_r = (r + 1)! n_{r+1} / n_1
-    size_t indx = 1;
-    while(counts_hist[indx] > 0  && indx <= counts_hist.size()){
-      measure_moments.push_back(exp(gsl_sf_lnfact(indx)
-				    + log(counts_hist[indx])
-				    - log(counts_hist[1])));
-      if(!std::isfinite(measure_moments.back())){
-	measure_moments.pop_back();
-	break;
-      }
-      indx++;
-    }
-    
-
     if (VERBOSE){
       cerr << "TOTAL OBSERVATIONS     = " << n_obs << endl
            << "DISTINCT OBSERVATIONS  = " << distinct_obs << endl
@@ -1465,236 +1645,452 @@ bound_pop(const int argc, const char **argv) {
       for (size_t i = 0; i < counts_hist.size(); i++)
 	if (counts_hist[i] > 0)
 	  cerr << i << '\t' << setprecision(16) << counts_hist[i] << endl;
+    }
 
-      cerr << "OBSERVED MOMENTS" << endl;
-      for(size_t i = 0; i < measure_moments.size(); i++)
-	cerr << std::setprecision(16) << measure_moments[i] << endl;  
+    if(seed == 0){
+      seed = rand();
     }
 
+    BoundPopOptions options;
+    options.max_num_points = max_num_points;
+    options.tolerance = tolerance;
+    options.bootstraps = bootstraps;
+    options.c_level = c_level;
+    options.max_iter = max_iter;
+    options.seed = seed;
+    options.QUICK_MODE = QUICK_MODE;
+    options.stats = stats.get();
+
+    BoundPopEstimate estimate;
+    bound_pop_estimate(VERBOSE, counts_hist, options, estimate);
+
+    PhaseTimer output_timer(stats.get(), "output");
+    BufferedOutput out(outfile);
+    write_bound_pop_estimate(out, QUICK_MODE, estimate);
+    out.close();
+    output_timer.stop();
+
+    if (stats)
+      write_run_stats(stats_file, n_obs, counts_hist, *stats);
+  }
+  catch (SMITHLABException &e) {
+    cerr << "ERROR:\t" << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (std::bad_alloc &ba) {
+    cerr << "ERROR: could not allocate memory" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-    if(QUICK_MODE){
-      if(measure_moments.size() < 2*max_num_points)
-	max_num_points = static_cast<size_t>(floor(measure_moments.size()/2));
-      else
-	measure_moments.resize(2*max_num_points);
-      size_t n_points = 0;
-      n_points = ensure_pos_def_mom_seq(measure_moments, tolerance, VERBOSE);
-      if(VERBOSE)
-	cerr << "n_points = " << n_points << endl;    
 
-      MomentSequence obs_mom_seq(measure_moments);
-    
-      if(VERBOSE){
-	for(size_t k = 0; k < obs_mom_seq.alpha.size(); k++)
-	  cerr << "alpha_" << k << '\t';
-	cerr << endl;
-	for(size_t k = 0; k < obs_mom_seq.alpha.size(); k++)
-	  cerr << obs_mom_seq.alpha[k] << '\t';
-	cerr << endl;
-
-	for(size_t k = 0; k < obs_mom_seq.beta.size(); k++)
-	  cerr << "beta_" << k << '\t';
-	cerr << endl;
-	for(size_t k = 0; k < obs_mom_seq.beta.size(); k++)
-	  cerr << obs_mom_seq.beta[k] << '\t';
-	cerr << endl;
-      }
-    
-      vector<double> points, weights;
-      obs_mom_seq.Lower_quadrature_rules(VERBOSE, n_points, tolerance,
-					 max_iter, points, weights);
-
-      const double weights_sum = accumulate(weights.begin(), weights.end(), 0.0);
-      if(weights_sum != 1.0){
-	for(size_t i = 0; i < weights.size(); i++)
-	  weights[i] = weights[i]/weights_sum;
-      }
 
-      if(VERBOSE){
-	cerr << "points = " << endl;
-	for(size_t i = 0; i < points.size(); i++)
-	  cerr << points[i] << '\t';
-	cerr << endl;
-
-	cerr << "weights = " << endl;
-	for(size_t i = 0; i < weights.size(); i++)
-	  cerr << weights[i] << '\t';
-	cerr << endl;
-      }
+/////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////
+// SERVE: estimates for histograms sent over a local socket
+//
+// A client connects, sends a request and shuts down its side of the
+// connection. The request starts with a line giving the command and
+// its options as on the command line, e.g. "lc_extrap -Q -e 1e9",
+// followed by the histogram in the -H format. With -b in that line
+// the histogram is instead given as binary pairs of a count (uint64_t)
+// and the number of reads seen that many times (double), in the byte
+// order of the host. The response is a line "OK" followed by what the
+// command would write to its output file, or a line "ERROR\t<message>".
+
+static const int serve_request_timeout = 60; // seconds
+static const int serve_poll_interval = 200; // milliseconds
+static const double serve_max_reads = 1e15;
+
+// what a server gives every request: the seed of requests without -r,
+// and the limits that keep one request from exhausting its memory
+struct ServeSettings {
+  ServeSettings() : default_seed(0), max_count(10000000),
+                    max_request_bytes(256*bytes_per_megabyte),
+                    max_points(100000), max_bootstraps(1000) {}
+  unsigned long int default_seed;
+  // the largest count a request histogram may have
+  size_t max_count;
+  size_t max_request_bytes;
+  // points of a curve, and bootstraps, that one request may ask for
+  size_t max_points;
+  size_t max_bootstraps;
+};
+
+static volatile sig_atomic_t SERVE_STOP = 0;
 
-      double estimated_unobs = 0.0;
-    
-      for(size_t i = 0; i < weights.size(); i++)
-	estimated_unobs += counts_hist[1]*weights[i]/points[i];
-
-      if(estimated_unobs > 0.0)
-	estimated_unobs += distinct_obs;
-      else{
-	estimated_unobs = distinct_obs;
-	n_points = 0;
-      }
+static void
+stop_serving(int) {
+  SERVE_STOP = 1;
+}
 
-      std::ofstream of;
-      if (!outfile.empty()) of.open(outfile.c_str());
-      std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
 
-      out.setf(std::ios_base::fixed, std::ios_base::floatfield);
-      out.precision(1);
+static size_t
+read_binary_histogram(const char *data, const size_t n_bytes,
+                      const size_t max_count, vector<double> &counts_hist) {
+  const size_t pair_size = sizeof(uint64_t) + sizeof(double);
+  if (n_bytes % pair_size != 0)
+    throw SMITHLABException("binary histogram is not a whole number "
+                            "of pairs");
+  counts_hist.clear();
+  size_t n_reads = 0;
+  uint64_t prev_read_count = 0;
+  for (size_t i = 0; i < n_bytes; i += pair_size) {
+    uint64_t read_count = 0;
+    double frequency = 0.0;
+    memcpy(&read_count, data + i, sizeof(uint64_t));
+    memcpy(&frequency, data + i + sizeof(uint64_t), sizeof(double));
+    if (read_count < prev_read_count)
+      throw SMITHLABException("bad order in binary histogram at count " +
+                              toa(read_count));
+    if (max_count > 0 && read_count > max_count)
+      throw SMITHLABException("count " + toa(read_count) + " is above the "
+                              "largest accepted, " + toa(max_count));
+    counts_hist.resize(read_count + 1, 0.0);
+    counts_hist[read_count] = frequency;
+    prev_read_count = read_count;
+    n_reads += static_cast<size_t>(read_count*frequency);
+  }
+  return n_reads;
+}
 
-      out << "quadrature_estimated_unobs" << '\t' << "n_points" << endl;
-      out << estimated_unobs << '\t' << n_points << endl;
-    
-    }
-    // NOT QUICK MODE, BOOTSTRAP
-   else{
-      vector<double> quad_estimates;
 
-  //setup rng
-      if(seed == 0){
-	seed = rand();
-      }
-      srand(time(0) + getpid());
-      gsl_rng_env_setup();
-      gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
-      gsl_rng_set(rng, seed);
-
-      // hist may be sparse, to speed up bootstrapping
-      // sample only from positive entries
-      vector<size_t> counts_hist_distinct_counts;
-      vector<double> distinct_counts_hist;
-      for (size_t i = 0; i < counts_hist.size(); i++){
-	if (counts_hist[i] > 0) {
-	  counts_hist_distinct_counts.push_back(i);
-	  distinct_counts_hist.push_back(counts_hist[i]);
-	}
-      }
+static void
+parse_request_options(OptionParser &opt_parse,
+                      const vector<const char *> &args) {
+  vector<string> leftover_args;
+  opt_parse.parse(args.size(), const_cast<const char **>(&args[0]),
+                  leftover_args);
+  if (opt_parse.help_requested() || !leftover_args.empty())
+    throw SMITHLABException("bad options for " + string(args.front()));
+}
 
-      for(size_t iter = 0; 
-	  iter < max_iter && quad_estimates.size() < bootstraps; 
-	  ++iter){
-	if(VERBOSE)
-	  cerr << "iter=" << "\t" << iter << endl;
-
-	vector<double> sample_hist;
-	resample_hist(rng, counts_hist_distinct_counts, 
-		      distinct_counts_hist, sample_hist);
-
-	const double sampled_distinct = accumulate(sample_hist.begin(), sample_hist.end(), 0.0);
-	// initialize moments, 0th moment is 1
-	vector<double> bootstrap_moments(1, 1.0);
-	// moments[r] = (r + 1)! n_{r+1} / n_1
-	for(size_t i = 0; i < 2*max_num_points; i++)
-	  bootstrap_moments.push_back(exp(gsl_sf_lnfact(i + 2) 
-					  + log(sample_hist[i + 2])
-					  - log(sample_hist[1])) );
-
-	size_t n_points = 0;
-	n_points = ensure_pos_def_mom_seq(bootstrap_moments, tolerance, VERBOSE);
-	n_points = std::min(n_points, max_num_points);
-	if(VERBOSE)
-	  cerr << "n_points = " << n_points << endl;    
-
-
-	MomentSequence bootstrap_mom_seq(bootstrap_moments);
-
-   	vector<double> points, weights;
-	bootstrap_mom_seq.Lower_quadrature_rules(VERBOSE, n_points, tolerance,
-						 max_iter, points, weights);
-
-	const double weights_sum = accumulate(weights.begin(), weights.end(), 0.0);
-	if(weights_sum != 1.0){
-	  for(size_t i = 0; i < weights.size(); i++)
-	    weights[i] = weights[i]/weights_sum;
-	}
-
-	double estimated_unobs = 0.0;
-    
-	for(size_t i = 0; i < weights.size(); i++)
-	  estimated_unobs += counts_hist[1]*weights[i]/points[i];
-
-	if(estimated_unobs > 0.0)
-	  estimated_unobs += sampled_distinct;
-	else{
-	  estimated_unobs = sampled_distinct;
-	  n_points = 0;
-	}
-
-	if(VERBOSE){
-	  cerr << "bootstrapped_moments=" << endl;
-	  for(size_t i = 0; i < bootstrap_moments.size(); i++)
-	    cerr << bootstrap_moments[i] << endl;
-	}
-	if(VERBOSE){
-	  for(size_t k = 0; k < bootstrap_mom_seq.alpha.size(); k++)
-	    cerr << "alpha_" << k << '\t';
-	  cerr << endl;
-	  for(size_t k = 0; k < bootstrap_mom_seq.alpha.size(); k++)
-	    cerr << bootstrap_mom_seq.alpha[k] << '\t';
-	  cerr << endl;
-
-	  for(size_t k = 0; k < bootstrap_mom_seq.beta.size(); k++)
-	    cerr << "beta_" << k << '\t';
-	  cerr << endl;
-	  for(size_t k = 0; k < bootstrap_mom_seq.beta.size(); k++)
-	    cerr << bootstrap_mom_seq.beta[k] << '\t';
-	  cerr << endl;
-	}
-	if(VERBOSE){
-	  cerr << "points=" << "\t";
-	  for(size_t i = 0; i < points.size(); i++)
-	    cerr << points[i] << "\t";
-	  cerr << endl;
-	  cerr << "weights=" << "\t";
-	  for(size_t i = 0; i < weights.size(); i++)
-	    cerr << weights[i] << "\t";
-	  cerr << endl;
-	  cerr << "estimated_unobs=" << "\t" << estimated_unobs << endl;
-	}
-
-	quad_estimates.push_back(estimated_unobs);
-      }
 
-      double median_estimate, lower_ci, upper_ci;
-      median_and_ci(quad_estimates, c_level, median_estimate,
-		    lower_ci, upper_ci);
+static size_t
+read_request_histogram(const bool BINARY, const string &payload,
+                       const ServeSettings &settings,
+                       vector<double> &counts_hist) {
+  size_t n_reads = 0;
+  if (BINARY)
+    n_reads = read_binary_histogram(payload.data(), payload.size(),
+                                    settings.max_count, counts_hist);
+  else {
+    std::istringstream in(payload);
+    n_reads = read_histogram(in, "request", counts_hist, settings.max_count);
+  }
+
+  if (counts_hist.size() < 2)
+    throw SMITHLABException("empty histogram");
+  for (size_t i = 0; i < counts_hist.size(); ++i)
+    if (!isfinite(counts_hist[i]) || counts_hist[i] < 0.0)
+      throw SMITHLABException("bad histogram entry for count " + toa(i));
+  return n_reads;
+}
+
 
-      std::ofstream of;
-      if (!outfile.empty()) of.open(outfile.c_str());
-      std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
+// a step below one read would never advance along the curve, and
+// steps and reads beyond serve_max_reads do not fit the counts of reads
+static void
+check_curve_points(const ServeSettings &settings, const double step_size,
+                   const double curve_end) {
+  if (!(step_size >= 1.0 && step_size <= serve_max_reads))
+    throw SMITHLABException("step size must be between 1 and " +
+                            toa(serve_max_reads));
+  if (!(curve_end <= serve_max_reads))
+    throw SMITHLABException("curve longer than " + toa(serve_max_reads) +
+                            " reads");
+  if (settings.max_points > 0 && !(curve_end/step_size <= settings.max_points))
+    throw SMITHLABException("more than " + toa(settings.max_points) +
+                            " points in the curve");
+}
 
-      out.setf(std::ios_base::fixed, std::ios_base::floatfield);
-      out.precision(1);
 
-      out << "median_estimated_unobs" << '\t'
-	  << "lower_ci" << '\t'
-	  << "upper_ci" << endl;
-      out << median_estimate << '\t'
-	  << lower_ci << '\t'
-	  << upper_ci << endl;
-      /*
-      double log_mean_estimate, lower_log_ci, upper_log_ci;
+static void
+check_bootstraps(const ServeSettings &settings, const size_t bootstraps) {
+  if (settings.max_bootstraps > 0 && bootstraps > settings.max_bootstraps)
+    throw SMITHLABException("more than " + toa(settings.max_bootstraps) +
+                            " bootstraps");
+}
 
-      log_mean(VERBOSE, quad_estimates, c_level, log_mean_estimate, 
-	       lower_log_ci, upper_log_ci);
 
-      std::ofstream of;
-      if (!outfile.empty()) of.open(outfile.c_str());
-      std::ostream out(outfile.empty() ? std::cout.rdbuf() : of.rdbuf());
+static void
+serve_lc_extrap(const vector<const char *> &args, const string &payload,
+                const ServeSettings &settings, BufferedOutput &out) {
+  ExtrapOptions options;
+  // zero until given, as in the commands
+  options.seed = 0;
+  bool BINARY = false;
+  OptionParser opt_parse(args.front(), "", "");
+  opt_parse.add_opt("extrap", 'e', "maximum extrapolation",
+                    false, options.max_extrapolation);
+  opt_parse.add_opt("step", 's', "step size in extrapolations",
+                    false, options.step_size);
+  opt_parse.add_opt("bootstraps", 'n', "number of bootstraps",
+                    false, options.bootstraps);
+  opt_parse.add_opt("cval", 'c', "level for confidence intervals",
+                    false, options.c_level);
+  opt_parse.add_opt("terms", 'x', "maximum number of terms",
+                    false, options.max_terms);
+  opt_parse.add_opt("quick", 'Q', "quick mode", false,
+                    options.SINGLE_ESTIMATE);
+  opt_parse.add_opt("defects", 'D', "defects mode", false, options.DEFECTS);
+  opt_parse.add_opt("seed", 'r', "seed for random number generator",
+                    false, options.seed);
+  opt_parse.add_opt("binary", 'b', "binary histogram", false, BINARY);
+
+  parse_request_options(opt_parse, args);
+  if (!options.SINGLE_ESTIMATE)
+    check_bootstraps(settings, options.bootstraps);
+  vector<double> counts_hist;
+  const size_t n_reads =
+    read_request_histogram(BINARY, payload, settings, counts_hist);
+  // the curve is interpolated up to the reads, then extrapolated
+  check_curve_points(settings, options.step_size,
+                     std::max(static_cast<double>(n_reads),
+                              options.max_extrapolation));
+  if (options.seed == 0)
+    options.seed = settings.default_seed;
+
+  ExtrapCurve curve;
+  extrap_curve(false, counts_hist, options, curve);
+
+  out << "OK\n";
+  if (options.SINGLE_ESTIMATE)
+    write_predicted_yield(out, options.step_size, curve.estimates);
+  else
+    write_predicted_complexity_curve(out, options.c_level, options.step_size,
+                                     curve.estimates, curve.lower_ci,
+                                     curve.upper_ci);
+}
 
-      out.setf(std::ios_base::fixed, std::ios_base::floatfield);
-      out.precision(1);
 
-      out << "log_mean_estimated_unobs" << '\t'
-	  << "log_lower_ci" << '\t'
-	  << "log_upper_ci" << endl;
-      out << log_mean_estimate << '\t'
-	  << lower_log_ci << '\t'
-	  << upper_log_ci << endl;
-      */
+static void
+serve_c_curve(const vector<const char *> &args, const string &payload,
+              const ServeSettings &settings, BufferedOutput &out) {
+  double step_size = 1e6;
+  bool BINARY = false;
+  OptionParser opt_parse(args.front(), "", "");
+  opt_parse.add_opt("step", 's', "step size in extrapolations",
+                    false, step_size);
+  opt_parse.add_opt("binary", 'b', "binary histogram", false, BINARY);
+
+  parse_request_options(opt_parse, args);
+  vector<double> counts_hist;
+  const size_t n_reads =
+    read_request_histogram(BINARY, payload, settings, counts_hist);
+  check_curve_points(settings, step_size, n_reads);
+
+  vector<size_t> sample_sizes;
+  vector<double> expected_distinct;
+  interpolate_curve(counts_hist, step_size, n_reads, sample_sizes,
+                    expected_distinct);
+
+  out << "OK\n";
+  write_interpolated_curve(out, sample_sizes, expected_distinct);
+}
+
+
+static void
+serve_bound_pop(const vector<const char *> &args, const string &payload,
+                const ServeSettings &settings, BufferedOutput &out) {
+  BoundPopOptions options;
+  // zero until given, as in the commands
+  options.seed = 0;
+  bool BINARY = false;
+  OptionParser opt_parse(args.front(), "", "");
+  opt_parse.add_opt("max_num_points", 'p', "maximum number of points in "
+                    "quadrature estimates", false, options.max_num_points);
+  opt_parse.add_opt("tolerance", 't', "numerical tolerance",
+                    false, options.tolerance);
+  opt_parse.add_opt("bootstraps", 'n', "number of bootstraps",
+                    false, options.bootstraps);
+  opt_parse.add_opt("clevel", 'c', "level for confidence intervals",
+                    false, options.c_level);
+  opt_parse.add_opt("quick", 'Q', "quick mode", false, options.QUICK_MODE);
+  opt_parse.add_opt("seed", 'r', "seed for random number generator",
+                    false, options.seed);
+  opt_parse.add_opt("binary", 'b', "binary histogram", false, BINARY);
+
+  parse_request_options(opt_parse, args);
+  if (!options.QUICK_MODE)
+    check_bootstraps(settings, options.bootstraps);
+  vector<double> counts_hist;
+  read_request_histogram(BINARY, payload, settings, counts_hist);
+  if (options.seed == 0)
+    options.seed = settings.default_seed;
+
+  BoundPopEstimate estimate;
+  bound_pop_estimate(false, counts_hist, options, estimate);
+
+  out << "OK\n";
+  write_bound_pop_estimate(out, options.QUICK_MODE, estimate);
+}
+
+
+// writes the response to request into out; throws if there is no
+// estimate, before anything is written
+static void
+answer_request(const ServeSettings &settings, const string &request,
+               string &header, BufferedOutput &out) {
+  const size_t header_end = std::min(request.find('\n'), request.size());
+  header = request.substr(0, header_end);
+  const string payload = request.substr(std::min(header_end + 1,
+                                                 request.size()));
+
+  vector<string> tokens;
+  std::istringstream header_in(header);
+  string token;
+  while (header_in >> token)
+    tokens.push_back(token);
+  if (tokens.empty())
+    throw SMITHLABException("no command in request");
+
+  vector<const char *> args;
+  for (size_t i = 0; i < tokens.size(); ++i)
+    args.push_back(tokens[i].c_str());
+
+  if (tokens.front() == "lc_extrap")
+    serve_lc_extrap(args, payload, settings, out);
+  else if (tokens.front() == "c_curve")
+    serve_c_curve(args, payload, settings, out);
+  else if (tokens.front() == "bound_pop")
+    serve_bound_pop(args, payload, settings, out);
+  else throw SMITHLABException("unrecognized command: " + tokens.front());
+}
+
+
+static void
+answer_connection(const bool VERBOSE, const ServeSettings &settings,
+                  const int fd, std::mutex &log_mtx) {
+  const std::chrono::steady_clock::time_point start_time =
+    std::chrono::steady_clock::now();
+  string header;
+  string status = "OK";
+  try {
+    set_receive_timeout(fd, serve_request_timeout);
+    BufferedOutput out(fd, "socket");
+    try {
+      // inside, so that a request too large is answered with its error
+      string request;
+      read_until_eof(fd, request, settings.max_request_bytes);
+      answer_request(settings, request, header, out);
+    }
+    catch (SMITHLABException &e) {
+      status = e.what();
+    }
+    catch (std::bad_alloc &ba) {
+      status = "could not allocate memory";
+    }
+    catch (std::exception &e) {
+      status = e.what();
+    }
+    if (status != "OK") {
+      std::replace(status.begin(), status.end(), '\n', ' ');
+      out << "ERROR\t" << status << '\n';
+    }
+    out.close();
+  }
+  catch (SMITHLABException &e) {
+    status = e.what();
+  }
+  close(fd);
+
+  if (VERBOSE) {
+    const double milliseconds = 1000.0*std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_time).count();
+    std::lock_guard<std::mutex> lock(log_mtx);
+    cerr << "REQUEST\t" << header << '\t' << status << '\t'
+         << milliseconds << " ms" << endl;
+  }
+}
+
+
+static int
+serve(const int argc, const char **argv) {
+
+  try {
+    string socket_path;
+    size_t n_threads = 1;
+    ServeSettings settings;
+    size_t max_request = settings.max_request_bytes/bytes_per_megabyte;
+    bool VERBOSE = false;
+
+    /********** GET COMMAND LINE ARGUMENTS  FOR SERVE ***********/
+    OptionParser opt_parse(strip_path(argv[1]),
+                           "answer lc_extrap, c_curve and bound_pop "
+                           "requests for histograms sent to a socket", "");
+    opt_parse.add_opt("socket", 'S', "path of the unix socket to listen on",
+                      true, socket_path);
+    opt_parse.add_opt("threads", 'T', "number of requests answered at once "
+                      "(default: " + toa(n_threads) + ")",
+                      false, n_threads);
+    opt_parse.add_opt("max-count", 'x', "largest count accepted in a "
+                      "histogram (default: " + toa(settings.max_count) + ")",
+                      false, settings.max_count);
+    opt_parse.add_opt("max-request", 'L', "megabytes accepted in a request "
+                      "(default: " + toa(max_request) + ")",
+                      false, max_request);
+    opt_parse.add_opt("max-points", 'p', "points accepted in a curve "
+                      "(default: " + toa(settings.max_points) + ")",
+                      false, settings.max_points);
+    opt_parse.add_opt("max-bootstraps", 'n', "bootstraps accepted in a "
+                      "request (default: " + toa(settings.max_bootstraps) +
+                      ")", false, settings.max_bootstraps);
+    opt_parse.add_opt("verbose", 'v', "report every request",
+                      false, VERBOSE);
+
+    vector<string> leftover_args;
+    opt_parse.parse(argc-1, argv+1, leftover_args);
+    if (argc == 2 || opt_parse.help_requested()) {
+      cerr << opt_parse.help_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.about_requested()) {
+      cerr << opt_parse.about_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.option_missing()) {
+      cerr << opt_parse.option_missing_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    /******************************************************************/
 
-   }
+    // requests without a seed get the one the commands would use
+    settings.default_seed = rand();
+    settings.max_request_bytes = max_request*bytes_per_megabyte;
 
+    signal(SIGINT, stop_serving);
+    signal(SIGTERM, stop_serving);
+    // a client that leaves early must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
 
+    const int listen_fd = listen_local_socket(socket_path);
+    if (VERBOSE)
+      cerr << "SERVING ON      = " << socket_path << endl
+           << "THREADS         = " << n_threads << endl
+           << "MAX COUNT       = " << settings.max_count << endl
+           << "MAX REQUEST     = " << settings.max_request_bytes << endl
+           << "MAX POINTS      = " << settings.max_points << endl
+           << "MAX BOOTSTRAPS  = " << settings.max_bootstraps << endl;
+
+    {
+      WorkStealingPool pool(n_threads);
+      std::mutex log_mtx;
+      while (!SERVE_STOP) {
+        const int fd = accept_local_connection(listen_fd,
+                                               serve_poll_interval);
+        if (fd >= 0)
+          pool.submit([VERBOSE, settings, fd, &log_mtx] {
+              answer_connection(VERBOSE, settings, fd, log_mtx);
+            });
+      }
+      pool.wait();
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    if (VERBOSE)
+      cerr << "STOPPED" << endl;
   }
   catch (SMITHLABException &e) {
     cerr << "ERROR:\t" << e.what() << endl;
@@ -1708,6 +2104,107 @@ bound_pop(const int argc, const char **argv) {
 }
 
 
+// a client for serve: sends the histogram in a file with the command
+// and options in request, and writes the estimates as the command would
+static int
+query(const int argc, const char **argv) {
+
+  try {
+    string socket_path;
+    string request = "lc_extrap";
+    string outfile;
+
+    /********** GET COMMAND LINE ARGUMENTS  FOR QUERY ***********/
+    OptionParser opt_parse(strip_path(argv[1]),
+                           "send a histogram to preseq serve",
+                           "<histogram-file>");
+    opt_parse.add_opt("socket", 'S', "path of the socket preseq serve "
+                      "listens on", true, socket_path);
+    opt_parse.add_opt("request", 'q', "command and options, in quotes "
+                      "(default: " + request + ")", false, request);
+    opt_parse.add_opt("output", 'o', "output file (default: stdout)",
+                      false, outfile);
+
+    vector<string> leftover_args;
+    opt_parse.parse(argc-1, argv+1, leftover_args);
+    if (argc == 2 || opt_parse.help_requested()) {
+      cerr << opt_parse.help_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.about_requested()) {
+      cerr << opt_parse.about_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.option_missing()) {
+      cerr << opt_parse.option_missing_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (leftover_args.empty()) {
+      cerr << opt_parse.help_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    const string input_file_name = leftover_args.front();
+    /******************************************************************/
+
+    std::ostringstream histogram;
+    if (is_standard_input(input_file_name))
+      histogram << std::cin.rdbuf();
+    else {
+      ifstream in(input_file_name.c_str(), std::ios::binary);
+      if (!in)
+        throw SMITHLABException("could not open histogram: " +
+                                input_file_name);
+      histogram << in.rdbuf();
+    }
+    const string message = request + '\n' + histogram.str();
+
+    // the server stops reading a request it refuses, and its answer
+    // says why better than the failed write would
+    signal(SIGPIPE, SIG_IGN);
+
+    string response;
+    const int fd = connect_local_socket(socket_path);
+    try {
+      try {
+        write_all(fd, message.data(), message.size());
+        shutdown_writing(fd);
+      }
+      catch (SMITHLABException &e) {
+        read_until_eof(fd, response);
+        if (response.empty())
+          throw;
+      }
+      if (response.empty())
+        read_until_eof(fd, response);
+    }
+    catch (SMITHLABException &e) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+
+    const size_t status_end = std::min(response.find('\n'), response.size());
+    const string status = response.substr(0, status_end);
+    if (status != "OK")
+      throw SMITHLABException(status.compare(0, 6, "ERROR\t") == 0 ?
+                              status.substr(6) : "bad response: " + status);
+
+    BufferedOutput out(outfile);
+    out.write(response.data() + status_end + 1,
+              response.size() - status_end - 1);
+    out.close();
+  }
+  catch (SMITHLABException &e) {
+    cerr << "ERROR:\t" << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (std::bad_alloc &ba) {
+    cerr << "ERROR: could not allocate memory" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
 
 int
 main(const int argc, const char **argv) {
@@ -1721,8 +2218,19 @@ main(const int argc, const char **argv) {
                   "           gc_extrap  predict genome coverage low input\n"
                   "                      sequencing experiments\n"
 		  "           bound_pop  lower bound on population size\n"
+                  "           serve      answer requests for estimates on a\n"
+                  "                      local socket\n"
+                  "           query      send a histogram to serve\n"
                   );
   
+  // only the C++ streams read the standard input, so skip syncing them
+  // with stdio; this must come before any input or output
+  std::ios_base::sync_with_stdio(false);
+
+  // the estimators use generators of type gsl_rng_default, which can
+  // be set through GSL_RNG_TYPE
+  gsl_rng_env_setup();
+
   if (argc < 2)
     cerr << USAGE_MESSAGE << endl;
 
@@ -1745,6 +2253,16 @@ main(const int argc, const char **argv) {
 
     return bound_pop(argc, argv);
   
+  }
+  else if (strcmp(argv[1], "serve") == 0) {
+
+    return serve(argc, argv);
+
+  }
+  else if (strcmp(argv[1], "query") == 0) {
+
+    return query(argc, argv);
+
   }
   else {
     cerr << "unrecognized command: " << argv[1] << endl
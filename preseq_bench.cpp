@@ -0,0 +1,403 @@
+/*    preseq_bench: timings of the preseq loaders and estimators
+ *
+ *    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <limits>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_sf_gamma.h>
+
+#include "OptionParser.hpp"
+#include "smithlab_utils.hpp"
+#include "smithlab_os.hpp"
+
+#include "complexity_estimates.hpp"
+#include "continued_fraction.hpp"
+#include "moment_sequence.hpp"
+#include "load_data_for_complexity.hpp"
+#include "buffered_output.hpp"
+#include "run_stats.hpp"
+
+using std::string;
+using std::vector;
+using std::cerr;
+using std::endl;
+using std::function;
+
+// Each benchmark calls a function in runs of calls_per_run calls,
+// with enough calls in a run for it to take at least min_run_seconds,
+// and reports the fastest and the median run as seconds per call. The
+// function returns the items it handled, reads for the loaders, so
+// that rates can be compared across inputs of different sizes.
+
+struct BenchResult {
+  string name;
+  string input;
+  size_t runs;
+  size_t calls_per_run;
+  double min_seconds;
+  double median_seconds;
+  double items_per_call;
+};
+
+// results of the timed kernels go here so they are not optimized away
+static volatile double bench_sink = 0.0;
+
+static double
+seconds_since(const std::chrono::steady_clock::time_point &start) {
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+
+static void
+run_benchmark(const bool VERBOSE, const string &name, const string &input,
+              const size_t runs, const double min_run_seconds,
+              const function<size_t()> &f, vector<BenchResult> &results) {
+  BenchResult result;
+  result.name = name;
+  result.input = input;
+  result.runs = runs;
+
+  // the first call warms up caches and sets the calls per run
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  result.items_per_call = f();
+  const double first_call = seconds_since(start);
+  result.calls_per_run = (first_call >= min_run_seconds) ? 1 :
+    static_cast<size_t>(std::min(1e9, ceil(min_run_seconds/
+                                           std::max(first_call, 1e-9))));
+
+  vector<double> seconds;
+  for (size_t i = 0; i < runs; ++i) {
+    start = std::chrono::steady_clock::now();
+    for (size_t j = 0; j < result.calls_per_run; ++j)
+      f();
+    seconds.push_back(seconds_since(start)/result.calls_per_run);
+  }
+  std::sort(seconds.begin(), seconds.end());
+  result.min_seconds = seconds.front();
+  result.median_seconds = (runs % 2 == 1) ? seconds[runs/2] :
+    (seconds[runs/2 - 1] + seconds[runs/2])/2.0;
+
+  if (VERBOSE)
+    cerr << name << '\t' << input << '\t'
+         << result.median_seconds << " s" << endl;
+  results.push_back(result);
+}
+
+
+static void
+write_results(const string &outfile, const size_t n_threads,
+              const vector<BenchResult> &results) {
+  BufferedOutput out(outfile);
+  out << "{\n"
+      << "  \"timestamp\": " << static_cast<long long>(time(NULL)) << ",\n"
+      << "  \"threads\": " << n_threads << ",\n"
+      << "  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &r = results[i];
+    out << (i == 0 ? "\n" : ",\n")
+        << "    {\"name\": " << json_string(r.name)
+        << ", \"input\": " << json_string(r.input)
+        << ", \"runs\": " << r.runs
+        << ", \"calls_per_run\": " << r.calls_per_run
+        << ", \"min_seconds\": " << json_number(r.min_seconds)
+        << ", \"median_seconds\": " << json_number(r.median_seconds)
+        << ", \"items_per_second\": "
+        << json_number(r.items_per_call/r.median_seconds) << "}";
+  }
+  out << "\n  ]\n}\n";
+  out.close();
+}
+
+
+/////////////////////////////////////////////////////////
+// the benchmarks
+
+static void
+bench_loaders(const bool VERBOSE, const size_t runs, const size_t n_threads,
+              const string &bed_file, const string &pe_bed_file,
+              const string &bam_file, const string &pe_bam_file,
+              vector<BenchResult> &results) {
+  if (!bed_file.empty()) {
+    run_benchmark(VERBOSE, "load_counts_BED_se", bed_file, runs, 0.0, [&] {
+        vector<double> hist;
+        return load_counts_BED_se(bed_file, n_threads, hist);
+      }, results);
+    run_benchmark(VERBOSE, "load_coverage_counts_GR", bed_file, runs, 0.0,
+                  [&] {
+        vector<double> hist;
+        return load_coverage_counts_GR(bed_file, 1, n_threads, 10, 10000,
+                                       hist);
+      }, results);
+  }
+  if (!pe_bed_file.empty())
+    run_benchmark(VERBOSE, "load_counts_BED_pe", pe_bed_file, runs, 0.0, [&] {
+        vector<double> hist;
+        return load_counts_BED_pe(pe_bed_file, n_threads, hist);
+      }, results);
+#ifdef HAVE_SAMTOOLS
+  if (!bam_file.empty())
+    run_benchmark(VERBOSE, "load_counts_BAM_se", bam_file, runs, 0.0, [&] {
+        vector<double> hist;
+        return load_counts_BAM_se(bam_file, hist);
+      }, results);
+  if (!pe_bam_file.empty())
+    run_benchmark(VERBOSE, "load_counts_BAM_pe", pe_bam_file, runs, 0.0, [&] {
+        vector<double> hist;
+        size_t n_paired = 0, n_mates = 0;
+        return load_counts_BAM_pe(false, pe_bam_file, 5000, 5000000, 0,
+                                  n_paired, n_mates, hist);
+      }, results);
+#endif
+}
+
+
+static void
+bench_kernels(const bool VERBOSE, const size_t runs,
+              const double min_run_seconds, const string &input,
+              const vector<double> &hist, vector<BenchResult> &results) {
+  const HistogramSummary summary = summarize_histogram(hist);
+  const size_t N = static_cast<size_t>(summary.total);
+  const size_t S = static_cast<size_t>(summary.distinct);
+
+  run_benchmark(VERBOSE, "summarize_histogram", input, runs,
+                min_run_seconds, [&] {
+      bench_sink = summarize_histogram(hist).good_toulmin_2x;
+      return 1;
+    }, results);
+
+  run_benchmark(VERBOSE, "interpolate_distinct", input, runs,
+                min_run_seconds, [&] {
+      bench_sink = interpolate_distinct(hist, N, S, N/2);
+      return 1;
+    }, results);
+
+  const size_t max_terms = usable_max_terms(summary, 100);
+  if (max_terms < 4) {
+    cerr << "histogram of " << input << " is too short for the "
+         << "continued fraction benchmarks" << endl;
+    return;
+  }
+
+  // the power series of optimal_cont_frac_distinct; on the diagonal
+  // the constructor is quotdiff_algorithm and nothing else
+  vector<double> ps_coeffs;
+  for (size_t j = 1; j <= max_terms; ++j)
+    ps_coeffs.push_back(j % 2 == 1 ? hist[j] : -hist[j]);
+  run_benchmark(VERBOSE, "quotdiff_algorithm", input, runs,
+                min_run_seconds, [&] {
+      const ContinuedFraction cf(ps_coeffs, 0, max_terms);
+      bench_sink = cf.cf_coeffs.back();
+      return 1;
+    }, results);
+
+  const ContinuedFractionApproximation cfa(0, max_terms);
+  run_benchmark(VERBOSE, "optimal_cont_frac_distinct", input, runs,
+                min_run_seconds, [&] {
+      const ContinuedFraction cf = cfa.optimal_cont_frac_distinct(hist);
+      bench_sink = cf.degree;
+      return 1;
+    }, results);
+
+  const ContinuedFraction cf = cfa.optimal_cont_frac_distinct(hist);
+  if (cf.is_valid()) {
+    // the points extrapolate_distinct evaluates for a 10x extrapolation
+    const size_t n_points = 1000;
+    run_benchmark(VERBOSE, "ContinuedFraction::operator()", input, runs,
+                  min_run_seconds, [&] {
+        double sum = 0.0;
+        for (size_t i = 0; i < n_points; ++i)
+          sum += cf(0.01*i);
+        bench_sink = sum;
+        return n_points;
+      }, results);
+  }
+
+  // the moments of bound_pop quick mode
+  const size_t max_num_points = 10;
+  vector<double> log_moments;
+  for (size_t i = 1; i < hist.size() && hist[i] > 0 &&
+         log_moments.size() < 2*max_num_points; ++i)
+    log_moments.push_back(gsl_sf_lnfact(i) + log(hist[i]) - log(hist[1]));
+  vector<double> moments;
+  const double log_scale = scale_log_moments(log_moments, moments);
+  const size_t n_points = ensure_pos_def_mom_seq(moments, 1e-20, false,
+                                                 log_scale);
+  if (n_points > 0) {
+    const MomentSequence mom_seq(std::move(moments), log_scale);
+    run_benchmark(VERBOSE, "Lower_quadrature_rules", input, runs,
+                  min_run_seconds, [&] {
+        MomentSequence seq(mom_seq);
+        vector<double> points, weights;
+        seq.Lower_quadrature_rules(false, n_points, 1e-20, 100,
+                                   points, weights);
+        bench_sink = weights.empty() ? 0.0 : weights.front();
+        return 1;
+      }, results);
+  }
+}
+
+
+// the commands with their default options, from loading to estimates
+static void
+bench_full_runs(const bool VERBOSE, const size_t runs, const size_t n_threads,
+                const string &bed_file, vector<BenchResult> &results) {
+  run_benchmark(VERBOSE, "lc_extrap", bed_file, runs, 0.0, [&] {
+      vector<double> hist;
+      const size_t n_reads = load_counts_BED_se(bed_file, n_threads, hist);
+      ExtrapOptions options;
+      ExtrapCurve curve;
+      extrap_curve(false, hist, options, curve);
+      return n_reads;
+    }, results);
+
+  run_benchmark(VERBOSE, "gc_extrap", bed_file, runs, 0.0, [&] {
+      const size_t bin_size = 10;
+      vector<double> hist;
+      const size_t n_reads =
+        load_coverage_counts_GR(bed_file, 1, n_threads, bin_size, 10000, hist);
+      ExtrapOptions options;
+      options.max_extrapolation = 1.0e12/bin_size;
+      options.step_size = 1.0e8/bin_size;
+      ExtrapCurve curve;
+      extrap_curve(false, hist, options, curve);
+      return n_reads;
+    }, results);
+
+  run_benchmark(VERBOSE, "bound_pop", bed_file, runs, 0.0, [&] {
+      vector<double> hist;
+      const size_t n_reads = load_counts_BED_se(bed_file, n_threads, hist);
+      BoundPopOptions options;
+      BoundPopEstimate estimate;
+      bound_pop_estimate(false, hist, options, estimate);
+      return n_reads;
+    }, results);
+}
+
+
+int
+main(int argc, const char **argv) {
+  try {
+    string outfile;
+    string bed_file;
+    string pe_bed_file;
+    string bam_file;
+    string pe_bam_file;
+    string hist_file;
+    size_t runs = 5;
+    double min_run_seconds = 0.1;
+    size_t n_threads = 1;
+    bool NO_FULL_RUNS = false;
+    bool VERBOSE = false;
+
+    /****************** COMMAND LINE OPTIONS ********************/
+    OptionParser opt_parse(strip_path(argv[0]),
+                           "time the preseq loaders and estimators, "
+                           "writing the results as JSON", "");
+    opt_parse.add_opt("output", 'o', "output file (default: stdout)",
+                      false, outfile);
+    opt_parse.add_opt("bed", 'b', "sorted single end BED file",
+                      false, bed_file);
+    opt_parse.add_opt("pe_bed", 'p', "sorted paired end BED file",
+                      false, pe_bed_file);
+#ifdef HAVE_SAMTOOLS
+    opt_parse.add_opt("bam", 'B', "sorted single end BAM file",
+                      false, bam_file);
+    opt_parse.add_opt("pe_bam", 'P', "sorted paired end BAM file",
+                      false, pe_bam_file);
+#endif
+    opt_parse.add_opt("hist", 'H', "histogram for the estimator benchmarks "
+                      "(default: that of the BED file)", false, hist_file);
+    opt_parse.add_opt("runs", 'r', "timed runs of each benchmark (default: "
+                      + toa(runs) + ")", false, runs);
+    opt_parse.add_opt("min_time", 't', "least seconds in a run of the "
+                      "estimator benchmarks (default: "
+                      + toa(min_run_seconds) + ")", false, min_run_seconds);
+    opt_parse.add_opt("threads", 'T', "threads for the BED loaders "
+                      "(default: " + toa(n_threads) + ")", false, n_threads);
+    opt_parse.add_opt("no_full", 'F', "skip the full lc_extrap, gc_extrap "
+                      "and bound_pop runs", false, NO_FULL_RUNS);
+    opt_parse.add_opt("verbose", 'v', "print each result as it is measured",
+                      false, VERBOSE);
+
+    vector<string> leftover_args;
+    opt_parse.parse(argc, argv, leftover_args);
+    if (argc < 2 || opt_parse.help_requested()) {
+      cerr << opt_parse.help_message() << endl
+           << opt_parse.about_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.about_requested()) {
+      cerr << opt_parse.about_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.option_missing()) {
+      cerr << opt_parse.option_missing_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    /****************** END COMMAND LINE OPTIONS *****************/
+
+    if (runs == 0)
+      throw SMITHLABException("at least one run is needed");
+    if (bed_file.empty() && hist_file.empty())
+      throw SMITHLABException("the estimator benchmarks need a BED file "
+                              "or a histogram");
+
+    gsl_rng_env_setup();
+
+    vector<BenchResult> results;
+    bench_loaders(VERBOSE, runs, n_threads, bed_file, pe_bed_file,
+                  bam_file, pe_bam_file, results);
+
+    vector<double> hist;
+    if (!hist_file.empty())
+      load_histogram(hist_file, hist);
+    else
+      load_counts_BED_se(bed_file, n_threads, hist);
+    bench_kernels(VERBOSE, runs, min_run_seconds,
+                  hist_file.empty() ? bed_file : hist_file, hist, results);
+
+    if (!NO_FULL_RUNS && !bed_file.empty())
+      bench_full_runs(VERBOSE, runs, n_threads, bed_file, results);
+
+    write_results(outfile, n_threads, results);
+  }
+  catch (const SMITHLABException &e) {
+    cerr << "ERROR:\t" << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (std::bad_alloc &ba) {
+    cerr << "ERROR: could not allocate memory" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
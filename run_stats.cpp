@@ -0,0 +1,244 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "run_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <sys/resource.h>
+
+#include "buffered_output.hpp"
+
+using std::string;
+using std::vector;
+using std::pair;
+
+
+static double
+seconds_since(const std::chrono::steady_clock::time_point &start) {
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+
+RunStats::RunStats() : start_time(std::chrono::steady_clock::now()) {}
+
+
+RunStats::PhaseTime &
+RunStats::phase_time(const string &phase) {
+  for (size_t i = 0; i < phases.size(); ++i)
+    if (phases[i].name == phase)
+      return phases[i];
+  phases.push_back(PhaseTime());
+  phases.back().name = phase;
+  return phases.back();
+}
+
+
+void
+RunStats::add_time(const string &phase, const double wall_seconds,
+                   const double cpu_seconds) {
+  std::lock_guard<std::mutex> lock(mtx);
+  PhaseTime &t = phase_time(phase);
+  t.wall_seconds += wall_seconds;
+  t.cpu_seconds += cpu_seconds;
+  ++t.calls;
+}
+
+
+void
+RunStats::add_share(const string &share, const double wall_seconds) {
+  std::lock_guard<std::mutex> lock(mtx);
+  PhaseTime &t = phase_time(share);
+  t.wall_seconds += wall_seconds;
+  ++t.calls;
+  t.SHARE = true;
+}
+
+
+void
+RunStats::set_info(const string &key, const string &value) {
+  std::lock_guard<std::mutex> lock(mtx);
+  info.push_back(std::make_pair(key, value));
+}
+
+
+// the counter named c, appended at zero if it is new
+static double &
+find_counter(vector<pair<string, double> > &counters, const string &c) {
+  for (size_t i = 0; i < counters.size(); ++i)
+    if (counters[i].first == c)
+      return counters[i].second;
+  counters.push_back(std::make_pair(c, 0.0));
+  return counters.back().second;
+}
+
+
+void
+RunStats::add(const string &c, const double x) {
+  std::lock_guard<std::mutex> lock(mtx);
+  find_counter(counters, c) += x;
+}
+
+
+void
+RunStats::set(const string &c, const double x) {
+  std::lock_guard<std::mutex> lock(mtx);
+  find_counter(counters, c) = x;
+}
+
+
+void
+RunStats::raise_to(const string &c, const double x) {
+  std::lock_guard<std::mutex> lock(mtx);
+  double &value = find_counter(counters, c);
+  value = std::max(value, x);
+}
+
+
+void
+RunStats::add_cf_degree(const size_t degree) {
+  std::lock_guard<std::mutex> lock(mtx);
+  ++cf_degrees[degree];
+}
+
+
+double
+RunStats::wall_seconds(const string &phase) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  for (size_t i = 0; i < phases.size(); ++i)
+    if (phases[i].name == phase)
+      return phases[i].wall_seconds;
+  return 0.0;
+}
+
+
+double
+RunStats::counter(const string &c) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  for (size_t i = 0; i < counters.size(); ++i)
+    if (counters[i].first == c)
+      return counters[i].second;
+  return 0.0;
+}
+
+
+void
+RunStats::write_json(const string &filename) const {
+  std::lock_guard<std::mutex> lock(mtx);
+  BufferedOutput out(filename);
+  out << "{\n";
+  for (size_t i = 0; i < info.size(); ++i)
+    out << "  " << json_string(info[i].first) << ": "
+        << json_string(info[i].second) << ",\n";
+  out << "  \"wall_seconds\": " << json_number(seconds_since(start_time))
+      << ",\n"
+      << "  \"cpu_seconds\": "
+      << json_number(static_cast<double>(std::clock())/CLOCKS_PER_SEC)
+      << ",\n"
+      << "  \"peak_rss_bytes\": " << peak_rss_bytes() << ",\n"
+      << "  \"phases\": {";
+  for (size_t i = 0; i < phases.size(); ++i) {
+    const PhaseTime &t = phases[i];
+    out << (i == 0 ? "\n" : ",\n")
+        << "    " << json_string(t.name) << ": {\"wall_seconds\": "
+        << json_number(t.wall_seconds);
+    if (!t.SHARE)
+      out << ", \"cpu_seconds\": " << json_number(t.cpu_seconds);
+    out << ", \"calls\": " << t.calls << "}";
+  }
+  out << "\n  },\n"
+      << "  \"counters\": {";
+  for (size_t i = 0; i < counters.size(); ++i)
+    out << (i == 0 ? "\n" : ",\n") << "    " << json_string(counters[i].first)
+        << ": " << json_number(counters[i].second);
+  out << "\n  },\n"
+      << "  \"cf_degrees\": {";
+  for (std::map<size_t, size_t>::const_iterator i = cf_degrees.begin();
+       i != cf_degrees.end(); ++i)
+    out << (i == cf_degrees.begin() ? "\n" : ",\n")
+        << "    \"" << i->first << "\": " << i->second;
+  out << "\n  }\n}\n";
+  out.close();
+}
+
+
+PhaseTimer::PhaseTimer(RunStats *s, const string &p) :
+  stats(s), phase(stats ? p : string()), start_cpu(0) {
+  if (stats) {
+    start_wall = std::chrono::steady_clock::now();
+    start_cpu = std::clock();
+  }
+}
+
+
+void
+PhaseTimer::stop() {
+  if (stats)
+    stats->add_time(phase, seconds_since(start_wall),
+                    static_cast<double>(std::clock() - start_cpu)/
+                    CLOCKS_PER_SEC);
+  stats = NULL;
+}
+
+
+size_t
+peak_rss_bytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  // bytes on Darwin, kilobytes elsewhere
+  return usage.ru_maxrss;
+#else
+  return static_cast<size_t>(usage.ru_maxrss)*1024;
+#endif
+}
+
+
+string
+json_string(const string &s) {
+  string quoted = "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\')
+      quoted += '\\';
+    if (static_cast<unsigned char>(s[i]) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", s[i]);
+      quoted += escaped;
+    }
+    else quoted += s[i];
+  }
+  return quoted + "\"";
+}
+
+
+string
+json_number(const double x) {
+  if (!std::isfinite(x))
+    return "null";
+  char formatted[32];
+  // counts are written in full
+  if (x == std::floor(x) && std::fabs(x) < 1e15)
+    snprintf(formatted, sizeof(formatted), "%.0f", x);
+  else snprintf(formatted, sizeof(formatted), "%.6g", x);
+  return formatted;
+}
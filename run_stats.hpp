@@ -0,0 +1,132 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RUN_STATS_HPP
+#define RUN_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+
+// Timings and counters of one run, as written by --stats-json. A phase
+// may be entered many times (the continued fraction search runs once
+// per bootstrap) and adds up its wall and CPU seconds; shares are parts
+// of a phase timed inside a loop, such as the decoding of records while
+// loading, and have wall seconds only. The CPU seconds are those of the
+// whole process, so they include any threads the phase starts.
+class RunStats {
+public:
+  RunStats();
+
+  void add_time(const std::string &phase, const double wall_seconds,
+                const double cpu_seconds);
+  void add_share(const std::string &share, const double wall_seconds);
+
+  void set_info(const std::string &key, const std::string &value);
+  void add(const std::string &counter, const double x);
+  void set(const std::string &counter, const double x);
+  // for high-water marks: the counter becomes x if x is larger
+  void raise_to(const std::string &counter, const double x);
+  void add_cf_degree(const size_t degree);
+
+  double wall_seconds(const std::string &phase) const;
+  double counter(const std::string &counter) const;
+
+  // adds the peak resident set size and seconds since construction
+  void write_json(const std::string &filename) const;
+
+private:
+  struct PhaseTime {
+    PhaseTime() : wall_seconds(0.0), cpu_seconds(0.0), calls(0),
+                  SHARE(false) {}
+    std::string name;
+    double wall_seconds;
+    double cpu_seconds;
+    size_t calls;
+    bool SHARE;
+  };
+  PhaseTime &phase_time(const std::string &phase);
+
+  mutable std::mutex mtx;
+  const std::chrono::steady_clock::time_point start_time;
+  // in the order first entered
+  std::vector<PhaseTime> phases;
+  std::vector<std::pair<std::string, std::string> > info;
+  std::vector<std::pair<std::string, double> > counters;
+  std::map<size_t, size_t> cf_degrees;
+};
+
+
+// times a phase from construction to destruction, or to stop() if
+// that comes first; does nothing if stats is NULL
+class PhaseTimer {
+public:
+  PhaseTimer(RunStats *s, const std::string &p);
+  ~PhaseTimer() {stop();}
+  void stop();
+
+private:
+  PhaseTimer(const PhaseTimer &);
+  PhaseTimer &operator=(const PhaseTimer &);
+
+  RunStats *stats;
+  const std::string phase;
+  std::chrono::steady_clock::time_point start_wall;
+  std::clock_t start_cpu;
+};
+
+
+// wall seconds of one step of a loop, summed locally so timing each
+// pass costs two clock reads; does nothing unless ON
+class StopWatch {
+public:
+  StopWatch(const bool on) : ON(on), seconds(0.0) {}
+  void start() {
+    if (ON)
+      begin = std::chrono::steady_clock::now();
+  }
+  void stop() {
+    if (ON)
+      seconds += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - begin).count();
+  }
+
+  const bool ON;
+  double seconds;
+
+private:
+  std::chrono::steady_clock::time_point begin;
+};
+
+
+// peak resident set size of the process in bytes, 0 if not known
+size_t
+peak_rss_bytes();
+
+// JSON literals; non-finite numbers become null
+std::string
+json_string(const std::string &s);
+
+std::string
+json_number(const double x);
+
+#endif
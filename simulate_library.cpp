@@ -0,0 +1,471 @@
+/*    simulate_library: synthetic sorted BED and BAM libraries for
+ *    benchmarking preseq
+ *
+ *    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <stdint.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#include "OptionParser.hpp"
+#include "smithlab_utils.hpp"
+#include "smithlab_os.hpp"
+
+#include "buffered_output.hpp"
+
+#ifdef HAVE_SAMTOOLS
+#include "sam.h"
+#endif
+
+using std::string;
+using std::vector;
+using std::cerr;
+using std::endl;
+using std::min;
+using std::max;
+
+// The library is a set of molecules, each at a uniform position in a
+// genome of equal chromosomes and with an abundance drawn from the
+// chosen distribution. Sequencing n reads draws a Poisson number of
+// copies of each molecule with mean proportional to its abundance, so
+// with equal abundances (poisson) the duplicate counts are Poisson,
+// with gamma abundances (negbin) they are negative binomial, and
+// lognormal abundances give the heavier tails of amplified libraries.
+// A fraction of the molecules is sequenced from both ends: in BED
+// output such a molecule is one line for the whole fragment, as read
+// by lc_extrap -P, and in BAM output it is a properly paired read1 and
+// read2. The bases of every read come from a virtual reference, so
+// copies and overlapping reads agree.
+
+struct SimParams {
+  size_t n_reads;
+  size_t n_molecules;
+  string distribution;
+  double shape;
+  double sigma;
+  double pe_fraction;
+  size_t read_len;
+  double frag_mean;
+  double frag_sd;
+  size_t n_chroms;
+  size_t chrom_len;
+};
+
+struct Molecule {
+  uint32_t chrom;
+  uint32_t start;
+  uint32_t frag_len;
+  uint32_t count;
+  bool rev;
+  bool PAIRED;
+};
+
+// one line of BED, or one mate of a molecule in BAM
+struct SimRecord {
+  uint32_t chrom;
+  uint32_t start;
+  uint32_t end;
+  uint32_t molecule;
+  // 0 for a single end read or a BED fragment, 1 and 2 for the mates
+  uint8_t mate;
+  bool rev;
+
+  bool operator<(const SimRecord &other) const {
+    if (chrom != other.chrom) return chrom < other.chrom;
+    if (start != other.start) return start < other.start;
+    if (end != other.end) return end < other.end;
+    if (rev != other.rev) return rev < other.rev;
+    if (molecule != other.molecule) return molecule < other.molecule;
+    return mate < other.mate;
+  }
+};
+
+
+static double
+draw_abundance(const gsl_rng *rng, const SimParams &params) {
+  if (params.distribution == "poisson")
+    return 1.0;
+  if (params.distribution == "negbin")
+    return gsl_ran_gamma(rng, params.shape, 1.0/params.shape);
+  return gsl_ran_lognormal(rng, 0.0, params.sigma);
+}
+
+
+// the molecules seen at least once; returns the number of reads
+static size_t
+sequence_library(const gsl_rng *rng, const SimParams &params,
+                 vector<Molecule> &molecules) {
+  vector<double> abundance(params.n_molecules);
+  for (size_t i = 0; i < abundance.size(); ++i)
+    abundance[i] = draw_abundance(rng, params);
+  const double total_abundance =
+    std::accumulate(abundance.begin(), abundance.end(), 0.0);
+
+  const size_t max_frag = params.chrom_len - 1;
+  const size_t min_frag = min(params.read_len, max_frag);
+  size_t n_reads = 0;
+  molecules.clear();
+  for (size_t i = 0; i < abundance.size(); ++i) {
+    const unsigned int count =
+      gsl_ran_poisson(rng, params.n_reads*abundance[i]/total_abundance);
+    if (count == 0)
+      continue;
+    Molecule m;
+    m.count = count;
+    m.PAIRED = gsl_rng_uniform(rng) < params.pe_fraction;
+    m.rev = gsl_rng_uniform(rng) < 0.5;
+    const double frag =
+      params.frag_mean + gsl_ran_gaussian(rng, params.frag_sd);
+    m.frag_len = static_cast<uint32_t>(
+      min(static_cast<double>(max_frag),
+          max(static_cast<double>(min_frag), floor(frag))));
+    m.chrom = gsl_rng_uniform_int(rng, params.n_chroms);
+    m.start = gsl_rng_uniform_int(rng, params.chrom_len - m.frag_len);
+    molecules.push_back(m);
+    n_reads += count;
+  }
+  return n_reads;
+}
+
+
+static void
+make_records(const SimParams &params, const bool BAM_OUTPUT,
+             const vector<Molecule> &molecules, vector<SimRecord> &records) {
+  records.clear();
+  for (size_t i = 0; i < molecules.size(); ++i) {
+    const Molecule &m = molecules[i];
+    SimRecord r;
+    r.chrom = m.chrom;
+    r.molecule = i;
+    const uint32_t frag_end = m.start + m.frag_len;
+    const uint32_t read_len = min<uint32_t>(params.read_len, m.frag_len);
+    if (m.PAIRED && BAM_OUTPUT) {
+      // read1 is the mate on the strand of the molecule
+      r.start = m.start;
+      r.end = m.start + read_len;
+      r.rev = false;
+      r.mate = m.rev ? 2 : 1;
+      records.push_back(r);
+      r.start = frag_end - read_len;
+      r.end = frag_end;
+      r.rev = true;
+      r.mate = m.rev ? 1 : 2;
+      records.push_back(r);
+    }
+    else {
+      r.mate = 0;
+      r.rev = m.rev;
+      if (m.PAIRED) {
+        r.start = m.start;
+        r.end = frag_end;
+      }
+      else if (m.rev) {
+        r.start = frag_end - read_len;
+        r.end = frag_end;
+      }
+      else {
+        r.start = m.start;
+        r.end = m.start + read_len;
+      }
+      records.push_back(r);
+    }
+  }
+  std::sort(records.begin(), records.end());
+}
+
+
+// chromosome names sort in the same order as their numbers
+static string
+chrom_name(const size_t n_chroms, const size_t chrom) {
+  const int width = static_cast<int>(toa(n_chroms).size());
+  char name[32];
+  snprintf(name, sizeof(name), "chr%0*zu", width, chrom + 1);
+  return name;
+}
+
+
+static void
+write_bed(const string &outfile, const SimParams &params,
+          const vector<Molecule> &molecules,
+          const vector<SimRecord> &records) {
+  vector<string> names(params.n_chroms);
+  for (size_t i = 0; i < names.size(); ++i)
+    names[i] = chrom_name(params.n_chroms, i);
+
+  BufferedOutput out(outfile);
+  for (size_t i = 0; i < records.size(); ++i) {
+    const SimRecord &r = records[i];
+    const char strand = r.rev ? '-' : '+';
+    for (size_t j = 0; j < molecules[r.molecule].count; ++j)
+      out << names[r.chrom] << '\t' << r.start << '\t' << r.end << '\t'
+          << "sim" << r.molecule << '_' << j << '\t' << 0 << '\t'
+          << strand << '\n';
+  }
+  out.close();
+}
+
+
+#ifdef HAVE_SAMTOOLS
+
+// the base at a position of the virtual reference
+static char
+reference_base(const uint32_t chrom, const uint32_t pos) {
+  uint64_t z = (static_cast<uint64_t>(chrom) << 32 | pos)
+    + 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+  return "ACGT"[(z ^ (z >> 31)) & 3];
+}
+
+
+static void
+fill_bam_record(const SimRecord &r, const Molecule &m, const string &name,
+                bam1_t *b) {
+  const uint32_t len = r.end - r.start;
+  const uint32_t frag_end = m.start + m.frag_len;
+
+  bam1_core_t &c = b->core;
+  c.tid = r.chrom;
+  c.pos = r.start;
+  c.bin = bam_reg2bin(r.start, r.end);
+  c.qual = 60;
+  c.l_qname = name.size() + 1;
+  c.n_cigar = 1;
+  c.l_qseq = len;
+  c.flag = r.rev ? BAM_FREVERSE : 0;
+  c.mtid = -1;
+  c.mpos = -1;
+  c.isize = 0;
+  if (r.mate != 0) {
+    c.flag |= BAM_FPAIRED | BAM_FPROPER_PAIR |
+      (r.mate == 1 ? BAM_FREAD1 : BAM_FREAD2) |
+      (r.rev ? 0 : BAM_FMREVERSE);
+    c.mtid = r.chrom;
+    c.mpos = r.rev ? m.start : frag_end - len;
+    c.isize = r.rev ? -static_cast<int32_t>(m.frag_len) : m.frag_len;
+  }
+
+  b->l_aux = 0;
+  b->data_len = c.l_qname + 4*c.n_cigar + (len + 1)/2 + len;
+  if (b->m_data < b->data_len) {
+    b->m_data = b->data_len;
+    kroundup32(b->m_data);
+    b->data = static_cast<uint8_t *>(realloc(b->data, b->m_data));
+  }
+  memcpy(b->data, name.c_str(), c.l_qname);
+  const uint32_t cigar = len << BAM_CIGAR_SHIFT | BAM_CMATCH;
+  memcpy(bam1_cigar(b), &cigar, 4);
+  uint8_t *seq = bam1_seq(b);
+  memset(seq, 0, (len + 1)/2);
+  for (uint32_t i = 0; i < len; ++i) {
+    const uint8_t code = bam_nt16_table[static_cast<int>(
+      reference_base(r.chrom, r.start + i))];
+    seq[i/2] |= (i % 2 == 0) ? code << 4 : code;
+  }
+  memset(bam1_qual(b), 40, len);
+}
+
+
+static void
+write_bam(const string &outfile, const SimParams &params,
+          const vector<Molecule> &molecules,
+          const vector<SimRecord> &records) {
+  bam_header_t *header = bam_header_init();
+  header->n_targets = params.n_chroms;
+  header->target_name =
+    static_cast<char **>(calloc(params.n_chroms, sizeof(char *)));
+  header->target_len =
+    static_cast<uint32_t *>(calloc(params.n_chroms, sizeof(uint32_t)));
+  string text = "@HD\tVN:1.0\tSO:coordinate\n";
+  for (size_t i = 0; i < params.n_chroms; ++i) {
+    const string name = chrom_name(params.n_chroms, i);
+    header->target_name[i] = strdup(name.c_str());
+    header->target_len[i] = params.chrom_len;
+    text += "@SQ\tSN:" + name + "\tLN:" + toa(params.chrom_len) + "\n";
+  }
+  header->l_text = text.size();
+  header->text = strdup(text.c_str());
+
+  samfile_t *out = samopen(outfile.c_str(), "wb", header);
+  if (out == NULL) {
+    bam_header_destroy(header);
+    throw SMITHLABException("could not open output file: " + outfile);
+  }
+
+  bam1_t *b = bam_init1();
+  bool GOOD = true;
+  for (size_t i = 0; i < records.size() && GOOD; ++i) {
+    const SimRecord &r = records[i];
+    const Molecule &m = molecules[r.molecule];
+    for (size_t j = 0; j < m.count && GOOD; ++j) {
+      fill_bam_record(r, m, "sim" + toa(r.molecule) + "_" + toa(j), b);
+      GOOD = samwrite(out, b) >= 0;
+    }
+  }
+  bam_destroy1(b);
+  samclose(out);
+  bam_header_destroy(header);
+  if (!GOOD)
+    throw SMITHLABException("failed to write output: " + outfile);
+}
+
+#endif
+
+
+int
+main(int argc, const char **argv) {
+  try {
+    string outfile;
+    SimParams params;
+    params.n_reads = 1000000;
+    params.n_molecules = 0;
+    params.distribution = "negbin";
+    params.shape = 1.0;
+    params.sigma = 1.0;
+    params.pe_fraction = 0.0;
+    params.read_len = 100;
+    params.frag_mean = 300.0;
+    params.frag_sd = 50.0;
+    params.n_chroms = 24;
+    double genome_size = 3e9;
+    unsigned long int seed = 1;
+    bool BAM_OUTPUT = false;
+    bool VERBOSE = false;
+
+    /****************** COMMAND LINE OPTIONS ********************/
+    OptionParser opt_parse(strip_path(argv[0]),
+                           "simulate a sorted library for benchmarks", "");
+    opt_parse.add_opt("output", 'o', "output file", true, outfile);
+    opt_parse.add_opt("reads", 'n', "expected number of reads (default: "
+                      + toa(params.n_reads) + ")", false, params.n_reads);
+    opt_parse.add_opt("molecules", 'm', "distinct molecules in the library "
+                      "(default: twice the reads)", false,
+                      params.n_molecules);
+    opt_parse.add_opt("dist", 'd', "abundance distribution: poisson, "
+                      "negbin or lognormal (default: "
+                      + params.distribution + ")", false,
+                      params.distribution);
+    opt_parse.add_opt("shape", 'k', "shape of the negbin abundances, "
+                      "smaller is more skewed (default: "
+                      + toa(params.shape) + ")", false, params.shape);
+    opt_parse.add_opt("sigma", 's', "log standard deviation of the "
+                      "lognormal abundances (default: "
+                      + toa(params.sigma) + ")", false, params.sigma);
+    opt_parse.add_opt("pe", 'P', "fraction of molecules sequenced from "
+                      "both ends (default: " + toa(params.pe_fraction) + ")",
+                      false, params.pe_fraction);
+    opt_parse.add_opt("read_len", 'l', "read length (default: "
+                      + toa(params.read_len) + ")", false, params.read_len);
+    opt_parse.add_opt("frag_len", 'f', "mean fragment length (default: "
+                      + toa(params.frag_mean) + ")", false, params.frag_mean);
+    opt_parse.add_opt("frag_sd", 'F', "standard deviation of fragment "
+                      "length (default: " + toa(params.frag_sd) + ")",
+                      false, params.frag_sd);
+    opt_parse.add_opt("chroms", 'c', "number of chromosomes (default: "
+                      + toa(params.n_chroms) + ")", false, params.n_chroms);
+    opt_parse.add_opt("genome", 'g', "genome size (default: "
+                      + toa(genome_size) + ")", false, genome_size);
+#ifdef HAVE_SAMTOOLS
+    opt_parse.add_opt("bam", 'B', "write BAM instead of BED",
+                      false, BAM_OUTPUT);
+#endif
+    opt_parse.add_opt("seed", 'r', "seed for random number generator "
+                      "(default: " + toa(seed) + ")", false, seed);
+    opt_parse.add_opt("verbose", 'v', "print more information",
+                      false, VERBOSE);
+
+    vector<string> leftover_args;
+    opt_parse.parse(argc, argv, leftover_args);
+    if (argc < 2 || opt_parse.help_requested()) {
+      cerr << opt_parse.help_message() << endl
+           << opt_parse.about_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.about_requested()) {
+      cerr << opt_parse.about_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    if (opt_parse.option_missing()) {
+      cerr << opt_parse.option_missing_message() << endl;
+      return EXIT_SUCCESS;
+    }
+    /****************** END COMMAND LINE OPTIONS *****************/
+
+    if (params.distribution != "poisson" && params.distribution != "negbin" &&
+        params.distribution != "lognormal")
+      throw SMITHLABException("unknown distribution: " + params.distribution);
+    if (params.n_molecules == 0)
+      params.n_molecules = 2*params.n_reads;
+    if (params.n_chroms == 0 || params.read_len == 0 ||
+        params.shape <= 0.0 || params.sigma <= 0.0 ||
+        params.pe_fraction < 0.0 || params.pe_fraction > 1.0)
+      throw SMITHLABException("bad simulation parameters");
+    params.chrom_len = static_cast<size_t>(genome_size/params.n_chroms);
+    if (params.chrom_len <= params.frag_mean + params.read_len ||
+        params.chrom_len > std::numeric_limits<int32_t>::max())
+      throw SMITHLABException("chromosomes must be longer than fragments "
+                              "and shorter than 2^31");
+
+    gsl_rng_env_setup();
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_default);
+    gsl_rng_set(rng, seed);
+
+    vector<Molecule> molecules;
+    const size_t n_reads = sequence_library(rng, params, molecules);
+    gsl_rng_free(rng);
+
+    vector<SimRecord> records;
+    make_records(params, BAM_OUTPUT, molecules, records);
+
+    if (VERBOSE)
+      cerr << "MOLECULES       = " << params.n_molecules << endl
+           << "OBSERVED        = " << molecules.size() << endl
+           << "READS           = " << n_reads << endl
+           << "RECORDS         = " << records.size() << endl;
+
+#ifdef HAVE_SAMTOOLS
+    if (BAM_OUTPUT)
+      write_bam(outfile, params, molecules, records);
+    else
+#endif
+      write_bed(outfile, params, molecules, records);
+  }
+  catch (const SMITHLABException &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (std::bad_alloc &ba) {
+    cerr << "ERROR: could not allocate memory" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread_pool.hpp"
+
+using std::function;
+
+
+// the pool and queue of the pool thread running this, if any
+static thread_local const WorkStealingPool *current_pool = NULL;
+static thread_local size_t current_queue = 0;
+
+
+WorkStealingPool::WorkStealingPool(const size_t n_threads) :
+  next_queue(0), n_queued(0), n_unfinished(0), STOP(false) {
+  const size_t n = (n_threads == 0) ? 1 : n_threads;
+  for (size_t i = 0; i < n; ++i)
+    queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue));
+  for (size_t i = 0; i < n; ++i)
+    threads.push_back(std::thread(&WorkStealingPool::run, this, i));
+}
+
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    STOP = true;
+  }
+  work_cv.notify_all();
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+}
+
+
+void
+WorkStealingPool::submit(const function<void()> &task) {
+  const size_t id = (current_pool == this) ? current_queue :
+    next_queue++ % queues.size();
+  {
+    std::lock_guard<std::mutex> lock(queues[id]->mtx);
+    queues[id]->tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ++n_queued;
+    ++n_unfinished;
+  }
+  work_cv.notify_one();
+}
+
+
+// the back of the thread's own queue, or else the front of another's
+bool
+WorkStealingPool::take(const size_t id, function<void()> &task) {
+  {
+    std::lock_guard<std::mutex> lock(queues[id]->mtx);
+    if (!queues[id]->tasks.empty()) {
+      task.swap(queues[id]->tasks.back());
+      queues[id]->tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues.size(); ++i) {
+    TaskQueue &victim = *queues[(id + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mtx);
+    if (!victim.tasks.empty()) {
+      task.swap(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void
+WorkStealingPool::run(const size_t id) {
+  current_pool = this;
+  current_queue = id;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      work_cv.wait(lock, [this] {return n_queued > 0 || STOP;});
+      if (n_queued == 0)
+        return;
+      --n_queued;
+    }
+    // a task was claimed above and only claimed tasks are taken, so one
+    // is still in some queue, though other threads may move it first
+    function<void()> task;
+    while (!take(id, task))
+      std::this_thread::yield();
+
+    try {
+      task();
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!error)
+        error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (--n_unfinished == 0)
+      done_cv.notify_all();
+  }
+}
+
+
+void
+WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> lock(mtx);
+  done_cv.wait(lock, [this] {return n_unfinished == 0;});
+  if (error) {
+    std::exception_ptr e;
+    std::swap(e, error);
+    std::rethrow_exception(e);
+  }
+}
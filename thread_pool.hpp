@@ -0,0 +1,77 @@
+/*    Copyright (C) 2014 University of Southern California and
+ *                       Andrew D. Smith and Timothy Daley
+ *
+ *    Authors: Andrew D. Smith and Timothy Daley
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Runs tasks on a fixed set of threads, each with its own deque of
+// tasks. A task submitted from one of the threads goes on the back of
+// that thread's deque, and each thread takes its next task from the
+// back of its own deque, so the work a task creates is done next by
+// the same thread; a thread with nothing left steals from the front of
+// another's deque, taking the oldest and usually largest pieces of
+// work. Tasks submitted from outside are dealt out in turn.
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(const size_t n_threads);
+  ~WorkStealingPool();
+
+  size_t size() const {return threads.size();}
+
+  void submit(const std::function<void()> &task);
+  // blocks until every task submitted so far, and every task those
+  // submit, has run; rethrows the first exception a task threw. Must
+  // not be called from a task.
+  void wait();
+
+private:
+  struct TaskQueue {
+    std::mutex mtx;
+    std::deque<std::function<void()> > tasks;
+  };
+
+  void run(const size_t id);
+  bool take(const size_t id, std::function<void()> &task);
+
+  std::vector<std::unique_ptr<TaskQueue> > queues;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next_queue;
+
+  // n_queued counts tasks sitting in the queues that no thread has
+  // claimed yet, n_unfinished those submitted and not yet run
+  std::mutex mtx;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  size_t n_queued;
+  size_t n_unfinished;
+  bool STOP;
+  std::exception_ptr error;
+};
+
+#endif